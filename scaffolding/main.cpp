@@ -30,6 +30,9 @@ __attribute__((export_name("entry"))) int entry() {
 
   tower_tests();
   parser_tests();
+#ifdef TOWER_BENCHMARKS
+  tower_benchmarks();
+#endif
 
   char* default_triple = LLVMGetDefaultTargetTriple();
   printf("Current target triple for the native system: %s\n", default_triple);
@@ -159,6 +159,73 @@ void parser_tests() {
 
   assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
 
+  // Save a grammar to a snapshot, and load it back (the components all have registered types)
+  {
+    TowerNode* rules = tower_node_create();
+    TowerNode* rule = parser_rule_create_subtree(rules, "A", true);
+    parser_reference_create_subtree(rule, "B");
+    parser_string_create_subtree_utf8_null_terminated(rule, "xyz");
+    parser_range_create_subtree(rule, 'a', 'z');
+
+    size_t bytes = 0;
+    void* data = tower_snapshot_create(rules, &bytes);
+    tower_node_release_ref(rules);
+    const TowerSnapshot* snapshot = tower_snapshot_view(data, bytes);
+    assert(snapshot);
+    assert(tower_snapshot_get_node_count(snapshot) == 5);
+
+    TowerArena* arena = tower_arena_create();
+    TowerNode* loaded = tower_snapshot_instantiate(snapshot, arena);
+    assert(tower_node_get_child_count(loaded) == 1);
+    rule = tower_node_get_child(loaded, 0);
+    Rule* rule_component = (Rule*)tower_node_get_component_userdata(rule, parser_rule_get_type());
+    assert(strcmp(parser_rule_get_name(rule_component), "A") == 0);
+    assert(parser_rule_get_generated(rule_component));
+    Reference* reference = (Reference*)tower_node_get_component_userdata(tower_node_get_child(rule, 0), parser_reference_get_type());
+    assert(strcmp(parser_reference_get_name(reference), "B") == 0);
+    String* string = (String*)tower_node_get_component_userdata(tower_node_get_child(rule, 1), parser_string_get_type());
+    assert(parser_string_get_length(string) == 3);
+    assert(parser_string_get_id(string, 2) == U'z');
+    Range* range = (Range*)tower_node_get_component_userdata(tower_node_get_child(rule, 2), parser_range_get_type());
+    assert(parser_range_get_start(range) == 'a');
+    assert(parser_range_get_end(range) == 'z');
+
+    tower_arena_destroy(arena);
+    tower_memory_free(data);
+  }
+
+  assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
+
+  // Run a recognizer with it's parse nodes allocated in an arena, which tears them all down at once
+  // token A = 'a' 'b';
+  {
+    TowerNode* token_rules = tower_node_create();
+    TowerNode* a = parser_rule_create_subtree(token_rules, "A", false);
+    parser_string_create_subtree_utf8_null_terminated(a, "ab");
+    Table* table = parser_table_create(token_rules, nullptr, nullptr, parser_table_utf8_id_to_string);
+    Stream* stream = parser_stream_utf8_null_terminated_create("ab");
+    Recognizer* recognizer = parser_recognizer_create(table, stream);
+    TowerArena* arena = tower_arena_create();
+    parser_recognizer_set_arena(recognizer, arena);
+
+    const size_t node_count = tower_node_get_allocated_count();
+    bool running = true;
+    for (size_t i = 0; running && i < 16; ++i) {
+      parser_recognizer_step(recognizer, &running);
+    }
+    assert(!running);
+    assert(tower_node_get_allocated_count() > node_count);
+
+    parser_recognizer_destroy(recognizer);
+    tower_arena_destroy(arena);
+    assert(tower_node_get_allocated_count() == node_count);
+    parser_stream_destroy(stream);
+    parser_table_destroy(table);
+    tower_node_release_ref(token_rules);
+  }
+
+  assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
+
   // Test infinite recursion (rules with no base case)
   // Test missing rules (which we actually want to be able to iteratively add rules and have it work...)
   // Test orphaned rules (no references to them)
@@ -503,12 +570,56 @@ void parser_tests() {
   assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
 }
 
+// Memory the parser allocates is counted by what it's used for (see tower_memory_get_stats)
+TowerMemoryCategory parser_memory_tables = tower_memory_category_create("parser tables");
+TowerMemoryCategory parser_memory_recognizers = tower_memory_category_create("parser recognizers");
+TowerMemoryCategory parser_memory_streams = tower_memory_category_create("parser streams");
+TowerMemoryCategory parser_memory_strings = tower_memory_category_create("parser strings");
+
+// Lets std containers count their memory towards a category
+template <typename T>
+struct ParserTaggedAllocator {
+  typedef T value_type;
+  TowerMemoryCategory category = TOWER_MEMORY_CATEGORY_GENERAL;
+
+  ParserTaggedAllocator(TowerMemoryCategory category) : category(category) {}
+
+  template <typename U>
+  ParserTaggedAllocator(const ParserTaggedAllocator<U>& other) : category(other.category) {}
+
+  T* allocate(size_t count) {
+    return (T*)tower_memory_allocate_tagged(count * sizeof(T), category);
+  }
+
+  void deallocate(T* memory, size_t) {
+    tower_memory_free(memory);
+  }
+
+  template <typename U>
+  bool operator==(const ParserTaggedAllocator<U>& other) const {
+    return category == other.category;
+  }
+};
+
+// Names the parser's work in sampled allocation profiles for as long as it's in scope
+struct ParserProfileScope {
+  ParserProfileScope(const char* name) {
+    tower_profiler_push_scope(name);
+  }
+
+  ~ParserProfileScope() {
+    tower_profiler_pop_scope();
+  }
+};
+
+template <typename T>
+void destroy_component(TowerComponent* component, void* userdata) {
+  ((T*)userdata)->~T();
+}
+
 template <typename T>
 T* create_component(TowerNode* owner) {
-  TowerComponent* component =
-    tower_component_create(owner, T::compiletime_type, sizeof(T), [](TowerComponent* component, void* userdata) {
-      ((T*)userdata)->~T();
-    });
+  TowerComponent* component = tower_component_create(owner, T::compiletime_type, sizeof(T), destroy_component<T>);
 
 
   void* userdata = tower_component_get_userdata(component);
@@ -522,13 +633,45 @@ TowerNode* create_attached_child_without_ref(TowerNode* parent) {
   return child;
 }
 
+// Types live for the whole program and are shared by every component of the type, so they're frozen
+// to avoid reference count traffic on every component (and so that threads can share them)
+// Types are registered by name so that grammars can be saved and loaded as snapshots
+// A null serializer and deserializer copies the component as is (for trivially copyable components)
+template <typename T>
+TowerNode* create_compiletime_type(
+  const char* name,
+  TowerComponentSerialize serialize = nullptr,
+  TowerComponentDeserialize deserialize = nullptr) {
+  TowerNode* type = tower_node_create();
+  TowerTypeInfo info = { name, destroy_component<T>, serialize, deserialize, sizeof(T) };
+  tower_type_register(type, &info);
+  tower_node_freeze(type);
+  return type;
+}
+
 struct Rule {
   static TowerNode* compiletime_type;
   
   std::string name;
   bool generated = false;
 };
-TowerNode* Rule::compiletime_type = tower_node_create();
+
+void parser_rule_serialize(TowerComponent* component, void* userdata, TowerSnapshotWriter* writer) {
+  Rule* rule = (Rule*)userdata;
+  uint8_t generated = rule->generated;
+  tower_snapshot_writer_write(writer, &generated, sizeof(generated));
+  tower_snapshot_writer_write(writer, rule->name.data(), rule->name.size());
+}
+
+void parser_rule_deserialize(TowerComponent* component, void* userdata, const void* data, size_t bytes) {
+  assert(bytes >= 1);
+  const char* chars = (const char*)data;
+  Rule* rule = new (userdata) Rule();
+  rule->generated = chars[0] != 0;
+  rule->name.assign(chars + 1, bytes - 1);
+}
+
+TowerNode* Rule::compiletime_type = create_compiletime_type<Rule>("parser.Rule", parser_rule_serialize, parser_rule_deserialize);
 
 TowerNode* parser_rule_get_type() {
   return Rule::compiletime_type;
@@ -574,7 +717,19 @@ struct Reference {
   static TowerNode* compiletime_type;
   std::string name;
 };
-TowerNode* Reference::compiletime_type = tower_node_create();
+
+void parser_reference_serialize(TowerComponent* component, void* userdata, TowerSnapshotWriter* writer) {
+  Reference* reference = (Reference*)userdata;
+  tower_snapshot_writer_write(writer, reference->name.data(), reference->name.size());
+}
+
+void parser_reference_deserialize(TowerComponent* component, void* userdata, const void* data, size_t bytes) {
+  Reference* reference = new (userdata) Reference();
+  reference->name.assign((const char*)data, bytes);
+}
+
+TowerNode* Reference::compiletime_type =
+  create_compiletime_type<Reference>("parser.Reference", parser_reference_serialize, parser_reference_deserialize);
 
 TowerNode* parser_reference_get_type() {
   return Reference::compiletime_type;
@@ -604,7 +759,20 @@ struct String {
   static TowerNode* compiletime_type;
   std::vector<uint32_t> ids;
 };
-TowerNode* String::compiletime_type = tower_node_create();
+
+void parser_string_serialize(TowerComponent* component, void* userdata, TowerSnapshotWriter* writer) {
+  String* string = (String*)userdata;
+  tower_snapshot_writer_write(writer, string->ids.data(), string->ids.size() * sizeof(uint32_t));
+}
+
+void parser_string_deserialize(TowerComponent* component, void* userdata, const void* data, size_t bytes) {
+  assert(bytes % sizeof(uint32_t) == 0);
+  String* string = new (userdata) String();
+  string->ids.resize(bytes / sizeof(uint32_t));
+  memcpy(string->ids.data(), data, bytes);
+}
+
+TowerNode* String::compiletime_type = create_compiletime_type<String>("parser.String", parser_string_serialize, parser_string_deserialize);
 
 TowerNode* parser_string_get_type() {
   return String::compiletime_type;
@@ -769,7 +937,7 @@ struct Range {
   uint32_t start = '\0';
   uint32_t end = '\0';
 };
-TowerNode* Range::compiletime_type = tower_node_create();
+TowerNode* Range::compiletime_type = create_compiletime_type<Range>("parser.Range");
 
 TowerNode* parser_range_get_type() {
   return Range::compiletime_type;
@@ -813,7 +981,7 @@ struct Match {
   size_t start = 0;
   size_t length = 0;
 };
-TowerNode* Match::compiletime_type = tower_node_create();
+TowerNode* Match::compiletime_type = create_compiletime_type<Match>("parser.Match");
 
 TowerNode* parser_match_get_type() {
   return Match::compiletime_type;
@@ -869,7 +1037,7 @@ struct Stream {
 };
 
 Stream* parser_stream_create(size_t userdata_bytes, ParserStreamDestructor destructor, ParserStreamRead read) {
-  void* memory = tower_memory_allocate(sizeof(Stream) + userdata_bytes);
+  void* memory = tower_memory_allocate_tagged(sizeof(Stream) + userdata_bytes, parser_memory_streams);
   Stream* stream = new (memory) Stream();
   stream->destructor = destructor;
   stream->read = read;
@@ -972,7 +1140,7 @@ TowerNode* parser_stream_recognizer_read(
   } while (running && !node);
 
   if (node) {
-    Match* match = (Match*)tower_node_get_component_userdata(node, parser_match_get_type());
+    const Match* match = (const Match*)tower_node_get_component_userdata_for_read(node, parser_match_get_type());
     assert(match);
     *id = match->id;
     *start_index = match->start;
@@ -1107,7 +1275,7 @@ struct GrammarSymbolRef {
 
 struct GrammarRule {
   size_t index = (size_t)-1;
-  Rule* rule = nullptr;
+  const Rule* rule = nullptr;
   GrammarNonTerminal* non_terminal = nullptr;
   std::vector<GrammarSymbol> symbols;
 };
@@ -1123,17 +1291,19 @@ struct Grammar {
 };
 
 void parser_grammar_create(Grammar& grammar, TowerNode* root, void* userdata, ParserTableResolveReference resolve) {
-  std::vector<Rule*> rules;
-  rules.reserve(tower_node_get_child_count(root));
+  size_t rule_count = 0;
+  TowerNode* const* rule_nodes = tower_node_get_children(root, &rule_count);
+  std::vector<const Rule*> rules;
+  rules.reserve(rule_count);
 
   // Walk all the rules we have
-  for (size_t p = 0;; ++p) {
-    TowerNode* rule_node = tower_node_get_child(root, p);
+  for (size_t p = 0; p < rule_count; ++p) {
+    TowerNode* rule_node = rule_nodes[p];
+    // Skip the tombstones of detached rules
     if (!rule_node) {
-      break;
+      continue;
     }
-    
-    Rule* rule = (Rule*)tower_node_get_component_userdata(rule_node, parser_rule_get_type());
+    const Rule* rule = (const Rule*)tower_node_get_component_userdata_for_read(rule_node, parser_rule_get_type());
     assert(rule);
     
     rules.push_back(rule);
@@ -1159,7 +1329,7 @@ void parser_grammar_create(Grammar& grammar, TowerNode* root, void* userdata, Pa
 
   // Now build our grammar rules and map from the sorted rules above
   for (size_t i = 0; i < rules.size(); ++i) {
-    Rule* rule = rules[i];
+    const Rule* rule = rules[i];
 
     size_t grammar_rule_index = grammar.rules.size();
     GrammarRule& grammar_rule = grammar.rules.emplace_back();
@@ -1188,25 +1358,27 @@ void parser_grammar_create(Grammar& grammar, TowerNode* root, void* userdata, Pa
   // Now we can map all rule names/references
   for (size_t r = 1; r < grammar.rules.size(); ++r) {
     GrammarRule& grammar_rule = grammar.rules[r];
-    TowerNode* rule_node = tower_component_get_owner(tower_component_from_userdata(grammar_rule.rule));
+    TowerNode* rule_node = tower_component_get_owner(tower_component_from_userdata((void*)grammar_rule.rule));
     
     // Assume we will have at least as many grammar symbols as we have children
     // Note that strings often contain many grammar symbols packed in a single component
+    size_t symbol_count = 0;
+    TowerNode* const* symbol_nodes = tower_node_get_children(rule_node, &symbol_count);
     std::vector<GrammarSymbol>& symbols = grammar_rule.symbols;
-    symbols.reserve(tower_node_get_child_count(rule_node));
+    symbols.reserve(symbol_count);
 
     // Walk over all the grammar symbols
-    for (size_t g = 0;; ++g) {
-      TowerNode* symbol_node = tower_node_get_child(rule_node, g);
+    for (size_t g = 0; g < symbol_count; ++g) {
+      TowerNode* symbol_node = symbol_nodes[g];
       if (!symbol_node) {
-        break;
+        continue;
       }
 
       // TODO(trevor): Add the concept of component interfaces, and in this case we register a base type
       // for grammar symbols (so that we can only have one, and fetching it is quick)
       // kind of throws a wrench in has or add...
 
-      Reference* reference = (Reference*)tower_node_get_component_userdata(symbol_node, parser_reference_get_type());
+      const Reference* reference = (const Reference*)tower_node_get_component_userdata_for_read(symbol_node, parser_reference_get_type());
       if (reference) {
         // First we look internally to see if have satisfied a name
         auto it = non_terminals.find(reference->name);
@@ -1232,7 +1404,7 @@ void parser_grammar_create(Grammar& grammar, TowerNode* root, void* userdata, Pa
         }
       }
 
-      String* string = (String*)tower_node_get_component_userdata(symbol_node, parser_string_get_type());
+      const String* string = (const String*)tower_node_get_component_userdata_for_read(symbol_node, parser_string_get_type());
       if (string) {
         symbols.reserve(symbols.size() + string->ids.size());
         for (uint32_t id : string->ids) {
@@ -1243,7 +1415,7 @@ void parser_grammar_create(Grammar& grammar, TowerNode* root, void* userdata, Pa
         }
       }
 
-      Range* range = (Range*)tower_node_get_component_userdata(symbol_node, parser_range_get_type());
+      const Range* range = (const Range*)tower_node_get_component_userdata_for_read(symbol_node, parser_range_get_type());
       if (range) {
         GrammarSymbol& symbol = symbols.emplace_back();
         symbol.symbol_node = symbol_node;
@@ -1945,8 +2117,8 @@ struct State {
 
 struct Table {
   Grammar grammar;
-  std::vector<State> states;
-  std::vector<StateTransitions> shared_transitions;
+  std::vector<State, ParserTaggedAllocator<State>> states { ParserTaggedAllocator<State>(parser_memory_tables) };
+  std::vector<StateTransitions, ParserTaggedAllocator<StateTransitions>> shared_transitions { ParserTaggedAllocator<StateTransitions>(parser_memory_tables) };
 };
 
 std::string debug_str_header(const State& state, const Table& table, const char* prefix = "state") {
@@ -2536,7 +2708,7 @@ uint32_t parser_table_non_terminal_resolve_reference(void* userdata, const char*
 
 char* parser_copy_string(const std::string& str) {
   // Include the null terminator
-  void* str_mem = tower_memory_allocate(str.size() + 1);
+  void* str_mem = tower_memory_allocate_tagged(str.size() + 1, parser_memory_strings);
   memcpy(str_mem, str.c_str(), str.size() + 1);
   return (char*)str_mem;
 }
@@ -2544,7 +2716,7 @@ char* parser_copy_string(const std::string& str) {
 char* parser_table_utf8_id_to_string(void* userdata, uint32_t id) {
   size_t encode_size = parser_encode_utf8_codepoint(id, nullptr, 0);
   // Include the null terminator, and two '' characters
-  char* str_mem = (char*)tower_memory_allocate(encode_size + 3);
+  char* str_mem = (char*)tower_memory_allocate_tagged(encode_size + 3, parser_memory_strings);
   str_mem[0] = '\'';
   str_mem[encode_size + 1] = '\'';
   str_mem[encode_size + 2] = 0;
@@ -2574,7 +2746,8 @@ Table* parser_table_create(
   ParserTableResolveReference resolve,
   ParserTableIdToString to_string
 ) {
-  void* memory = tower_memory_allocate(sizeof(Table));
+  ParserProfileScope profile_scope("parser_table_create");
+  void* memory = tower_memory_allocate_tagged(sizeof(Table), parser_memory_tables);
   Table* table = new (memory) Table();
 
   Grammar& grammar = table->grammar;
@@ -2622,7 +2795,7 @@ struct StackState {
 };
 
 struct Recognizer {
-  std::vector<StackState> stack;
+  std::vector<StackState, ParserTaggedAllocator<StackState>> stack { ParserTaggedAllocator<StackState>(parser_memory_recognizers) };
 
   // TODO(trevor): The recgonizer needs to hold on to these (reference count?)
   Stream* stream = nullptr;
@@ -2630,6 +2803,9 @@ struct Recognizer {
   // Note that we never actually use the table, we just need to keep the states inside the table alive
   const Table* table = nullptr;
 
+  // Where parse nodes are allocated (null means individually)
+  TowerArena* arena = nullptr;
+
   // Holds the last read value from the stream
   TowerNode* read_node_or_null = nullptr;
   uint32_t read_id = PARSER_ID_EOF;
@@ -2654,7 +2830,7 @@ void parser_recognizer_read_id(Recognizer* recognizer) {
 }
 
 Recognizer* parser_recognizer_create(Table* table, Stream* stream) {
-  void* memory = tower_memory_allocate(sizeof(Recognizer));
+  void* memory = tower_memory_allocate_tagged(sizeof(Recognizer), parser_memory_recognizers);
   Recognizer* recognizer = new (memory) Recognizer();
   recognizer->stream = stream;
   recognizer->table = table;
@@ -2671,8 +2847,13 @@ void parser_recognizer_destroy(Recognizer* recognizer) {
   tower_memory_free(recognizer);
 }
 
+void parser_recognizer_set_arena(Recognizer* recognizer, TowerArena* arena) {
+  recognizer->arena = arena;
+}
+
 TowerNode* parser_recognizer_step(Recognizer* recognizer, bool* running) {
   assert(*running);
+  ParserProfileScope profile_scope("parser_recognizer_step");
 
   StackState stack_state = recognizer->stack.back();
   const State* state = stack_state.state;
@@ -2714,7 +2895,7 @@ TowerNode* parser_recognizer_step(Recognizer* recognizer, bool* running) {
     if (found_edge->shift_state) {
       // Create a node for each shift to represent the character or token
       // TODO(trevor): Add a recognizer 'token' mode that discards unnamed nodes (doesn't create one for each character)
-      TowerNode* node = tower_node_create();
+      TowerNode* node = tower_node_create_with_capacity(recognizer->arena, 1, sizeof(Match));
       Match* match = parser_match_create(node);
       parser_match_set_id(match, id);
       parser_match_set_start(match, recognizer->read_start);
@@ -2735,7 +2916,7 @@ TowerNode* parser_recognizer_step(Recognizer* recognizer, bool* running) {
       } else {
         // Create a node for each shift to represent the character or token
         // TODO(trevor): Add a recognizer 'token' mode that discards unnamed nodes (doesn't create one for each character)
-        TowerNode* node = tower_node_create();
+        TowerNode* node = tower_node_create_with_capacity(recognizer->arena, 1, sizeof(Match));
         Match* match = parser_match_create(node);
         parser_match_set_id(match, id);
         parser_match_set_start(match, recognizer->read_start);
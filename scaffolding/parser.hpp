@@ -282,6 +282,11 @@ Recognizer* parser_recognizer_create(Table* table, Stream* stream);
 // Destructs the parser and frees it's memory
 void parser_recognizer_destroy(Recognizer* recognizer);
 
+// Allocate every node the recognizer creates within the arena (null allocates them individually, the default)
+// This allows the entire parse tree to be torn down at once with tower_arena_destroy
+// The arena must be kept alive for as long as the recognizer or the parse tree is used
+void parser_recognizer_set_arena(Recognizer* recognizer, TowerArena* arena);
+
 // Take a single iterative step on the recognizer, which is defined by some 
 // change occuring such as an attachment to the parse tree or a callback.
 // When the recognizer is complete, the running bool will be set to false.
@@ -4,6 +4,15 @@
 #include <string>
 #include <atomic>
 #include <algorithm>
+#include <mutex>
+#include <chrono>
+#include <cstdio>
+#include <unordered_map>
+#include <unordered_set>
+#include <string_view>
+#include <thread>
+#include <condition_variable>
+#include <cmath>
 
 // The tests come first so that we don't see the definition of any structs
 void tower_tests() {
@@ -11,6 +20,36 @@ void tower_tests() {
   const size_t tower_component_initial_count = tower_component_get_allocated_count();
   const size_t tower_memory_initial_count = tower_memory_get_allocated_count();
 
+  // Allocate across all the size classes (and beyond) and free in a different order
+  {
+    const size_t count = 1100;
+    void* allocations[count];
+    for (size_t i = 0; i < count; ++i) {
+      allocations[i] = tower_memory_allocate(i);
+      assert(allocations[i] != nullptr);
+      assert((uintptr_t)allocations[i] % sizeof(size_t) == 0);
+      memset(allocations[i], (int)i, i);
+    }
+    assert(tower_memory_get_allocated_count() == tower_memory_initial_count + count);
+
+    for (size_t i = 0; i < count; ++i) {
+      uint8_t* bytes = (uint8_t*)allocations[i];
+      (void)bytes;
+      for (size_t j = 0; j < i; ++j) {
+        assert(bytes[j] == (uint8_t)i);
+      }
+    }
+
+    for (size_t i = 0; i < count; i += 2) {
+      tower_memory_free(allocations[i]);
+    }
+    for (size_t i = 1; i < count; i += 2) {
+      tower_memory_free(allocations[i]);
+    }
+  }
+
+  assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
+
   // Attach child and release parent (destroys both)
   {
     TowerNode* parent = tower_node_create();
@@ -229,308 +268,5439 @@ void tower_tests() {
   assert(tower_node_get_allocated_count() == tower_node_initial_count);
   assert(tower_component_get_allocated_count() == tower_component_initial_count);
   assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
-}
 
-struct TowerNodeChild {
-  std::string member_name;
-  TowerNode* /*strong*/ child = nullptr;
-};
+  // Create a tree within an arena, holding a child from outside of the arena, and destroy it all at once
+  {
+    static size_t destructed_count = 0;
+    destructed_count = 0;
+    TowerComponentDestructor destructor = [](TowerComponent* component, void* userdata) {
+      ++destructed_count;
+    };
 
-struct TowerNode {
-  static std::atomic<size_t> allocated_count;
-  static std::atomic<size_t> id_counter;
-  size_t id = TOWER_INVALID_INDEX;
-  size_t reference_count = 1;
+    TowerNode* type = tower_node_create();
+    TowerNode* outside = tower_node_create();
 
-  TowerNode* /*weak*/ parent = nullptr;
+    TowerArena* arena = tower_arena_create();
+    TowerNode* root = tower_node_create_in_arena(arena);
+    assert(tower_node_get_arena(root) == arena);
+    assert(tower_node_get_arena(outside) == nullptr);
 
-  std::vector<TowerComponent*> components;
-  std::vector<TowerNodeChild> children;
-};
-std::atomic<size_t> TowerNode::allocated_count = 0;
-std::atomic<size_t> TowerNode::id_counter = 0;
+    for (size_t i = 0; i < 100; ++i) {
+      TowerNode* child = tower_node_create_in_arena(arena);
+      tower_component_create(child, type, sizeof(size_t), destructor);
+      tower_node_attach_member(child, root, (i % 2) ? "odd" : nullptr);
+      tower_node_release_ref(child);
+    }
+    assert(tower_node_get_child_count(root) == 51);
+    assert(tower_node_get_allocated_count() == tower_node_initial_count + 3 + 51);
+    assert(tower_component_get_allocated_count() == tower_component_initial_count + 51);
 
-struct TowerComponent {
-  static std::atomic<size_t> allocated_count;
-  TowerComponentDestructor destructor = nullptr;
-  TowerNode* type = nullptr;
-  TowerNode* owner = nullptr;
-};
-std::atomic<size_t> TowerComponent::allocated_count = 0;
+    // Replacing the "odd" member destroyed nodes individually, which already ran their destructors
+    assert(destructed_count == 49);
 
-std::atomic<size_t> tower_allocated_count = 0;
+    // The arena holds one reference to the type, regardless of how many components use it
+    assert(tower_node_get_ref_count(type) == 2);
 
-// This will truncate to 4 bytes on 32 bit systems
-const size_t TOWER_MEMORY_GUARD = (size_t)0xDEADBEEFDEADBEEF;
+    // Nodes from outside of the arena can be held by nodes within it
+    tower_node_attach(outside, root);
+    assert(tower_node_get_ref_count(outside) == 2);
+    assert(tower_node_get_parent(outside) == root);
 
-void* tower_memory_allocate(size_t size) {
-  ++tower_allocated_count;
-#ifdef NDEBUG
-  return malloc(size);
-#else
-  // Round up to make sure the size is aligned
-  if (size % sizeof(size_t) != 0) {
-    size += sizeof(size_t) - (size % sizeof(size_t));
+    // Destroying the arena ignores the reference we hold to root
+    tower_arena_destroy(arena);
+    assert(destructed_count == 100);
+    assert(tower_node_get_ref_count(type) == 1);
+    assert(tower_node_get_ref_count(outside) == 1);
+    assert(tower_node_get_parent(outside) == nullptr);
+    assert(tower_node_get_allocated_count() == tower_node_initial_count + 2);
+    assert(tower_component_get_allocated_count() == tower_component_initial_count);
+
+    // Resetting an arena destroys it's nodes the same way, but keeps it's memory for the next ones
+    arena = tower_arena_create();
+    size_t reset_memory_count = 0;
+    for (size_t round = 0; round < 3; ++round) {
+      root = tower_node_create_in_arena(arena);
+      for (size_t i = 0; i < 1000; ++i) {
+        TowerNode* child = tower_node_create_in_arena(arena);
+        tower_component_create(child, type, (i == 0) ? 32 * 1024 : sizeof(size_t), destructor);
+        tower_node_attach(child, root);
+        tower_node_release_ref(child);
+      }
+      tower_node_attach(outside, root);
+      assert(tower_node_get_ref_count(type) == 2);
+      tower_arena_reset(arena);
+      assert(destructed_count == 100 + (round + 1) * 1000);
+      assert(tower_node_get_ref_count(type) == 1);
+      assert(tower_node_get_parent(outside) == nullptr);
+      assert(tower_node_get_allocated_count() == tower_node_initial_count + 2);
+      assert(tower_component_get_allocated_count() == tower_component_initial_count);
+      // Later rounds reuse the chunks of the first
+      if (round == 0) {
+        reset_memory_count = tower_memory_get_allocated_count();
+      }
+      assert(tower_memory_get_allocated_count() == reset_memory_count);
+    }
+    tower_arena_destroy(arena);
+
+    tower_node_release_ref(outside);
+    tower_node_release_ref(type);
   }
 
-  // One for a guard at the beginning, one for the size, and one for the guard at the end
-  size_t* mem = (size_t*)malloc(size + sizeof(size_t) * 3);
-  size_t end_guard_index = (size / sizeof(size_t)) + 2;
-  mem[0] = size;
-  mem[1] = TOWER_MEMORY_GUARD;
-  mem[end_guard_index] = TOWER_MEMORY_GUARD;
+  assert(tower_node_get_allocated_count() == tower_node_initial_count);
+  assert(tower_component_get_allocated_count() == tower_component_initial_count);
+  assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
 
-  // Clear the memory to a pattern that simulates uninitialized memory
-  void* result = &mem[2];
-  memset(result, 0xDB, size);
-  return result;
-#endif
-}
+  // Detach children from the middle and check the remaining children keep their order and indices
+  {
+    TowerNode* parent = tower_node_create();
+    TowerNode* children[5];
+    for (size_t i = 0; i < 5; ++i) {
+      children[i] = tower_node_create();
+      tower_node_attach_member(children[i], parent, (i == 4) ? "last" : nullptr);
+    }
 
-void tower_memory_free(void* memory) {
-  // If the allocation count was already 0, it will wrap around
-  auto new_count = --tower_allocated_count;
-  assert(new_count != (size_t)-1);
+    tower_node_detach(children[1]);
+    tower_node_detach(children[3]);
+    assert(tower_node_get_child_count(parent) == 3);
+    assert(tower_node_get_parent_child_index(children[1]) == TOWER_INVALID_INDEX);
+    assert(tower_node_get_parent_member_name(children[4]) != nullptr);
+    assert(tower_node_get_child_member(parent, "last") == children[4]);
+    assert(tower_node_get_child_member_index(parent, "last") == 2);
+    assert(tower_node_get_child(parent, 0) == children[0]);
+    assert(tower_node_get_child(parent, 1) == children[2]);
+    assert(tower_node_get_child(parent, 2) == children[4]);
+    assert(tower_node_get_child(parent, 3) == nullptr);
+    assert(tower_node_get_parent_child_index(children[0]) == 0);
+    assert(tower_node_get_parent_child_index(children[2]) == 1);
+    assert(tower_node_get_parent_child_index(children[4]) == 2);
 
-#ifdef NDEBUG
-  free(memory);
-#else
-  // Back up to the start of the allocation
-  size_t* mem = ((size_t*)memory) - 2;
+    // Reattaching goes to the end, and detaching the last child leaves no tombstone
+    tower_node_attach(children[3], parent);
+    tower_node_detach(children[0]);
+    tower_node_attach(children[1], parent);
+    tower_node_detach(children[1]);
+    assert(tower_node_get_child_count(parent) == 3);
+    assert(tower_node_get_parent_child_index(children[3]) == 2);
+    assert(tower_node_get_child(parent, 0) == children[2]);
+    assert(tower_node_get_child(parent, 1) == children[4]);
 
-  // Validate the first guard before checking size in case size has been corrupted
-  assert(mem[1] == TOWER_MEMORY_GUARD);
+    tower_node_release_ref(parent);
+    for (size_t i = 0; i < 5; ++i) {
+      assert(tower_node_get_parent(children[i]) == nullptr);
+      tower_node_release_ref(children[i]);
+    }
+  }
 
-  size_t size = mem[0];
-  size_t end_guard_index = (size / sizeof(size_t)) + 2;
-  assert(mem[end_guard_index] == TOWER_MEMORY_GUARD);
+  assert(tower_node_get_allocated_count() == tower_node_initial_count);
+  assert(tower_component_get_allocated_count() == tower_component_initial_count);
+  assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
 
-  // Clear the guards and all memory so that we can possibly detect double free
-  memset(mem, 0xFE, size + sizeof(size_t) * 3);
-  free(mem);
-#endif
-}
+  // Intern atoms and use them as member names
+  {
+    assert(tower_atom_intern(nullptr) == TOWER_ATOM_NONE);
+    assert(tower_atom_intern("") == TOWER_ATOM_NONE);
+    assert(tower_atom_get_string(TOWER_ATOM_NONE) == nullptr);
+    assert(tower_atom_find("tower_tests_never_interned") == TOWER_ATOM_NONE);
 
-size_t tower_memory_get_allocated_count() {
-  return tower_allocated_count;
-}
+    char name[] = "tower_tests_atom";
+    TowerAtom atom = tower_atom_intern(name);
+    assert(atom != TOWER_ATOM_NONE);
+    assert(tower_atom_find("tower_tests_atom") == atom);
+    assert(tower_atom_intern("tower_tests_atom") == atom);
+    assert(tower_atom_intern("tower_tests_atom2") != atom);
 
-size_t tower_node_get_allocated_count() {
-  return TowerNode::allocated_count;
-}
+    // The atom owns a copy of the string
+    name[0] = 'X';
+    assert(strcmp(tower_atom_get_string(atom), "tower_tests_atom") == 0);
 
-TowerNode* tower_node_create() {
-  void* memory = tower_memory_allocate(sizeof(TowerNode));
-  ++TowerNode::allocated_count;
-  size_t id = TowerNode::id_counter++;
-  TowerNode* node = new (memory) TowerNode();
-  node->id = id;
-  return node;
-}
+    TowerNode* parent = tower_node_create();
+    TowerNode* child = tower_node_create();
+    tower_node_attach_member_atom(child, parent, atom);
+    assert(tower_node_get_parent_member_atom(child) == atom);
+    assert(tower_node_get_child_member_atom(parent, atom) == child);
+    assert(tower_node_get_child_member(parent, "tower_tests_atom") == child);
+    assert(tower_node_get_child_member_index_atom(parent, atom) == 0);
+    assert(tower_node_get_parent_member_name(child) == tower_atom_get_string(atom));
+    assert(tower_node_get_child_member(parent, "tower_tests_never_interned") == nullptr);
+    assert(tower_atom_find("tower_tests_never_interned") == TOWER_ATOM_NONE);
 
-size_t tower_node_add_ref(TowerNode* node) {
-  assert(node->reference_count >= 1);
-  return ++node->reference_count;
-}
+    tower_node_release_ref(child);
+    tower_node_release_ref(parent);
+  }
 
-size_t tower_node_release_ref(TowerNode* node) {
-  assert(node->reference_count >= 1);
-  size_t new_count = --node->reference_count;
+  assert(tower_node_get_allocated_count() == tower_node_initial_count);
+  assert(tower_component_get_allocated_count() == tower_component_initial_count);
+  assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
 
-  // Destruct the node and all it's components, and release references to children
-  if (new_count == 0) {
-    for (size_t i = 0; i < node->children.size(); ++i) {
-      auto& child = node->children[i];
-      // This logic needs to mimic tower_node_detach
-      child.child->parent = nullptr;
-      tower_node_release_ref(child.child);
+  // Attach enough named members to use a hashed member index, then replace, detach and compact them
+  {
+    const size_t count = 200;
+    TowerAtom members[count];
+    TowerNode* children[count];
+    TowerNode* parent = tower_node_create();
+    for (size_t i = 0; i < count; ++i) {
+      char name[32];
+      snprintf(name, sizeof(name), "tower_tests_member%zu", i);
+      members[i] = tower_atom_intern(name);
+      children[i] = tower_node_create();
+      tower_node_attach_member_atom(children[i], parent, members[i]);
+      // Interleave unnamed children which should never be found by member
+      TowerNode* unnamed = tower_node_create();
+      tower_node_attach(unnamed, parent);
+      tower_node_release_ref(unnamed);
     }
 
-    for (size_t i = 0; i < node->components.size(); ++i) {
-      TowerComponent* component = node->components[i];
-      tower_node_release_ref(component->type);
-      if (component->destructor) {
-        component->destructor(component, tower_component_get_userdata(component));
-      }
+    for (size_t i = 0; i < count; ++i) {
+      assert(tower_node_get_child_member_atom(parent, members[i]) == children[i]);
+      assert(tower_node_get_child_member_index_atom(parent, members[i]) == i * 2);
+    }
 
-      --TowerComponent::allocated_count;
-      component->~TowerComponent();
-      tower_memory_free(component);
+    // Replace every third member with a new node, which detaches the original
+    for (size_t i = 0; i < count; i += 3) {
+      TowerNode* replacement = tower_node_create();
+      tower_node_attach_member_atom(replacement, parent, members[i]);
+      assert(tower_node_get_parent(children[i]) == nullptr);
+      assert(tower_node_get_child_member_atom(parent, members[i]) == replacement);
+      tower_node_release_ref(children[i]);
+      children[i] = replacement;
     }
+    assert(tower_node_get_child_count(parent) == count * 2);
 
-    --TowerNode::allocated_count;
-    node->~TowerNode();
-    tower_memory_free(node);
-  }
+    // Detach most of the members, dropping below the threshold for the index
+    for (size_t i = 0; i < count - 4; ++i) {
+      tower_node_detach(children[i]);
+      assert(tower_node_get_child_member_atom(parent, members[i]) == nullptr);
+    }
+    for (size_t i = count - 4; i < count; ++i) {
+      assert(tower_node_get_child_member_atom(parent, members[i]) == children[i]);
+      assert(tower_node_get_child(parent, tower_node_get_child_member_index_atom(parent, members[i])) == children[i]);
+    }
+    assert(tower_node_get_child_count(parent) == count + 4);
 
-  return new_count;
-}
+    tower_node_release_ref(parent);
+    for (size_t i = 0; i < count; ++i) {
+      tower_node_release_ref(children[i]);
+    }
+  }
 
-size_t tower_node_get_ref_count(TowerNode* node) {
-  return node->reference_count;
-}
+  assert(tower_node_get_allocated_count() == tower_node_initial_count);
+  assert(tower_component_get_allocated_count() == tower_component_initial_count);
+  assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
 
-size_t tower_node_get_id(TowerNode* node) {
-  return node->id;
-}
+  // Add components in different orders to different nodes, which share layouts between them
+  {
+    const size_t type_count = 6;
+    TowerNode* types[type_count];
+    for (size_t i = 0; i < type_count; ++i) {
+      types[i] = tower_node_create();
+    }
 
-void tower_node_attach(TowerNode* child, TowerNode* new_parent) {
-  tower_node_attach_member(child, new_parent, nullptr);
-}
+    const size_t node_count = 12;
+    TowerNode* nodes[node_count];
+    for (size_t n = 0; n < node_count; ++n) {
+      nodes[n] = tower_node_create();
+      // Each node gets a different subset of types, starting at a different type
+      for (size_t i = 0; i < n % type_count + 1; ++i) {
+        TowerNode* type = types[(n + i) % type_count];
+        TowerComponent* component = tower_component_create(nodes[n], type, sizeof(size_t), nullptr);
+        *(size_t*)tower_component_get_userdata(component) = n * 100 + i;
+      }
+    }
 
-void tower_node_attach_member(TowerNode* child, TowerNode* new_parent, const char* member_name) {
-  assert(child != nullptr);
-  assert(child != new_parent);
+    for (size_t n = 0; n < node_count; ++n) {
+      size_t component_count = n % type_count + 1;
+      assert(tower_node_get_component_count(nodes[n]) == component_count);
+      for (size_t i = 0; i < type_count; ++i) {
+        TowerNode* type = types[(n + i) % type_count];
+        TowerComponent* component = tower_node_get_component(nodes[n], type);
+        (void)component;
+        if (i < component_count) {
+          assert(component != nullptr);
+          assert(tower_node_get_component_by_index(nodes[n], i) == component);
+          assert(tower_component_get_type(component) == type);
+          assert(*(size_t*)tower_component_get_userdata(component) == n * 100 + i);
+        } else {
+          assert(component == nullptr);
+        }
+      }
+    }
 
-  if (child->parent == nullptr && new_parent == nullptr) {
-    return;
+    for (size_t n = 0; n < node_count; ++n) {
+      tower_node_release_ref(nodes[n]);
+    }
+    for (size_t i = 0; i < type_count; ++i) {
+      assert(tower_node_get_ref_count(types[i]) == 1);
+      tower_node_release_ref(types[i]);
+    }
   }
 
-  // We know we're changing parents at this point (attaching to a new one or detaching)
-  // Check if we need to detach from the current parent
-  if (child->parent) {
-    for (auto it = child->parent->children.begin(); it != child->parent->children.end(); ++it) {
-      if (it->child == child) {
-        child->parent->children.erase(it);
-        break;
-      }
+  assert(tower_node_get_allocated_count() == tower_node_initial_count);
+  assert(tower_component_get_allocated_count() == tower_component_initial_count);
+  assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
+
+  // Shapes are freed along with their types while other threads keep adding components to shapes they
+  // share, and new types that reuse the memory of destroyed ones never find stale slots
+  {
+    TowerNode* shared_type = tower_node_create();
+    tower_node_freeze(shared_type);
+    const size_t thread_count = 4;
+    std::thread threads[thread_count];
+    for (size_t t = 0; t < thread_count; ++t) {
+      threads[t] = std::thread([shared_type]() {
+        for (size_t i = 0; i < 500; ++i) {
+          TowerNode* types[2] = { tower_node_create(), tower_node_create() };
+          TowerNode* nodes[2] = { tower_node_create(), tower_node_create() };
+          for (size_t n = 0; n < 2; ++n) {
+            tower_component_create(nodes[n], shared_type, sizeof(size_t), nullptr);
+            *(size_t*)tower_component_get_userdata(tower_component_create(nodes[n], types[n], sizeof(size_t), nullptr)) = n;
+            *(size_t*)tower_component_get_userdata(tower_component_create(nodes[n], types[1 - n], sizeof(size_t), nullptr)) = 1 - n;
+          }
+          for (size_t n = 0; n < 2; ++n) {
+            assert(tower_node_get_component_count(nodes[n]) == 3);
+            assert(tower_node_get_component_by_index(nodes[n], 1) == tower_node_get_component(nodes[n], types[n]));
+            assert(*(size_t*)tower_node_get_component_userdata(nodes[n], types[0]) == 0);
+            assert(*(size_t*)tower_node_get_component_userdata(nodes[n], types[1]) == 1);
+          }
+          for (size_t n = 0; n < 2; ++n) {
+            tower_node_release_ref(nodes[n]);
+            tower_node_release_ref(types[n]);
+          }
+        }
+      });
     }
-  } else {
-    // Since the child has no parent, we know the new parent can't
-    // be null so we are transitioning from detached to attached
-    tower_node_add_ref(child);
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    tower_node_thaw(shared_type);
+    tower_node_release_ref(shared_type);
   }
 
-  child->parent = new_parent;
+  assert(tower_node_get_allocated_count() == tower_node_initial_count);
+  assert(tower_component_get_allocated_count() == tower_component_initial_count);
+  assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
 
-  // Finally, if we have a new parent, add ourselves
-  if (new_parent) {
-    const char* member = "";
-    if (member_name && *member_name != '\0') {
-      member = member_name;
-      
-      // Find a member of the same name and detach it
-      // Note: This may destroy the child if this is the last reference to this child
-      TowerNode* child_with_same_member_name = tower_node_get_child_member(new_parent, member_name);
-      if (child_with_same_member_name) {
-        tower_node_detach(child_with_same_member_name);
-      }
+  // Components that fit within the node share the node's allocation, and the rest are allocated separately
+  {
+    TowerNode* types[4];
+    for (size_t i = 0; i < 4; ++i) {
+      types[i] = tower_node_create();
     }
+    const size_t memory_count = tower_memory_get_allocated_count();
 
-    new_parent->children.push_back({member, child});
-  } else {
-    // Since the child had a parent, if the new parent is null
-    // we are transitioning from attached to detached
-    // This MUST come at the end as this could be the last reference
-    // to child and could cause the child pointer to be freed
-    tower_node_release_ref(child);
-  }
-}
+    // A node with room for one small component holds it without any other allocation
+    TowerNode* node = tower_node_create_with_capacity(nullptr, 1, sizeof(size_t) * 2);
+    TowerComponent* small = tower_component_create(node, types[0], sizeof(size_t) * 2, nullptr);
+    assert(tower_memory_get_allocated_count() == memory_count + 1);
+    assert(tower_component_from_userdata(tower_component_get_userdata(small)) == small);
+    tower_node_release_ref(node);
 
-void tower_node_detach(TowerNode* child) {
-  tower_node_attach_member(child, nullptr, nullptr);
-}
+    // Reserve room for two components, the third does not fit and has to be allocated
+    node = tower_node_create_with_capacity(nullptr, 2, 100 + 28);
+    TowerComponent* components[4];
+    components[0] = tower_component_create(node, types[0], 100, nullptr);
+    components[1] = tower_component_create(node, types[1], 28, nullptr);
+    assert(tower_memory_get_allocated_count() == memory_count + 1);
+    components[2] = tower_component_create(node, types[2], 1, nullptr);
+    // The component and a larger array of component pointers
+    assert(tower_memory_get_allocated_count() == memory_count + 3);
+    components[3] = tower_component_create(node, types[3], 1, nullptr);
+    assert(tower_memory_get_allocated_count() == memory_count + 4);
 
-TowerNode* tower_node_get_parent(TowerNode* child) {
-  return child->parent;
-}
+    for (size_t i = 0; i < 4; ++i) {
+      memset(tower_component_get_userdata(components[i]), (int)i, (i == 0) ? 100 : 1);
+    }
+    for (size_t i = 0; i < 4; ++i) {
+      assert(tower_node_get_component(node, types[i]) == components[i]);
+      assert(tower_node_get_component_by_index(node, i) == components[i]);
+      assert(*(uint8_t*)tower_node_get_component_userdata(node, types[i]) == i);
+      assert(tower_component_from_userdata(tower_component_get_userdata(components[i])) == components[i]);
+      assert(tower_component_get_owner(components[i]) == node);
+    }
+    tower_node_release_ref(node);
 
-size_t tower_node_get_child_count(TowerNode* parent) {
-  return parent->children.size();
-}
+    // Nodes without any capacity (including default nodes) allocate every component
+    node = tower_node_create_with_capacity(nullptr, 0, 0);
+    tower_component_create(node, types[0], 1, nullptr);
+    assert(tower_memory_get_allocated_count() == memory_count + 2);
+    tower_node_release_ref(node);
+    node = tower_node_create();
+    tower_component_create(node, types[0], 1, nullptr);
+    assert(tower_memory_get_allocated_count() == memory_count + 2);
+    tower_node_release_ref(node);
 
-TowerNode* tower_node_get_child(TowerNode* parent, size_t index) {
-  if (index < parent->children.size()) {
-    return parent->children[index].child;
+    for (size_t i = 0; i < 4; ++i) {
+      tower_node_release_ref(types[i]);
+    }
   }
-  return nullptr;
-}
-
-TowerNode* tower_node_get_child_member(TowerNode* parent, const char* member_name) {
-  size_t index = tower_node_get_child_member_index(parent, member_name);
-  return (index == TOWER_INVALID_INDEX) ? nullptr : parent->children[index].child;
-}
 
-size_t tower_node_get_child_member_index(TowerNode* parent, const char* member_name) {
-  assert(member_name && *member_name != '\0');
+  assert(tower_node_get_allocated_count() == tower_node_initial_count);
+  assert(tower_component_get_allocated_count() == tower_component_initial_count);
+  assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
 
-  for (size_t i = 0; i < parent->children.size(); ++i) {
-    auto& child = parent->children[i];
-    if (child.member_name == member_name) {
-      return i;
+  // Releasing the root of a very deep chain destroys it without recursion
+  {
+    const size_t depth = 100000;
+    TowerNode* type = tower_node_create();
+    TowerNode* root = tower_node_create();
+    TowerNode* parent = root;
+    for (size_t i = 0; i < depth; ++i) {
+      TowerNode* child = tower_node_create();
+      tower_component_create(child, type, sizeof(size_t), nullptr);
+      tower_node_attach(child, parent);
+      tower_node_release_ref(child);
+      parent = child;
     }
-  }
-  return TOWER_INVALID_INDEX;
-}
+    assert(tower_node_get_ref_count(type) == depth + 1);
+    assert(tower_node_get_allocated_count() == tower_node_initial_count + depth + 2);
 
-const char* tower_node_get_parent_member_name(TowerNode* child) {
-  if (child->parent == nullptr) {
-    return nullptr;
+    tower_node_release_ref(root);
+    assert(tower_node_get_ref_count(type) == 1);
+    assert(tower_node_get_allocated_count() == tower_node_initial_count + 1);
+    tower_node_release_ref(type);
   }
 
-  auto& children = child->parent->children;
-  for (size_t i = 0; i < children.size(); ++i) {
-    auto& current_child = children[i];
-    if (current_child.child == child) {
-      if (current_child.member_name.empty()) {
-        return nullptr;
-      } else {
-        return current_child.member_name.c_str();
-      }
+  assert(tower_node_get_allocated_count() == tower_node_initial_count);
+  assert(tower_component_get_allocated_count() == tower_component_initial_count);
+  assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
+
+  // Deferred reclamation destroys released trees on another thread, and a flush waits for it
+  {
+    assert(!tower_reclaim_get_deferred());
+    tower_reclaim_set_deferred(true);
+    assert(tower_reclaim_get_deferred());
+
+    TowerNode* type = tower_node_create();
+    TowerNode* root = tower_node_create();
+    for (size_t i = 0; i < 100; ++i) {
+      TowerNode* child = tower_node_create();
+      tower_component_create(child, type, sizeof(size_t), nullptr);
+      tower_node_attach(child, root);
+      tower_node_release_ref(child);
     }
-  }
+    tower_node_release_ref(root);
+    tower_reclaim_flush();
+    assert(tower_node_get_ref_count(type) == 1);
+    assert(tower_node_get_allocated_count() == tower_node_initial_count + 1);
+    assert(tower_component_get_allocated_count() == tower_component_initial_count);
 
-  // Should not ever get here, the child should be within the parent
-  assert(false);
-  return nullptr;
-}
+    // Types released back by the reclaimer are also destroyed by the flush
+    TowerNode* node = tower_node_create();
+    tower_component_create(node, type, sizeof(size_t), nullptr);
+    tower_node_release_ref(type);
+    tower_node_release_ref(node);
+    tower_reclaim_flush();
 
-size_t tower_node_get_parent_child_index(TowerNode* child) {
-  if (!child->parent) {
-    return TOWER_INVALID_INDEX;
+    tower_reclaim_set_deferred(false);
+    assert(!tower_reclaim_get_deferred());
   }
 
-  auto& children = child->parent->children;
-  for (size_t i = 0; i < children.size(); ++i) {
-    auto& current_child = children[i];
-    if (current_child.child == child) {
-      return i;
+  assert(tower_node_get_allocated_count() == tower_node_initial_count);
+  assert(tower_component_get_allocated_count() == tower_component_initial_count);
+  assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
+
+  // Nodes with an atomic reference count can be referenced and released from several threads
+  {
+    const size_t thread_count = 4;
+    TowerNode* shared = tower_node_create();
+    assert(!tower_node_get_atomic_ref_count(shared));
+    tower_node_set_atomic_ref_count(shared, true);
+    assert(tower_node_get_atomic_ref_count(shared));
+
+    std::thread threads[thread_count];
+    for (size_t t = 0; t < thread_count; ++t) {
+      tower_node_add_ref(shared);
+      threads[t] = std::thread([shared]() {
+        for (size_t i = 0; i < 10000; ++i) {
+          tower_node_add_ref(shared);
+          tower_node_release_ref(shared);
+        }
+        // Each thread releases the reference it was handed, and the last one destroys the node
+        tower_node_release_ref(shared);
+      });
+    }
+    size_t shared_ref_count = tower_node_release_ref(shared);
+    assert(shared_ref_count <= thread_count);
+    for (size_t t = 0; t < thread_count; ++t) {
+      threads[t].join();
     }
   }
 
-  // Should not ever get here, the child should be within the parent
-  assert(false);
-  return TOWER_INVALID_INDEX;
-}
+  assert(tower_node_get_allocated_count() == tower_node_initial_count);
+  assert(tower_component_get_allocated_count() == tower_component_initial_count);
+  assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
 
-TowerComponent* tower_node_get_component(TowerNode* owner, TowerNode* type) {
-  for (size_t i = 0; i < owner->components.size(); ++i) {
-    TowerComponent* component = owner->components[i];
-    if (component->type == type) {
-      return component;
+  // Frozen subtrees are pinned and immutable, and can be read by many threads without reference counting
+  {
+    TowerNode* type = tower_node_create();
+    TowerNode* root = tower_node_create();
+    TowerNode* children[3];
+    for (size_t i = 0; i < 3; ++i) {
+      children[i] = tower_node_create();
+      tower_component_create(children[i], type, sizeof(size_t), nullptr);
+      tower_node_attach(children[i], root);
+      tower_node_release_ref(children[i]);
     }
-  }
-  return nullptr;
-}
+    // Leave a tombstone behind, which the freeze compacts
+    tower_node_detach(children[0]);
 
-void* tower_node_get_component_userdata(TowerNode* owner, TowerNode* type) {
-  return tower_component_get_userdata(tower_node_get_component(owner, type));
-}
+    tower_node_freeze(root);
+    assert(tower_node_is_frozen(root));
+    assert(tower_node_is_frozen(children[1]));
+    assert(!tower_node_is_frozen(type));
+    assert(tower_node_get_ref_count(root) == 2);
+    assert(tower_node_add_ref(root) == 2);
+    assert(tower_node_release_ref(root) == 2);
 
-size_t tower_node_get_component_count(TowerNode* owner) {
-  return owner->components.size();
-}
+    std::thread threads[4];
+    for (size_t t = 0; t < 4; ++t) {
+      threads[t] = std::thread([root, type]() {
+        for (size_t i = 0; i < 1000; ++i) {
+          TowerNode* child = tower_node_get_child(root, i % 2);
+          tower_node_add_ref(child);
+          assert(tower_node_get_component(child, type) != nullptr);
+          tower_node_release_ref(child);
+        }
+      });
+    }
+    for (size_t t = 0; t < 4; ++t) {
+      threads[t].join();
+    }
 
-TowerComponent* tower_node_get_component_by_index(TowerNode* owner, size_t index) {
-  if (index < owner->components.size()) {
-    return owner->components[index];
+    // The reference the caller held from before the freeze is released after the thaw
+    tower_node_thaw(root);
+    assert(!tower_node_is_frozen(children[1]));
+    assert(tower_node_get_ref_count(root) == 1);
+    tower_node_release_ref(root);
+    tower_node_release_ref(type);
   }
-  return nullptr;
-}
 
-size_t tower_component_get_allocated_count() {
-  return TowerComponent::allocated_count;
-}
+  assert(tower_node_get_allocated_count() == tower_node_initial_count);
+  assert(tower_component_get_allocated_count() == tower_component_initial_count);
+  assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
+
+  // Read all children and components at once, and attach many children at once
+  {
+    TowerNode* parent = tower_node_create();
+    TowerNode* children[4];
+    for (size_t i = 0; i < 4; ++i) {
+      children[i] = tower_node_create();
+    }
+    // A child that's already attached elsewhere is moved, just like tower_node_attach
+    TowerNode* other_parent = tower_node_create();
+    tower_node_attach(children[3], other_parent);
+
+    tower_node_attach_many(children, 4, parent);
+    assert(tower_node_get_child_count(other_parent) == 0);
+    for (size_t i = 0; i < 4; ++i) {
+      assert(tower_node_get_ref_count(children[i]) == 2);
+      tower_node_release_ref(children[i]);
+    }
+
+    // Reading the children leaves the tombstone in place, which is handed out as null
+    tower_node_detach(children[1]);
+    size_t count = 0;
+    TowerNode* const* span = tower_node_get_children(parent, &count);
+    assert(count == 4);
+    assert(span[0] == children[0] && span[1] == nullptr && span[2] == children[2] && span[3] == children[3]);
+    assert(tower_node_get_child_count(parent) == 3);
+    assert(tower_node_get_child(parent, 1) == children[2]);
+    assert(tower_node_get_parent_child_index(children[3]) == 2);
+    assert(tower_node_get_children(parent, &count) == span && count == 4);
+
+    // Detaching more makes tombstones over half of the slots, which compacts them
+    tower_node_detach(children[2]);
+    tower_node_detach(children[0]);
+    span = tower_node_get_children(parent, &count);
+    assert(count == 1);
+    assert(span[0] == children[3]);
+    assert(tower_node_get_parent_child_index(children[3]) == 0);
+
+    TowerNode* types[3];
+    for (size_t i = 0; i < 3; ++i) {
+      types[i] = tower_node_create();
+      tower_component_create(parent, types[i], sizeof(size_t), nullptr);
+    }
+    TowerComponent* const* components = tower_node_get_components(parent, &count);
+    assert(count == 3);
+    for (size_t i = 0; i < 3; ++i) {
+      assert(components[i] == tower_node_get_component(parent, types[i]));
+    }
+
+    span = tower_node_get_children(other_parent, &count);
+    assert(count == 0);
+
+    tower_node_release_ref(parent);
+    tower_node_release_ref(other_parent);
+    for (size_t i = 0; i < 3; ++i) {
+      tower_node_release_ref(types[i]);
+    }
+  }
+
+  assert(tower_node_get_allocated_count() == tower_node_initial_count);
+  assert(tower_component_get_allocated_count() == tower_component_initial_count);
+  assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
+
+  // Handles refer to nodes without holding a reference, and stop resolving once the node is destroyed
+  {
+    assert(tower_node_from_handle(TOWER_HANDLE_NONE) == nullptr);
+
+    TowerNode* node = tower_node_create();
+    TowerHandle handle = tower_node_get_handle(node);
+    assert(handle != TOWER_HANDLE_NONE);
+    assert(tower_node_get_handle(node) == handle);
+    assert(tower_node_from_handle(handle) == node);
+    assert(tower_node_get_ref_count(node) == 1);
+    tower_node_release_ref(node);
+    assert(tower_node_from_handle(handle) == nullptr);
+
+    // The slot is reused by the next node, but the old handle stays invalid
+    TowerNode* other = tower_node_create();
+    TowerHandle other_handle = tower_node_get_handle(other);
+    assert(other_handle != handle);
+    assert((uint32_t)other_handle == (uint32_t)handle);
+    assert(tower_node_from_handle(handle) == nullptr);
+    assert(tower_node_from_handle(other_handle) == other);
+    tower_node_release_ref(other);
+
+    // Destroying an arena invalidates the handles of the nodes within it
+    TowerArena* arena = tower_arena_create();
+    TowerNode* released = tower_node_create_in_arena(arena);
+    TowerNode* alive = tower_node_create_in_arena(arena);
+    TowerHandle released_handle = tower_node_get_handle(released);
+    TowerHandle alive_handle = tower_node_get_handle(alive);
+    tower_node_release_ref(released);
+    assert(tower_node_from_handle(released_handle) == nullptr);
+    assert(tower_node_from_handle(alive_handle) == alive);
+    tower_arena_destroy(arena);
+    assert(tower_node_from_handle(alive_handle) == nullptr);
+  }
+
+  assert(tower_node_get_allocated_count() == tower_node_initial_count);
+  assert(tower_component_get_allocated_count() == tower_component_initial_count);
+  assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
+
+  // Weak references don't keep nodes alive, and can be upgraded to strong references while they are
+  {
+    TowerNode* node = tower_node_create();
+    TowerWeak* weak = tower_node_create_weak(node);
+    TowerWeak* other_weak = tower_node_create_weak(node);
+    assert(other_weak == weak);
+    tower_weak_release(other_weak);
+    assert(tower_node_get_ref_count(node) == 1);
+
+    TowerNode* upgraded = tower_weak_upgrade(weak);
+    assert(upgraded == node);
+    assert(tower_node_get_ref_count(node) == 2);
+    tower_node_release_ref(upgraded);
+
+    tower_node_release_ref(node);
+    assert(tower_node_get_allocated_count() == tower_node_initial_count);
+    assert(tower_weak_upgrade(weak) == nullptr);
+    tower_weak_release(weak);
+
+    // A child held alive only by it's parent goes away with the parent
+    TowerNode* parent = tower_node_create();
+    TowerNode* child = tower_node_create();
+    tower_node_attach(child, parent);
+    weak = tower_node_create_weak(child);
+    tower_node_release_ref(child);
+    tower_node_release_ref(parent);
+    assert(tower_weak_upgrade(weak) == nullptr);
+    tower_weak_release(weak);
+
+    // Destroying an arena invalidates weak references to it's nodes
+    TowerArena* arena = tower_arena_create();
+    node = tower_node_create_in_arena(arena);
+    weak = tower_node_create_weak(node);
+    tower_arena_destroy(arena);
+    assert(tower_weak_upgrade(weak) == nullptr);
+    tower_weak_release(weak);
+
+    // Upgrading races against the last release on another thread
+    node = tower_node_create();
+    tower_node_set_atomic_ref_count(node, true);
+    weak = tower_node_create_weak(node);
+    std::thread releaser([node]() {
+      tower_node_release_ref(node);
+    });
+    for (;;) {
+      upgraded = tower_weak_upgrade(weak);
+      if (!upgraded) {
+        break;
+      }
+      tower_node_release_ref(upgraded);
+    }
+    releaser.join();
+    tower_weak_release(weak);
+  }
+
+  assert(tower_node_get_allocated_count() == tower_node_initial_count);
+  assert(tower_component_get_allocated_count() == tower_component_initial_count);
+  assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
+
+  // Save and load subtrees through snapshots, with a trivially copyable and a serialized component type
+  {
+    struct Pod {
+      size_t a;
+      uint32_t b;
+    };
+    TowerNode* pod_type = tower_node_create();
+    TowerNode* text_type = tower_node_create();
+    TowerTypeInfo pod_info = { "tests.Pod", nullptr, nullptr, nullptr, 0 };
+    TowerTypeInfo text_info = {
+      "tests.Text",
+      [](TowerComponent* component, void* userdata) {
+        tower_memory_free(*(char**)userdata);
+      },
+      [](TowerComponent* component, void* userdata, TowerSnapshotWriter* writer) {
+        const char* text = *(char**)userdata;
+        tower_snapshot_writer_write(writer, text, strlen(text));
+      },
+      [](TowerComponent* component, void* userdata, const void* data, size_t bytes) {
+        char* text = (char*)tower_memory_allocate(bytes + 1);
+        memcpy(text, data, bytes);
+        text[bytes] = '\0';
+        *(char**)userdata = text;
+      },
+      sizeof(char*),
+    };
+    tower_type_register(pod_type, &pod_info);
+    tower_type_register(text_type, &text_info);
+    assert(tower_type_find("tests.Pod") == pod_type);
+    assert(strcmp(tower_type_get_info(text_type)->name, "tests.Text") == 0);
+
+    TowerNode* root = tower_node_create();
+    Pod* pod = (Pod*)tower_component_get_userdata(tower_component_create(root, pod_type, sizeof(Pod), nullptr));
+    pod->a = 123;
+    pod->b = 456;
+    for (size_t i = 0; i < 3; ++i) {
+      TowerNode* child = tower_node_create();
+      char* text = (char*)tower_memory_allocate(8);
+      snprintf(text, 8, "text%zu", i);
+      *(char**)tower_component_get_userdata(tower_component_create(child, text_type, sizeof(char*), text_info.destructor)) = text;
+      tower_node_attach_member(child, root, (i == 1) ? "second" : nullptr);
+      tower_node_release_ref(child);
+    }
+
+    size_t bytes = 0;
+    void* data = tower_snapshot_create(root, &bytes);
+    assert(data);
+    assert(tower_snapshot_view(data, bytes - 1) == nullptr);
+    const TowerSnapshot* snapshot = tower_snapshot_view(data, bytes);
+    assert(snapshot);
+
+    // Read the snapshot in place
+    assert(tower_snapshot_get_node_count(snapshot) == 4);
+    assert(tower_snapshot_get_child_count(snapshot, 0) == 3);
+    assert(tower_snapshot_get_child_member_name(snapshot, 0, 0) == nullptr);
+    assert(strcmp(tower_snapshot_get_child_member_name(snapshot, 0, 1), "second") == 0);
+    size_t second = tower_snapshot_get_child(snapshot, 0, 1);
+    assert(tower_snapshot_get_child_count(snapshot, second) == 0);
+    assert(strcmp(tower_snapshot_get_component_type_name(snapshot, second, 0), "tests.Text") == 0);
+    size_t payload_bytes = 0;
+    const void* payload = tower_snapshot_get_component_payload(snapshot, second, 0, &payload_bytes);
+    assert(payload_bytes == 5 && memcmp(payload, "text1", 5) == 0);
+    assert(((const Pod*)tower_snapshot_get_component_payload(snapshot, 0, 0, &payload_bytes))->b == 456);
+
+    // Load it as nodes, both individually and within an arena
+    TowerArena* arena = tower_arena_create();
+    for (size_t i = 0; i < 2; ++i) {
+      TowerNode* loaded = tower_snapshot_instantiate(snapshot, (i == 0) ? nullptr : arena);
+      assert(loaded != root);
+      Pod* loaded_pod = (Pod*)tower_node_get_component_userdata(loaded, pod_type);
+      assert(loaded_pod->a == 123 && loaded_pod->b == 456);
+      assert(tower_node_get_child_count(loaded) == 3);
+      TowerNode* loaded_second = tower_node_get_child_member(loaded, "second");
+      assert(tower_node_get_child(loaded, 1) == loaded_second);
+      assert(strcmp(*(char**)tower_node_get_component_userdata(loaded_second, text_type), "text1") == 0);
+      tower_node_release_ref(loaded);
+    }
+    tower_arena_destroy(arena);
+
+    // Corrupting any word of the snapshot either fails to view or instantiate, or still loads a valid tree
+    uint32_t* words = (uint32_t*)data;
+    for (size_t i = 0; i < bytes / sizeof(uint32_t); ++i) {
+      const uint32_t original = words[i];
+      const uint32_t corruptions[] = { 0, 1, original + 1, original - 1, 0x7FFFFFFF, 0xFFFFFFFF };
+      for (uint32_t corruption : corruptions) {
+        words[i] = corruption;
+        const TowerSnapshot* corrupted = tower_snapshot_view(data, bytes);
+        TowerNode* loaded = corrupted ? tower_snapshot_instantiate(corrupted, nullptr) : nullptr;
+        if (loaded) {
+          tower_node_release_ref(loaded);
+        }
+      }
+      words[i] = original;
+    }
+    TowerNode* restored = tower_snapshot_instantiate(snapshot, nullptr);
+    assert(restored && tower_node_get_child_count(restored) == 3);
+    tower_node_release_ref(restored);
+
+    // Types that are not registered can't be saved or loaded
+    tower_type_unregister(text_type);
+    assert(tower_snapshot_instantiate(snapshot, nullptr) == nullptr);
+    assert(tower_snapshot_create(root, &bytes) == nullptr);
+
+    tower_memory_free(data);
+    tower_node_release_ref(root);
+    tower_type_unregister(pod_type);
+    tower_node_release_ref(pod_type);
+    tower_node_release_ref(text_type);
+  }
+
+  assert(tower_node_get_allocated_count() == tower_node_initial_count);
+  assert(tower_component_get_allocated_count() == tower_component_initial_count);
+  assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
+
+  // Write a subtree as JSON through a flush callback, and read it back incrementally
+  {
+    TowerNode* type = tower_node_create();
+    TowerTypeInfo info = { "tests.Json", nullptr, nullptr, nullptr, 0 };
+    tower_type_register(type, &info);
+
+    TowerNode* root = tower_node_create();
+    *(uint16_t*)tower_component_get_userdata(tower_component_create(root, type, sizeof(uint16_t), nullptr)) = 0xABCD;
+    TowerNode* parent = root;
+    for (size_t i = 0; i < 2; ++i) {
+      TowerNode* child = tower_node_create();
+      tower_node_attach_member(child, parent, (i == 0) ? "first \"quoted\"" : nullptr);
+      tower_node_release_ref(child);
+      parent = child;
+    }
+
+    // A tiny buffer forces many flushes
+    std::string json;
+    tower_json_write(root, [](const uint8_t* data, size_t length, void* userdata) {
+      ((std::string*)userdata)->append((const char*)data, length);
+    }, &json, 4);
+    assert(json == "{\"components\":{\"tests.Json\":[2,\"cdab\"]},\"children\":[{\"member\":\"first \\\"quoted\\\"\",\"children\":[{}]}]}");
+
+    // Feed the text one character at a time, so every token is split
+    TowerJsonReader* reader = tower_json_reader_create(nullptr);
+    for (size_t i = 0; i < json.size(); ++i) {
+      bool fed = tower_json_reader_feed(reader, json.data() + i, 1);
+      assert(fed);
+    }
+    TowerNode* loaded = tower_json_reader_finish(reader);
+    tower_json_reader_destroy(reader);
+    assert(loaded);
+    assert(*(uint16_t*)tower_node_get_component_userdata(loaded, type) == 0xABCD);
+    TowerNode* first = tower_node_get_child_member(loaded, "first \"quoted\"");
+    assert(first && tower_node_get_child_count(first) == 1);
+    tower_node_release_ref(loaded);
+
+    // Invalid or incomplete text fails, and releases anything it created
+    reader = tower_json_reader_create(nullptr);
+    bool fed = tower_json_reader_feed(reader, json.data(), json.size() / 2);
+    assert(fed);
+    assert(tower_json_reader_finish(reader) == nullptr);
+    tower_json_reader_destroy(reader);
+    reader = tower_json_reader_create(nullptr);
+    fed = tower_json_reader_feed(reader, "{\"children\":[{\"unknown\":1}]}", 28);
+    assert(!fed);
+    tower_json_reader_destroy(reader);
+
+    // Sizes that don't match the type, or overflow, fail before any component is constructed
+    TowerNode* counted_type = tower_node_create();
+    TowerTypeInfo counted_info = {
+      "tests.JsonCounted",
+      nullptr,
+      [](TowerComponent* component, void* userdata, TowerSnapshotWriter* writer) {
+        tower_snapshot_writer_write(writer, userdata, sizeof(size_t));
+      },
+      [](TowerComponent* component, void* userdata, const void* data, size_t bytes) {
+        memcpy(userdata, data, sizeof(size_t));
+      },
+      sizeof(size_t),
+    };
+    tower_type_register(counted_type, &counted_info);
+    const char* invalid[] = {
+      "{\"components\":{\"tests.JsonCounted\":[0,\"00\"]}}",
+      "{\"components\":{\"tests.JsonCounted\":[4,\"00000000\"]}}",
+      "{\"components\":{\"tests.Json\":[3,\"0000\"]}}",
+      "{\"components\":{\"tests.Json\":[4294967296,\"\"]}}",
+      "{\"components\":{\"tests.Json\":[99999999999999999999999,\"\"]}}",
+      "{\"components\":{\"tests.Json\":[1,\"ab\"],\"tests.Json\":[4,\"00000000\"]}}",
+    };
+    for (const char* text : invalid) {
+      reader = tower_json_reader_create(nullptr);
+      fed = tower_json_reader_feed(reader, text, strlen(text));
+      assert(!fed);
+      tower_json_reader_destroy(reader);
+    }
+
+    // Escaped surrogate pairs are combined, while unpaired surrogates and nulls fail
+    const char* escapes[] = {
+      "{\"children\":[{\"member\":\"\\u0000\"}]}",
+      "{\"children\":[{\"member\":\"\\ud83d\"}]}",
+      "{\"children\":[{\"member\":\"\\ud83dx\"}]}",
+      "{\"children\":[{\"member\":\"\\ud83d\\u0041\"}]}",
+      "{\"children\":[{\"member\":\"\\ude00\"}]}",
+    };
+    for (const char* text : escapes) {
+      reader = tower_json_reader_create(nullptr);
+      fed = tower_json_reader_feed(reader, text, strlen(text));
+      assert(!fed);
+      tower_json_reader_destroy(reader);
+    }
+    reader = tower_json_reader_create(nullptr);
+    const char* paired = "{\"children\":[{\"member\":\"a\\ud83d\\ude00\\u00e9\"}]}";
+    fed = tower_json_reader_feed(reader, paired, strlen(paired));
+    assert(fed);
+    loaded = tower_json_reader_finish(reader);
+    tower_json_reader_destroy(reader);
+    assert(loaded && tower_node_get_child_member(loaded, "a\xF0\x9F\x98\x80\xC3\xA9"));
+    tower_node_release_ref(loaded);
+
+    // Writing fails rather than leaving out a component whose type isn't registered
+    TowerNode* unregistered = tower_node_create();
+    TowerNode* unwritable = tower_node_create();
+    tower_component_create(unwritable, unregistered, sizeof(uint32_t), nullptr);
+    std::string partial;
+    bool written = tower_json_write(unwritable, [](const uint8_t* data, size_t length, void* userdata) {
+      ((std::string*)userdata)->append((const char*)data, length);
+    }, &partial);
+    assert(!written);
+    assert(partial.empty());
+    tower_node_release_ref(unwritable);
+    tower_node_release_ref(unregistered);
+    reader = tower_json_reader_create(nullptr);
+    const char* counted = "{\"components\":{\"tests.JsonCounted\":[8,\"0700000000000000\"]}}";
+    fed = tower_json_reader_feed(reader, counted, strlen(counted));
+    assert(fed);
+    loaded = tower_json_reader_finish(reader);
+    tower_json_reader_destroy(reader);
+    assert(loaded && *(size_t*)tower_node_get_component_userdata(loaded, counted_type) == 7);
+    tower_node_release_ref(loaded);
+    tower_type_unregister(counted_type);
+    tower_node_release_ref(counted_type);
+
+    tower_node_release_ref(root);
+    tower_type_unregister(type);
+    tower_node_release_ref(type);
+  }
+
+  assert(tower_node_get_allocated_count() == tower_node_initial_count);
+  assert(tower_component_get_allocated_count() == tower_component_initial_count);
+  assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
+
+  // Clones of frozen templates share children and components until they are looked at or written to
+  {
+    TowerNode* number_type = tower_node_create();
+    TowerNode* text_type = tower_node_create();
+    TowerTypeInfo text_info = {
+      "tests.CowText",
+      [](TowerComponent* component, void* userdata) {
+        tower_memory_free(*(char**)userdata);
+      },
+      [](TowerComponent* component, void* userdata, TowerSnapshotWriter* writer) {
+        const char* text = *(char**)userdata;
+        tower_snapshot_writer_write(writer, text, strlen(text));
+      },
+      [](TowerComponent* component, void* userdata, const void* data, size_t bytes) {
+        char* text = (char*)tower_memory_allocate(bytes + 1);
+        memcpy(text, data, bytes);
+        text[bytes] = '\0';
+        *(char**)userdata = text;
+      },
+      sizeof(char*),
+    };
+    tower_type_register(text_type, &text_info);
+
+    // A root with three named children, each of which has two children of their own
+    TowerNode* root = tower_node_create();
+    *(size_t*)tower_component_get_userdata(tower_component_create(root, number_type, sizeof(size_t), nullptr)) = 1;
+    const char* names[3] = { "a", "b", "c" };
+    for (size_t i = 0; i < 3; ++i) {
+      TowerNode* child = tower_node_create();
+      char* text = (char*)tower_memory_allocate(8);
+      snprintf(text, 8, "text%zu", i);
+      *(char**)tower_component_get_userdata(tower_component_create(child, text_type, sizeof(char*), text_info.destructor)) = text;
+      for (size_t j = 0; j < 2; ++j) {
+        TowerNode* grandchild = tower_node_create();
+        tower_node_attach(grandchild, child);
+        tower_node_release_ref(grandchild);
+      }
+      tower_node_attach_member(child, root, names[i]);
+      tower_node_release_ref(child);
+    }
+    tower_node_freeze(root);
+    const size_t template_node_count = tower_node_get_allocated_count();
+    const size_t template_component_count = tower_component_get_allocated_count();
+
+    // Cloning and counting children doesn't clone anything below the root
+    TowerNode* clone = tower_node_clone_cow(root);
+    assert(!tower_node_is_frozen(clone));
+    assert(tower_node_get_child_count(clone) == 3);
+    assert(tower_node_get_allocated_count() == template_node_count + 1);
+    TowerComponent* shared = tower_node_get_component(clone, number_type);
+    assert(shared == tower_node_get_component(root, number_type));
+    assert(tower_component_get_owner(shared) == root);
+    assert(tower_component_get_allocated_count() == template_component_count);
+
+    // Looking at the children clones only that level
+    TowerNode* clone_b = tower_node_get_child_member(clone, "b");
+    assert(clone_b && clone_b != tower_node_get_child_member(root, "b"));
+    assert(tower_node_get_parent(clone_b) == clone);
+    assert(strcmp(tower_node_get_parent_member_name(clone_b), "b") == 0);
+    assert(tower_node_get_child_count(clone_b) == 2);
+    assert(tower_node_get_allocated_count() == template_node_count + 4);
+
+    // Writing gives the clone it's own copy, and the template keeps the original
+    TowerComponent* owned = tower_node_get_component_for_write(clone, number_type);
+    assert(owned != shared && tower_component_get_owner(owned) == clone);
+    assert(tower_node_get_component_for_write(clone, number_type) == owned);
+    assert(*(size_t*)tower_component_get_userdata(owned) == 1);
+    *(size_t*)tower_component_get_userdata(owned) = 2;
+    assert(*(size_t*)tower_node_get_component_userdata(root, number_type) == 1);
+    char** text = (char**)tower_component_get_userdata(tower_node_get_component_for_write(clone_b, text_type));
+    assert(*text != *(char**)tower_node_get_component_userdata(tower_node_get_child_member(root, "b"), text_type));
+    assert(strcmp(*text, "text1") == 0);
+    assert(tower_component_get_allocated_count() == template_component_count + 2);
+
+    // Changing the children of a clone clones that level first
+    TowerNode* added = tower_node_create();
+    tower_node_attach(added, clone_b);
+    tower_node_release_ref(added);
+    assert(tower_node_get_child_count(clone_b) == 3);
+    assert(tower_node_get_child_count(tower_node_get_child_member(root, "b")) == 2);
+    TowerNode* replacement = tower_node_create();
+    tower_node_attach_member(replacement, clone, "c");
+    tower_node_release_ref(replacement);
+    assert(tower_node_get_child_member(clone, "c") == replacement);
+    assert(tower_node_get_child_count(clone) == 3);
+
+    // Clones of clones and clones within arenas work the same way
+    tower_node_freeze(clone);
+    TowerArena* arena = tower_arena_create();
+    TowerNode* second = tower_node_clone_cow(clone, arena);
+    assert(*(const size_t*)tower_node_get_component_userdata_for_read(second, number_type) == 2);
+    TowerNode* second_b = tower_node_get_child_member(second, "b");
+    assert(tower_node_get_child_count(second_b) == 3);
+    text = (char**)tower_component_get_userdata(tower_node_get_component_for_write(second_b, text_type));
+    assert(strcmp(*text, "text1") == 0);
+    tower_arena_destroy(arena);
+    tower_node_thaw(clone);
+
+    tower_node_release_ref(clone);
+    assert(tower_node_get_allocated_count() == template_node_count);
+    assert(tower_component_get_allocated_count() == template_component_count);
+
+    // A clone holds a reference to it's source, which keeps it alive after being thawed and released
+    clone = tower_node_clone_cow(root);
+    tower_node_thaw(root);
+    tower_node_release_ref(root);
+    assert(tower_node_get_allocated_count() == template_node_count + 1);
+    assert(*(const size_t*)tower_node_get_component_userdata_for_read(clone, number_type) == 1);
+    tower_node_release_ref(clone);
+    tower_type_unregister(text_type);
+    tower_node_release_ref(text_type);
+    tower_node_release_ref(number_type);
+  }
+
+  assert(tower_node_get_allocated_count() == tower_node_initial_count);
+  assert(tower_component_get_allocated_count() == tower_component_initial_count);
+  assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
+
+  // Structural hashes and equality, which are kept up to date as subtrees change
+  {
+    TowerNode* number_type = tower_node_create();
+    TowerNode* text_type = tower_node_create();
+    TowerTypeInfo text_info = {
+      "tests.HashText",
+      [](TowerComponent* component, void* userdata) {
+        tower_memory_free(*(char**)userdata);
+      },
+      [](TowerComponent* component, void* userdata, TowerSnapshotWriter* writer) {
+        const char* text = *(char**)userdata;
+        tower_snapshot_writer_write(writer, text, strlen(text));
+      },
+      nullptr,
+      0,
+    };
+    tower_type_register(text_type, &text_info);
+
+    // Components are added in a different order, and the text is in different memory
+    const auto build = [&](bool reversed) {
+      TowerNode* root = tower_node_create();
+      for (size_t i = 0; i < 3; ++i) {
+        TowerNode* child = tower_node_create();
+        for (size_t c = 0; c < 2; ++c) {
+          if ((c == 0) != reversed) {
+            *(size_t*)tower_component_get_userdata(tower_component_create(child, number_type, sizeof(size_t), nullptr)) = i;
+          } else {
+            char* text = (char*)tower_memory_allocate(8);
+            snprintf(text, 8, "text%zu", i);
+            *(char**)tower_component_get_userdata(tower_component_create(child, text_type, sizeof(char*), text_info.destructor)) = text;
+          }
+        }
+        tower_node_attach_member(child, root, (i == 1) ? "second" : nullptr);
+        tower_node_release_ref(child);
+      }
+      return root;
+    };
+    TowerNode* a = build(false);
+    TowerNode* b = build(true);
+    assert(tower_node_hash(a) == tower_node_hash(b));
+    assert(tower_node_equal(a, b));
+    assert(tower_node_hash(tower_node_get_child(a, 0)) != tower_node_hash(tower_node_get_child(a, 2)));
+
+    // Changing a payload changes the hashes all the way up, and changing it back restores them
+    const uint64_t original_hash = tower_node_hash(a);
+    TowerNode* a_child = tower_node_get_child(a, 2);
+    size_t* number = (size_t*)tower_component_get_userdata(tower_node_get_component_for_write(a_child, number_type));
+    *number = 100;
+    assert(tower_node_hash(a) != original_hash);
+    assert(!tower_node_equal(a, b));
+    *number = 2;
+    tower_node_invalidate_hash(a_child);
+    assert(tower_node_hash(a) == original_hash);
+
+    // Getting the userdata to write to invalidates the hash the same way
+    *(size_t*)tower_node_get_component_userdata(a_child, number_type) = 100;
+    assert(tower_node_hash(a) != original_hash);
+    *(size_t*)tower_node_get_component_userdata(a_child, number_type) = 2;
+    assert(tower_node_hash(a) == original_hash);
+
+    // Member names, attaching and detaching are all part of the structure
+    TowerNode* renamed = tower_node_get_child(b, 0);
+    tower_node_attach_member(renamed, b, "first");
+    assert(!tower_node_equal(a, b));
+    assert(tower_node_get_child(b, 2) == renamed);
+    tower_node_attach(renamed, b);
+    assert(!tower_node_equal(a, b));
+    TowerNode* extra = tower_node_create();
+    tower_node_attach(extra, a);
+    assert(tower_node_get_child_count(a) == 4);
+    assert(!tower_node_equal(a, b));
+    tower_node_detach(extra);
+    tower_node_release_ref(extra);
+    // Moving the first child to the end in both trees leaves a tombstone in each
+    tower_node_attach(tower_node_get_child(a, 0), a);
+    assert(tower_node_equal(a, b));
+
+    // Clones start out equal to their source without cloning anything, and differ once written to
+    tower_node_freeze(a);
+    TowerNode* clone = tower_node_clone_cow(a);
+    const size_t node_count = tower_node_get_allocated_count();
+    assert(tower_node_hash(clone) == tower_node_hash(a));
+    assert(tower_node_equal(clone, b));
+    assert(tower_node_get_allocated_count() == node_count);
+    TowerNode* clone_child = tower_node_get_child(clone, 1);
+    *(size_t*)tower_component_get_userdata(tower_node_get_component_for_write(clone_child, number_type)) = 5;
+    assert(!tower_node_equal(clone, a));
+    assert(tower_node_equal(a, b));
+    tower_node_release_ref(clone);
+    tower_node_thaw(a);
+
+    // Freezing doesn't hash, so frozen subtrees are hashed the first time any thread asks
+    TowerNode* c = build(false);
+    tower_node_freeze(c);
+    std::vector<std::thread> threads;
+    uint64_t thread_hashes[4] = {};
+    for (size_t i = 0; i < 4; ++i) {
+      threads.emplace_back([&, i]() { thread_hashes[i] = tower_node_hash(c); });
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    for (size_t i = 0; i < 4; ++i) {
+      assert(thread_hashes[i] == original_hash);
+    }
+    tower_node_thaw(c);
+    tower_node_release_ref(c);
+
+    tower_node_release_ref(a);
+    tower_node_release_ref(b);
+    tower_type_unregister(text_type);
+    tower_node_release_ref(text_type);
+    tower_node_release_ref(number_type);
+  }
+
+  assert(tower_node_get_allocated_count() == tower_node_initial_count);
+  assert(tower_component_get_allocated_count() == tower_component_initial_count);
+  assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
+
+  // Interning shares one canonical node between every structurally equal subtree
+  {
+    TowerNode* type = tower_node_create();
+    const auto leaf = [&](size_t value) {
+      TowerNode* node = tower_node_create();
+      *(size_t*)tower_component_get_userdata(tower_component_create(node, type, sizeof(size_t), nullptr)) = value;
+      return node;
+    };
+    const auto build = [&]() {
+      // Two equal leaves, then two equal branches (one named) that each hold two leaves
+      TowerNode* root = leaf(0);
+      for (size_t i = 0; i < 4; ++i) {
+        TowerNode* child = leaf(i < 2 ? 1 : 5);
+        if (i >= 2) {
+          for (size_t j = 1; j <= 2; ++j) {
+            TowerNode* grandchild = leaf(j);
+            tower_node_attach(grandchild, child);
+            tower_node_release_ref(grandchild);
+          }
+        }
+        tower_node_attach_member(child, root, (i == 3) ? "named" : nullptr);
+        tower_node_release_ref(child);
+      }
+      return root;
+    };
+    const size_t node_count = tower_node_get_allocated_count();
+    TowerInterner* interner = tower_interner_create();
+    TowerNode* root = tower_interner_intern(interner, build());
+    assert(tower_interner_get_node_count(interner) == 4);
+    assert(tower_node_get_allocated_count() == node_count + 4);
+    assert(tower_node_is_shared(root) && tower_node_is_frozen(root));
+    assert(tower_node_get_child(root, 0) == tower_node_get_child(root, 1));
+    assert(tower_node_get_child(root, 2) == tower_node_get_child(root, 3));
+    assert(tower_node_get_child(tower_node_get_child(root, 2), 0) == tower_node_get_child(root, 0));
+    assert(tower_node_get_child_member(root, "named") == tower_node_get_child(root, 2));
+    assert(tower_node_get_parent(tower_node_get_child(root, 0)) == nullptr);
+    assert(tower_node_get_parent_child_index(tower_node_get_child(root, 0)) == TOWER_INVALID_INDEX);
+
+    // Interning an equal tree gives back the same nodes
+    assert(tower_interner_intern(interner, build()) == root);
+    assert(tower_interner_get_node_count(interner) == 4);
+    assert(tower_node_get_allocated_count() == node_count + 4);
+
+    // Shared nodes can be attached to many parents, which know their links without the node pointing back
+    TowerNode* shared = tower_node_get_child(root, 2);
+    TowerNode* parent = tower_node_create();
+    tower_node_attach(shared, parent);
+    tower_node_attach_member(shared, parent, "member");
+    tower_node_attach(shared, parent);
+    assert(tower_node_get_child_count(parent) == 3);
+    assert(tower_node_get_parent(shared) == nullptr);
+    tower_node_detach(shared);
+    assert(tower_node_get_child_count(parent) == 3);
+    tower_node_detach_child(parent, 2);
+    assert(tower_node_get_child_count(parent) == 2);
+    TowerNode* replacement = leaf(9);
+    tower_node_attach_member(replacement, parent, "member");
+    tower_node_release_ref(replacement);
+    assert(tower_node_get_child_member(parent, "member") == replacement);
+    assert(tower_node_get_child_count(parent) == 2);
+    assert(tower_node_get_child(parent, 0) == shared);
+    assert(tower_node_equal(tower_node_get_child(parent, 0), tower_node_get_child(root, 3)));
+
+    // Clones of shared nodes are ordinary nodes that can be changed
+    TowerNode* clone = tower_node_clone_cow(shared);
+    tower_node_attach(tower_node_get_child(clone, 0), clone);
+    assert(tower_node_get_child_count(clone) == 2 && !tower_node_is_shared(tower_node_get_child(clone, 0)));
+    assert(!tower_node_equal(clone, shared));
+    tower_node_attach(clone, parent);
+    tower_node_release_ref(clone);
+
+    // Parents in arenas, and parents destroyed later by deferred reclamation, release their shared children too
+    TowerArena* arena = tower_arena_create();
+    TowerNode* arena_parent = tower_node_create_in_arena(arena);
+    tower_node_attach(shared, arena_parent);
+    tower_reclaim_set_deferred(true);
+    tower_node_release_ref(parent);
+    tower_arena_destroy(arena);
+
+    // Shared nodes outlive the interner while a parent holds them, which leaves the holder, the node and it's children
+    TowerNode* holder = tower_node_create();
+    tower_node_attach(shared, holder);
+    tower_interner_destroy(interner);
+    tower_reclaim_set_deferred(false);
+    assert(tower_node_get_allocated_count() == node_count + 4);
+    assert(tower_node_get_child_count(shared) == 2);
+    assert(*(const size_t*)tower_node_get_component_userdata_for_read(tower_node_get_child(shared, 1), type) == 2);
+    tower_node_release_ref(holder);
+    tower_node_release_ref(type);
+  }
+
+  assert(tower_node_get_allocated_count() == tower_node_initial_count);
+  assert(tower_component_get_allocated_count() == tower_component_initial_count);
+  assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
+
+  // Cursors walk subtrees in pre-order, post-order and level order, optionally only returning nodes of a type
+  {
+    TowerNode* type = tower_node_create();
+    // root(0) has children 1 and 4, 1 has children 2 and 3, and 4 has the child 5
+    TowerNode* nodes[6];
+    for (size_t i = 0; i < 6; ++i) {
+      nodes[i] = tower_node_create();
+      if (i % 2 == 1) {
+        tower_component_create(nodes[i], type, sizeof(size_t), nullptr);
+      }
+    }
+    const size_t parents[6] = { 0, 0, 1, 1, 0, 4 };
+    for (size_t i = 1; i < 6; ++i) {
+      tower_node_attach(nodes[i], nodes[parents[i]]);
+      tower_node_release_ref(nodes[i]);
+    }
+    // Tombstones are skipped
+    TowerNode* detached = tower_node_create();
+    tower_node_attach(detached, nodes[1]);
+    tower_node_attach(nodes[3], nodes[1]);
+    tower_node_detach(detached);
+    tower_node_release_ref(detached);
+
+    const auto walk = [&](TowerCursor* cursor) {
+      std::string order;
+      while (TowerNode* node = tower_cursor_next(cursor)) {
+        for (size_t i = 0; i < 6; ++i) {
+          if (node == nodes[i]) {
+            order += (char)('0' + i);
+          }
+        }
+      }
+      return order;
+    };
+    TowerCursor* cursor = tower_cursor_create(nodes[0], TOWER_CURSOR_PRE_ORDER);
+    assert(walk(cursor) == "012345");
+    assert(tower_cursor_next(cursor) == nullptr);
+    tower_cursor_reset(cursor, nodes[1]);
+    assert(walk(cursor) == "123");
+    tower_cursor_destroy(cursor);
+
+    cursor = tower_cursor_create(nodes[0], TOWER_CURSOR_POST_ORDER);
+    assert(walk(cursor) == "231540");
+    tower_cursor_destroy(cursor);
+    cursor = tower_cursor_create(nodes[0], TOWER_CURSOR_LEVEL_ORDER);
+    assert(walk(cursor) == "014235");
+    tower_cursor_destroy(cursor);
+    cursor = tower_cursor_create(nodes[0], TOWER_CURSOR_POST_ORDER, type);
+    assert(walk(cursor) == "315");
+    tower_cursor_destroy(cursor);
+
+    // Pre-order walks can skip children, and the children of the last node returned can change
+    cursor = tower_cursor_create(nodes[0], TOWER_CURSOR_PRE_ORDER);
+    std::string order;
+    TowerNode* added = nullptr;
+    while (TowerNode* node = tower_cursor_next(cursor)) {
+      if (node == nodes[1]) {
+        tower_cursor_skip_children(cursor);
+      } else if (node == nodes[5]) {
+        added = tower_node_create();
+        tower_node_attach(added, node);
+        tower_node_release_ref(added);
+      } else if (node == nodes[4]) {
+        // Moves the child to the end, leaving a tombstone
+        tower_node_attach(nodes[5], node);
+      }
+      order += (node == added) ? 'a' : '.';
+    }
+    assert(order == "....a");
+    tower_cursor_destroy(cursor);
+
+    tower_node_release_ref(nodes[0]);
+    tower_node_release_ref(type);
+  }
+
+  assert(tower_node_get_allocated_count() == tower_node_initial_count);
+  assert(tower_component_get_allocated_count() == tower_component_initial_count);
+  assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
+
+  // Indexed types keep their live components in a dense array that can be queried by subtree
+  {
+    TowerNode* type = tower_node_create();
+    tower_type_set_indexed(type, true);
+    assert(tower_type_get_indexed(type));
+    const auto create = [&](TowerNode* parent, size_t value) {
+      TowerNode* node = tower_node_create();
+      *(size_t*)tower_component_get_userdata(tower_component_create(node, type, sizeof(size_t), nullptr)) = value;
+      if (parent) {
+        tower_node_attach(node, parent);
+        tower_node_release_ref(node);
+      }
+      return node;
+    };
+    const auto count_in = [&](TowerNode* root) {
+      size_t count = 0;
+      tower_type_get_subtree_components(type, root, &count);
+      return count;
+    };
+    const auto found_in = [&](TowerNode* root, TowerNode* owner) {
+      size_t count = 0;
+      TowerComponent* const* components = tower_type_get_subtree_components(type, root, &count);
+      return std::any_of(components, components + count, [&](TowerComponent* component) {
+        return tower_component_get_owner(component) == owner;
+      });
+    };
+
+    // root has children a and b, a has children a1 and a2, and b has the child b1 (b has no component)
+    TowerNode* root = create(nullptr, 0);
+    TowerNode* a = create(root, 1);
+    TowerNode* b = tower_node_create();
+    tower_node_attach(b, root);
+    tower_node_release_ref(b);
+    TowerNode* a1 = create(a, 2);
+    TowerNode* a2 = create(a, 3);
+    TowerNode* b1 = create(b, 4);
+    TowerNode* outside = create(nullptr, 5);
+
+    size_t count = 0;
+    tower_type_get_components(type, &count);
+    assert(count == 6);
+    assert(count_in(root) == 5);
+    assert(count_in(a) == 3);
+    assert(count_in(b) == 1);
+    assert(count_in(a2) == 1);
+    assert(count_in(outside) == 1);
+    // Subtrees are returned in pre-order
+    TowerComponent* const* components = tower_type_get_subtree_components(type, root, &count);
+    assert(tower_component_get_owner(components[0]) == root);
+    assert(tower_component_get_owner(components[1]) == a);
+    assert(tower_component_get_owner(components[2]) == a1);
+    assert(tower_component_get_owner(components[3]) == a2);
+    assert(tower_component_get_owner(components[4]) == b1);
+    assert(found_in(a, a1) && !found_in(b, a1));
+
+    // Moving, destroying and adding nodes are all seen by the next query
+    tower_node_attach(b1, a);
+    assert(count_in(a) == 4);
+    assert(count_in(b) == 0);
+    tower_node_detach(a2);
+    assert(count_in(a) == 3);
+    tower_type_get_components(type, &count);
+    assert(count == 5);
+    create(b, 6);
+    assert(count_in(b) == 1);
+    assert(count_in(root) == 5);
+
+    // Components within arenas, and those destroyed by the reclaimer, are removed as well
+    TowerArena* arena = tower_arena_create();
+    TowerNode* arena_node = tower_node_create_in_arena(arena);
+    tower_component_create(arena_node, type, sizeof(size_t), nullptr);
+    tower_type_get_components(type, &count);
+    assert(count == 7);
+    tower_arena_destroy(arena);
+    tower_reclaim_set_deferred(true);
+    tower_node_release_ref(outside);
+    tower_reclaim_flush();
+    tower_type_get_components(type, &count);
+    assert(count == 5);
+    tower_reclaim_set_deferred(false);
+
+    tower_type_set_indexed(type, false);
+    tower_node_release_ref(root);
+    tower_node_release_ref(type);
+  }
+
+  assert(tower_node_get_allocated_count() == tower_node_initial_count);
+  assert(tower_component_get_allocated_count() == tower_component_initial_count);
+  assert(tower_memory_get_allocated_count() == tower_memory_initial_count);
+
+  // Journals record the changes within their subtree until they are drained
+  {
+    TowerNode* type = tower_node_create();
+    TowerNode* root = tower_node_create();
+    TowerNode* child = tower_node_create();
+    TowerNode* grandchild = tower_node_create();
+    TowerNode* unrelated = tower_node_create();
+    TowerJournal* journal = tower_journal_create(root, 4);
+    TowerJournalEntry entries[8];
+    size_t dropped = 0;
+
+    // Nothing is recorded until the nodes are within the subtree
+    tower_component_create(child, type, sizeof(size_t), nullptr);
+    tower_node_attach(grandchild, child);
+    tower_node_attach(unrelated, grandchild);
+    assert(tower_journal_drain(journal, entries, 8, &dropped) == 0);
+
+    tower_node_attach_member(child, root, "child");
+    tower_component_create(grandchild, type, sizeof(size_t), nullptr);
+    tower_node_get_component_for_write(grandchild, type);
+    // Batches can be drained a few entries at a time
+    assert(tower_journal_drain(journal, entries, 2, &dropped) == 2);
+    assert(entries[0].event == TOWER_JOURNAL_ATTACH);
+    assert(tower_node_from_handle(entries[0].node) == root);
+    assert(tower_node_from_handle(entries[0].subject) == child);
+    assert(entries[0].member == tower_atom_intern("child"));
+    assert(entries[1].event == TOWER_JOURNAL_COMPONENT_CREATE);
+    assert(tower_node_from_handle(entries[1].node) == grandchild);
+    assert(tower_node_from_handle(entries[1].subject) == type);
+    assert(tower_journal_drain(journal, entries, 8, &dropped) == 1);
+    assert(entries[0].event == TOWER_JOURNAL_COMPONENT_WRITE);
+    assert(dropped == 0);
+
+    // Nested journals both see changes within the inner subtree, and destroyed nodes have dead handles
+    TowerJournal* inner = tower_journal_create(child, 4);
+    tower_node_release_ref(grandchild);
+    tower_node_detach(grandchild);
+    assert(tower_journal_drain(inner, entries, 8, &dropped) == 1);
+    assert(entries[0].event == TOWER_JOURNAL_DETACH);
+    assert(tower_node_from_handle(entries[0].node) == child);
+    assert(tower_node_from_handle(entries[0].subject) == nullptr);
+    assert(tower_journal_drain(journal, entries, 8, &dropped) == 1);
+    tower_journal_destroy(inner);
+
+    // When the buffer fills up, the oldest entries are overwritten
+    for (size_t i = 0; i < 3; ++i) {
+      tower_node_attach(unrelated, child);
+      tower_node_detach(unrelated);
+    }
+    assert(tower_journal_drain(journal, entries, 8, &dropped) == 4);
+    assert(dropped == 2);
+    assert(entries[0].event == TOWER_JOURNAL_ATTACH);
+    assert(entries[3].event == TOWER_JOURNAL_DETACH);
+    assert(tower_node_from_handle(entries[3].subject) == unrelated);
+    assert(tower_journal_drain(journal, entries, 8, &dropped) == 0);
+    assert(dropped == 0);
+
+    // Subtrees are recorded while they're moved into the journal's subtree, and not once moved out
+    TowerNode* branch = tower_node_create();
+    TowerNode* leaf = tower_node_create();
+    tower_node_attach(leaf, branch);
+    tower_node_attach(branch, child);
+    tower_component_create(leaf, type, sizeof(size_t), nullptr);
+    assert(tower_journal_drain(journal, entries, 8, &dropped) == 2);
+    assert(entries[1].event == TOWER_JOURNAL_COMPONENT_CREATE);
+    assert(tower_node_from_handle(entries[1].node) == leaf);
+    tower_node_attach(branch, unrelated);
+    tower_node_get_component_for_write(leaf, type);
+    assert(tower_journal_drain(journal, entries, 8, &dropped) == 1);
+    assert(entries[0].event == TOWER_JOURNAL_DETACH);
+    tower_node_release_ref(leaf);
+    tower_node_release_ref(branch);
+
+    tower_journal_destroy(journal);
+    tower_node_attach(unrelated, root);
+    tower_node_release_ref(unrelated);
+    tower_node_release_ref(child);
+    tower_node_release_ref(root);
+    tower_node_release_ref(type);
+  }
+
+  // Memory is counted by category and by component type, along with the peak since it was last reset
+  {
+    TowerMemoryCategory category = tower_memory_category_create("tests");
+    assert(tower_memory_category_create("tests") == category);
+    assert(strcmp(tower_memory_category_get_name(category), "tests") == 0);
+    assert(tower_memory_get_category_count() > category);
+
+    TowerMemoryStats before = tower_memory_get_stats(category);
+    void* a = tower_memory_allocate_tagged(100, category);
+    void* b = tower_memory_allocate_tagged(200, category);
+    TowerMemoryStats stats = tower_memory_get_stats(category);
+    assert(stats.count == before.count + 2);
+    assert(stats.bytes >= before.bytes + 300);
+    tower_memory_free(b);
+    stats = tower_memory_get_stats(category);
+    assert(stats.count == before.count + 1);
+    assert(stats.peak_bytes >= before.bytes + 300);
+    tower_memory_reset_peaks();
+    assert(tower_memory_get_stats(category).peak_bytes == tower_memory_get_stats(category).bytes);
+    tower_memory_free(a);
+    assert(tower_memory_get_stats(category).bytes == before.bytes);
+
+    TowerMemoryStats snapshot[64];
+    size_t category_count = tower_memory_snapshot(snapshot, 64);
+    assert(category_count == tower_memory_get_category_count());
+    assert(snapshot[category].count == before.count);
+
+    // Components are counted by type whether or not they fit within their node, but not within arenas
+    TowerNode* type = tower_node_create();
+    TowerNode* node = tower_node_create_with_capacity(nullptr, 1, sizeof(size_t));
+    tower_component_create(node, type, sizeof(size_t), nullptr);
+    TowerNode* other = tower_node_create();
+    tower_component_create(other, type, 1000, nullptr);
+    stats = tower_type_get_memory_stats(type);
+    assert(stats.count == 2);
+    assert(stats.bytes >= 1000 + sizeof(size_t));
+    TowerArena* arena = tower_arena_create();
+    tower_component_create(tower_node_create_in_arena(arena), type, sizeof(size_t), nullptr);
+    assert(tower_type_get_memory_stats(type).count == 2);
+    tower_arena_destroy(arena);
+    tower_node_release_ref(other);
+    stats = tower_type_get_memory_stats(type);
+    assert(stats.count == 1);
+    assert(stats.peak_bytes >= 1000);
+
+    // Both dumps name every category and the types with live components
+    std::string text;
+    const auto append = [](const uint8_t* data, size_t length, void* userdata) {
+      ((std::string*)userdata)->append((const char*)data, length);
+    };
+    tower_memory_dump(append, &text, false);
+    assert(text.find("\ntests ") != std::string::npos);
+    assert(text.find("\ntype #" + std::to_string(tower_node_get_id(type)) + " ") != std::string::npos);
+    std::string json;
+    tower_memory_dump(append, &json, true);
+    assert(json.find("{\"categories\":{\"general\":{\"bytes\":") == 0);
+    assert(json.find("\"tests\":{\"bytes\":") != std::string::npos);
+    assert(json.find("},\"types\":{") != std::string::npos);
+    assert(json.find("\"#" + std::to_string(tower_node_get_id(type)) + "\":{") != std::string::npos);
+
+    // Flush runs outside the lock, so it can create and destroy types
+    size_t flushes = 0;
+    tower_memory_dump([](const uint8_t* data, size_t length, void* userdata) {
+      TowerNode* flushed_type = tower_node_create();
+      TowerNode* flushed = tower_node_create();
+      tower_component_create(flushed, flushed_type, sizeof(size_t), nullptr);
+      tower_node_release_ref(flushed);
+      tower_node_release_ref(flushed_type);
+      ++*(size_t*)userdata;
+    }, &flushes, true);
+    assert(flushes != 0);
+
+    tower_node_release_ref(node);
+    tower_node_release_ref(type);
+  }
+
+  // Counts stay exact when nodes are created on one thread and released on another, and every thread's
+  // node ids are unique
+  {
+    const size_t thread_count = 4;
+    const size_t per_thread = 3000;
+    std::vector<std::vector<TowerNode*>> created(thread_count);
+    // Frozen types can be shared between threads, since their reference count never changes
+    TowerNode* type = tower_node_create();
+    tower_node_freeze(type);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < thread_count; ++t) {
+      threads.emplace_back([&, t]() {
+        for (size_t i = 0; i < per_thread; ++i) {
+          TowerNode* node = tower_node_create();
+          tower_component_create(node, type, sizeof(size_t), nullptr);
+          created[t].push_back(node);
+        }
+      });
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    threads.clear();
+    assert(tower_node_get_allocated_count() == tower_node_initial_count + thread_count * per_thread + 1);
+    assert(tower_component_get_allocated_count() == tower_component_initial_count + thread_count * per_thread);
+
+    std::vector<size_t> ids;
+    for (size_t t = 0; t < thread_count; ++t) {
+      for (size_t i = 0; i < per_thread; ++i) {
+        ids.push_back(tower_node_get_id(created[t][i]));
+        // Ids count up within a thread
+        assert(i == 0 || ids.back() > ids[ids.size() - 2]);
+      }
+    }
+    std::sort(ids.begin(), ids.end());
+    assert(std::adjacent_find(ids.begin(), ids.end()) == ids.end());
+
+    // Each thread releases the nodes another thread created
+    for (size_t t = 0; t < thread_count; ++t) {
+      threads.emplace_back([&, t]() {
+        for (TowerNode* node : created[(t + 1) % thread_count]) {
+          tower_node_release_ref(node);
+        }
+      });
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    tower_node_thaw(type);
+    tower_node_release_ref(type);
+  }
+  // Sampling every byte records every allocation after the first with its scopes, and frees only leave the total
+  {
+    const auto append = [](const uint8_t* data, size_t length, void* userdata) {
+      ((std::string*)userdata)->append((const char*)data, length);
+    };
+    // Sums the bytes of every folded stack that starts with the prefix
+    const auto sum_bytes = [&](bool live, const char* prefix) {
+      std::string text;
+      tower_profiler_dump(append, &text, live);
+      size_t bytes = 0;
+      size_t line_start = 0;
+      while (line_start < text.size()) {
+        const size_t line_end = text.find('\n', line_start);
+        assert(line_end != std::string::npos);
+        if (text.compare(line_start, strlen(prefix), prefix) == 0) {
+          bytes += std::stoull(text.substr(text.rfind(' ', line_end) + 1, line_end));
+        }
+        line_start = line_end + 1;
+      }
+      return bytes;
+    };
+
+    assert(tower_profiler_get_sample_interval() == 0);
+    tower_profiler_set_sample_interval(1);
+    assert(tower_profiler_get_sample_interval() == 1);
+    tower_profiler_push_scope("profiler test");
+    void* allocations[10];
+    for (void*& allocation : allocations) {
+      allocation = tower_memory_allocate(1000);
+    }
+    tower_profiler_push_scope("inner");
+    void* inner = tower_memory_allocate(1000);
+    tower_profiler_pop_scope();
+    tower_profiler_pop_scope();
+    for (size_t i = 0; i < 5; ++i) {
+      tower_memory_free(allocations[i]);
+    }
+    assert(sum_bytes(false, "profiler test;") == 10000);
+    assert(sum_bytes(true, "profiler test;") == 6000);
+    assert(sum_bytes(true, "profiler test;inner;") == 1000);
+
+    // Flush runs outside the lock, so it can allocate while sampling
+    std::vector<void*> flushed;
+    tower_profiler_dump([](const uint8_t* data, size_t length, void* userdata) {
+      ((std::vector<void*>*)userdata)->push_back(tower_memory_allocate(length));
+    }, &flushed, false);
+    assert(!flushed.empty());
+    for (void* allocation : flushed) {
+      tower_memory_free(allocation);
+    }
+
+    // Allocations made while disabled are never sampled, but sampled ones are still forgotten when freed
+    tower_profiler_set_sample_interval(0);
+    void* unsampled = tower_memory_allocate(1000);
+    tower_memory_free(unsampled);
+    for (size_t i = 5; i < 10; ++i) {
+      tower_memory_free(allocations[i]);
+    }
+    tower_memory_free(inner);
+    assert(sum_bytes(true, "profiler test;") == 0);
+    assert(sum_bytes(false, "profiler test;") == 10000);
+  }
+}
+
+// Returns the number of millions of operations per second since the start time
+double tower_benchmark_mops(std::chrono::high_resolution_clock::time_point start, size_t operations) {
+  auto elapsed = std::chrono::high_resolution_clock::now() - start;
+  double seconds = std::chrono::duration<double>(elapsed).count();
+  return (double)operations / seconds / 1000000.0;
+}
+
+// The benchmarks only use the public api (just like the tests)
+void tower_benchmarks() {
+  const size_t iterations = 1000;
+  const size_t batch = 1000;
+  const size_t operations = iterations * batch;
+  void* allocations[batch];
+
+  // Allocation churn of node and component sized blocks through the general purpose heap (the baseline)
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+      for (size_t j = 0; j < batch; ++j) {
+        allocations[j] = malloc(64 + (j % 4) * 16);
+      }
+      for (size_t j = 0; j < batch; ++j) {
+        free(allocations[j]);
+      }
+    }
+    printf("malloc/free: %.2f Mops/s\n", tower_benchmark_mops(start, operations));
+  }
+
+  // The same churn through the tower size class allocator
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+      for (size_t j = 0; j < batch; ++j) {
+        allocations[j] = tower_memory_allocate(64 + (j % 4) * 16);
+      }
+      for (size_t j = 0; j < batch; ++j) {
+        tower_memory_free(allocations[j]);
+      }
+    }
+    printf("tower_memory_allocate/free: %.2f Mops/s\n", tower_benchmark_mops(start, operations));
+  }
+
+  // Node and component churn, similar to a recognizer creating a Match node per character
+  {
+    TowerNode* type = tower_node_create();
+    TowerNode* nodes[batch];
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+      for (size_t j = 0; j < batch; ++j) {
+        nodes[j] = tower_node_create();
+        tower_component_create(nodes[j], type, sizeof(size_t) * 3, nullptr);
+      }
+      for (size_t j = 0; j < batch; ++j) {
+        tower_node_release_ref(nodes[j]);
+      }
+    }
+    printf("tower_node_create/release with component: %.2f Mops/s\n", tower_benchmark_mops(start, operations));
+    tower_node_release_ref(type);
+  }
+
+  // Build flat parse trees of Match-like nodes and tear them down, individually, within a new arena each
+  // time, and within one arena that is reset each time
+  {
+    TowerNode* type = tower_node_create();
+    const char* modes[] = { "individual", "arena", "arena reset" };
+    for (int use_arena = 0; use_arena < 3; ++use_arena) {
+      TowerArena* reused = (use_arena == 2) ? tower_arena_create() : nullptr;
+      auto start = std::chrono::high_resolution_clock::now();
+      for (size_t i = 0; i < iterations; ++i) {
+        TowerArena* arena = reused ? reused : use_arena ? tower_arena_create() : nullptr;
+        TowerNode* root = tower_node_create_in_arena(arena);
+        for (size_t j = 0; j < batch; ++j) {
+          TowerNode* node = tower_node_create_in_arena(arena);
+          tower_component_create(node, type, sizeof(size_t) * 3, nullptr);
+          tower_node_attach(node, root);
+          tower_node_release_ref(node);
+        }
+        if (reused) {
+          tower_arena_reset(reused);
+        } else if (arena) {
+          tower_arena_destroy(arena);
+        } else {
+          tower_node_release_ref(root);
+        }
+      }
+      printf("parse tree build/teardown (%s): %.2f Mnodes/s\n", modes[use_arena], tower_benchmark_mops(start, operations));
+      if (reused) {
+        tower_arena_destroy(reused);
+      }
+    }
+    tower_node_release_ref(type);
+  }
+
+  // Detach, reattach, and query the positions of children within a 10k child node
+  {
+    const size_t wide_count = 10000;
+    TowerNode* parent = tower_node_create();
+    TowerNode** children = (TowerNode**)tower_memory_allocate(sizeof(TowerNode*) * wide_count);
+    for (size_t i = 0; i < wide_count; ++i) {
+      children[i] = tower_node_create();
+      tower_node_attach(children[i], parent);
+    }
+
+    {
+      auto start = std::chrono::high_resolution_clock::now();
+      for (size_t i = 0; i < wide_count; ++i) {
+        tower_node_detach(children[i]);
+      }
+      printf("detach from the front of 10k children: %.2f Mops/s\n", tower_benchmark_mops(start, wide_count));
+    }
+
+    {
+      auto start = std::chrono::high_resolution_clock::now();
+      for (size_t i = 0; i < wide_count; ++i) {
+        tower_node_attach(children[i], parent);
+      }
+      printf("attach 10k children: %.2f Mops/s\n", tower_benchmark_mops(start, wide_count));
+    }
+
+    {
+      auto start = std::chrono::high_resolution_clock::now();
+      size_t index_sum = 0;
+      for (size_t i = 0; i < wide_count; ++i) {
+        index_sum += tower_node_get_parent_child_index(children[i]);
+        index_sum += (size_t)tower_node_get_parent_member_name(children[i]);
+      }
+      printf("child index/member name of 10k children: %.2f Mops/s (index sum %zu)\n",
+        tower_benchmark_mops(start, wide_count),
+        index_sum);
+    }
+
+    {
+      // Move every other child to the end, which interleaves detaching and attaching
+      auto start = std::chrono::high_resolution_clock::now();
+      for (size_t i = 0; i < wide_count; i += 2) {
+        tower_node_attach(children[i], nullptr);
+        tower_node_attach(children[i], parent);
+      }
+      printf("reattach 5k of 10k children: %.2f Mops/s\n", tower_benchmark_mops(start, wide_count / 2));
+    }
+
+    for (size_t i = 0; i < wide_count; ++i) {
+      tower_node_release_ref(children[i]);
+    }
+    tower_memory_free(children);
+    tower_node_release_ref(parent);
+  }
+
+  // Look up members of an object-like node by name and by atom
+  {
+    const size_t member_count = 16;
+    const char* names[member_count] = {
+      "a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m", "n", "o", "p"
+    };
+    TowerAtom atoms[member_count];
+    TowerNode* parent = tower_node_create();
+    for (size_t i = 0; i < member_count; ++i) {
+      atoms[i] = tower_atom_intern(names[i]);
+      TowerNode* child = tower_node_create();
+      tower_node_attach_member_atom(child, parent, atoms[i]);
+      tower_node_release_ref(child);
+    }
+
+    size_t found = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < operations; ++i) {
+      found += tower_node_get_child_member(parent, names[i % member_count]) != nullptr;
+    }
+    printf("member lookup by name (16 members): %.2f Mops/s\n", tower_benchmark_mops(start, operations));
+
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < operations; ++i) {
+      found += tower_node_get_child_member_atom(parent, atoms[i % member_count]) != nullptr;
+    }
+    printf("member lookup by atom (16 members): %.2f Mops/s (found %zu)\n", tower_benchmark_mops(start, operations), found);
+    tower_node_release_ref(parent);
+  }
+
+  // Build and query a scope-like node with many named members
+  {
+    const size_t member_count = 10000;
+    TowerAtom* atoms = (TowerAtom*)tower_memory_allocate(sizeof(TowerAtom) * member_count);
+    for (size_t i = 0; i < member_count; ++i) {
+      char name[32];
+      snprintf(name, sizeof(name), "symbol%zu", i);
+      atoms[i] = tower_atom_intern(name);
+    }
+
+    TowerNode* parent = tower_node_create();
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < member_count; ++i) {
+      TowerNode* child = tower_node_create();
+      tower_node_attach_member_atom(child, parent, atoms[i]);
+      tower_node_release_ref(child);
+    }
+    printf("attach 10k named members: %.2f Mops/s\n", tower_benchmark_mops(start, member_count));
+
+    size_t found = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < operations; ++i) {
+      found += tower_node_get_child_member_atom(parent, atoms[(i * 7919) % member_count]) != nullptr;
+    }
+    printf("member lookup by atom (10k members): %.2f Mops/s (found %zu)\n", tower_benchmark_mops(start, operations), found);
+
+    tower_node_release_ref(parent);
+    tower_memory_free(atoms);
+  }
+
+  // Probe nodes for components by type, like parser_grammar_create does for each symbol
+  {
+    const size_t type_count = 4;
+    const size_t node_count = 100000;
+    const size_t passes = operations / node_count;
+    TowerNode* types[type_count];
+    for (size_t i = 0; i < type_count; ++i) {
+      types[i] = tower_node_create();
+    }
+    TowerNode* missing_type = tower_node_create();
+
+    TowerNode** nodes = (TowerNode**)tower_memory_allocate(sizeof(TowerNode*) * node_count);
+    for (size_t j = 0; j < node_count; ++j) {
+      nodes[j] = tower_node_create();
+      for (size_t i = 0; i < type_count; ++i) {
+        tower_component_create(nodes[j], types[(i + j) % type_count], sizeof(size_t), nullptr);
+      }
+    }
+
+    size_t found = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < passes; ++i) {
+      for (size_t j = 0; j < node_count; ++j) {
+        found += tower_node_get_component(nodes[j], types[i % type_count]) != nullptr;
+        found += tower_node_get_component(nodes[j], missing_type) != nullptr;
+      }
+    }
+    printf("get component (100k nodes, 4 components, half missing): %.2f Mops/s (found %zu)\n",
+      tower_benchmark_mops(start, passes * node_count * 2),
+      found);
+
+    for (size_t j = 0; j < node_count; ++j) {
+      tower_node_release_ref(nodes[j]);
+    }
+    tower_memory_free(nodes);
+    for (size_t i = 0; i < type_count; ++i) {
+      tower_node_release_ref(types[i]);
+    }
+    tower_node_release_ref(missing_type);
+  }
+
+  // Release the root of a deep chain, like a long linked list of statements
+  {
+    const size_t depth = 1000000;
+    TowerNode* root = tower_node_create();
+    TowerNode* parent = root;
+    for (size_t i = 0; i < depth; ++i) {
+      TowerNode* child = tower_node_create();
+      tower_node_attach(child, parent);
+      tower_node_release_ref(child);
+      parent = child;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    tower_node_release_ref(root);
+    printf("release 1M deep chain: %.2f Mnodes/s\n", tower_benchmark_mops(start, depth + 1));
+  }
+
+  // Release a wide tree where every node has a component
+  {
+    const size_t fanout = 1000;
+    TowerNode* type = tower_node_create();
+    TowerNode* root = tower_node_create();
+    for (size_t i = 0; i < fanout; ++i) {
+      TowerNode* child = tower_node_create();
+      tower_node_attach(child, root);
+      for (size_t j = 0; j < fanout - 1; ++j) {
+        TowerNode* leaf = tower_node_create();
+        tower_component_create(leaf, type, sizeof(size_t), nullptr);
+        tower_node_attach(leaf, child);
+        tower_node_release_ref(leaf);
+      }
+      tower_node_release_ref(child);
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    tower_node_release_ref(root);
+    printf("release 1M node tree: %.2f Mnodes/s\n", tower_benchmark_mops(start, fanout * fanout + 1));
+    tower_node_release_ref(type);
+  }
+
+  // Drop a 1M node tree, measuring how long the releasing thread is stalled
+  {
+    const size_t fanout = 1000;
+    TowerNode* type = tower_node_create();
+    for (size_t deferred = 0; deferred < 2; ++deferred) {
+      tower_reclaim_set_deferred(deferred != 0);
+      TowerNode* root = tower_node_create();
+      for (size_t i = 0; i < fanout; ++i) {
+        TowerNode* child = tower_node_create();
+        tower_node_attach(child, root);
+        for (size_t j = 0; j < fanout - 1; ++j) {
+          TowerNode* leaf = tower_node_create();
+          tower_component_create(leaf, type, sizeof(size_t), nullptr);
+          tower_node_attach(leaf, child);
+          tower_node_release_ref(leaf);
+        }
+        tower_node_release_ref(child);
+      }
+
+      auto start = std::chrono::high_resolution_clock::now();
+      tower_node_release_ref(root);
+      auto released = std::chrono::high_resolution_clock::now();
+      tower_reclaim_flush();
+      printf("release 1M node tree (%s): %.3f ms stalled, %.3f ms until flushed\n",
+        deferred ? "deferred" : "synchronous",
+        std::chrono::duration<double, std::milli>(released - start).count(),
+        std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+    }
+    tower_reclaim_set_deferred(false);
+    tower_node_release_ref(type);
+  }
+
+  // Add and release references on a single thread, with and without an atomic reference count
+  {
+    TowerNode* node = tower_node_create();
+    for (size_t atomic = 0; atomic < 2; ++atomic) {
+      tower_node_set_atomic_ref_count(node, atomic != 0);
+      size_t checksum = 0;
+      auto start = std::chrono::high_resolution_clock::now();
+      for (size_t i = 0; i < operations; ++i) {
+        checksum += tower_node_add_ref(node);
+        checksum += tower_node_release_ref(node);
+      }
+      printf("add_ref/release_ref (%s): %.2f Mops/s (checksum %zu)\n",
+        atomic ? "atomic" : "plain", tower_benchmark_mops(start, operations), checksum);
+    }
+
+    // Contended by several threads at once
+    const size_t thread_count = 4;
+    std::thread threads[thread_count];
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t t = 0; t < thread_count; ++t) {
+      threads[t] = std::thread([node, operations]() {
+        for (size_t i = 0; i < operations; ++i) {
+          tower_node_add_ref(node);
+          tower_node_release_ref(node);
+        }
+      });
+    }
+    for (size_t t = 0; t < thread_count; ++t) {
+      threads[t].join();
+    }
+    printf("add_ref/release_ref (atomic, 4 threads): %.2f Mops/s\n", tower_benchmark_mops(start, operations * thread_count));
+    tower_node_release_ref(node);
+  }
+
+  // Several threads reading the same tree while holding references to the nodes they visit
+  {
+    const size_t thread_count = 4;
+    const size_t child_count = 64;
+    TowerNode* root = tower_node_create();
+    tower_node_set_atomic_ref_count(root, true);
+    for (size_t i = 0; i < child_count; ++i) {
+      TowerNode* child = tower_node_create();
+      tower_node_set_atomic_ref_count(child, true);
+      tower_node_attach(child, root);
+      tower_node_release_ref(child);
+    }
+
+    for (size_t frozen = 0; frozen < 2; ++frozen) {
+      if (frozen) {
+        tower_node_freeze(root);
+      }
+      std::thread threads[thread_count];
+      auto start = std::chrono::high_resolution_clock::now();
+      for (size_t t = 0; t < thread_count; ++t) {
+        threads[t] = std::thread([root, operations, child_count]() {
+          for (size_t i = 0; i < operations; ++i) {
+            TowerNode* child = tower_node_get_child(root, i % child_count);
+            tower_node_add_ref(child);
+            tower_node_release_ref(child);
+          }
+        });
+      }
+      for (size_t t = 0; t < thread_count; ++t) {
+        threads[t].join();
+      }
+      printf("shared read with references (%s, 4 threads): %.2f Mops/s\n",
+        frozen ? "frozen" : "atomic", tower_benchmark_mops(start, operations * thread_count));
+    }
+    tower_node_thaw(root);
+    tower_node_release_ref(root);
+  }
+
+  // Walk children one call at a time, the way parser_grammar_create used to, and as a span
+  {
+    const size_t child_count = 1000;
+    TowerNode* parent = tower_node_create();
+    TowerNode** children = (TowerNode**)tower_memory_allocate(sizeof(TowerNode*) * child_count);
+    for (size_t i = 0; i < child_count; ++i) {
+      children[i] = tower_node_create();
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < child_count; ++i) {
+      tower_node_attach(children[i], parent);
+    }
+    printf("attach 1k children one at a time: %.2f Mops/s\n", tower_benchmark_mops(start, child_count));
+    tower_node_release_ref(parent);
+
+    parent = tower_node_create();
+    start = std::chrono::high_resolution_clock::now();
+    tower_node_attach_many(children, child_count, parent);
+    printf("attach 1k children at once: %.2f Mops/s\n", tower_benchmark_mops(start, child_count));
+
+    size_t checksum = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+      for (size_t c = 0;; ++c) {
+        TowerNode* child = tower_node_get_child(parent, c);
+        if (!child) {
+          break;
+        }
+        checksum += (size_t)child;
+      }
+    }
+    printf("walk children with get_child: %.2f Mops/s\n", tower_benchmark_mops(start, iterations * child_count));
+
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+      size_t count = 0;
+      TowerNode* const* span = tower_node_get_children(parent, &count);
+      for (size_t c = 0; c < count; ++c) {
+        checksum += (size_t)span[c];
+      }
+    }
+    printf("walk children with get_children: %.2f Mops/s (checksum %zu)\n", tower_benchmark_mops(start, iterations * child_count), checksum);
+
+    for (size_t i = 0; i < child_count; ++i) {
+      tower_node_release_ref(children[i]);
+    }
+    tower_memory_free(children);
+    tower_node_release_ref(parent);
+  }
+
+  // Resolve handles to nodes, as a host holding handles instead of pointers would
+  {
+    const size_t node_count = 100000;
+    TowerNode** nodes = (TowerNode**)tower_memory_allocate(sizeof(TowerNode*) * node_count);
+    TowerHandle* handles = (TowerHandle*)tower_memory_allocate(sizeof(TowerHandle) * node_count);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < node_count; ++i) {
+      nodes[i] = tower_node_create();
+      handles[i] = tower_node_get_handle(nodes[i]);
+    }
+    printf("create node and get handle: %.2f Mops/s\n", tower_benchmark_mops(start, node_count));
+
+    size_t found = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < operations; ++i) {
+      found += tower_node_from_handle(handles[(i * 7919) % node_count]) != nullptr;
+    }
+    printf("resolve handle (100k nodes): %.2f Mops/s (found %zu)\n", tower_benchmark_mops(start, operations), found);
+
+    for (size_t i = 0; i < node_count; ++i) {
+      tower_node_release_ref(nodes[i]);
+    }
+    tower_memory_free(handles);
+    tower_memory_free(nodes);
+  }
+
+  // Upgrade weak references held by a cache, like a symbol table holding declarations
+  {
+    const size_t node_count = 1000;
+    TowerNode** nodes = (TowerNode**)tower_memory_allocate(sizeof(TowerNode*) * node_count);
+    TowerWeak** weaks = (TowerWeak**)tower_memory_allocate(sizeof(TowerWeak*) * node_count);
+    for (size_t i = 0; i < node_count; ++i) {
+      nodes[i] = tower_node_create();
+      weaks[i] = tower_node_create_weak(nodes[i]);
+    }
+
+    size_t found = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < operations; ++i) {
+      TowerNode* node = tower_weak_upgrade(weaks[i % node_count]);
+      if (node) {
+        ++found;
+        tower_node_release_ref(node);
+      }
+    }
+    printf("weak upgrade/release: %.2f Mops/s (found %zu)\n", tower_benchmark_mops(start, operations), found);
+
+    for (size_t i = 0; i < node_count; ++i) {
+      tower_node_release_ref(nodes[i]);
+      tower_weak_release(weaks[i]);
+    }
+    tower_memory_free(weaks);
+    tower_memory_free(nodes);
+  }
+
+  // Load a grammar sized tree (a few hundred rules) from a snapshot, like warm starting the bootstrap grammar
+  {
+    const size_t rule_count = 200;
+    const size_t symbols_per_rule = 4;
+    TowerNode* type = tower_node_create();
+    TowerTypeInfo info = { "benchmarks.Symbol", nullptr, nullptr, nullptr, 0 };
+    tower_type_register(type, &info);
+
+    TowerNode* rules = tower_node_create();
+    for (size_t r = 0; r < rule_count; ++r) {
+      TowerNode* rule = tower_node_create();
+      *(size_t*)tower_component_get_userdata(tower_component_create(rule, type, sizeof(size_t) * 4, nullptr)) = r;
+      for (size_t s = 0; s < symbols_per_rule; ++s) {
+        TowerNode* symbol = tower_node_create();
+        *(size_t*)tower_component_get_userdata(tower_component_create(symbol, type, sizeof(size_t) * 4, nullptr)) = s;
+        tower_node_attach(symbol, rule);
+        tower_node_release_ref(symbol);
+      }
+      tower_node_attach(rule, rules);
+      tower_node_release_ref(rule);
+    }
+    const size_t node_count = 1 + rule_count * (1 + symbols_per_rule);
+
+    size_t bytes = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    void* data = tower_snapshot_create(rules, &bytes);
+    auto created = std::chrono::high_resolution_clock::now();
+    const size_t loads = 100;
+    size_t checksum = 0;
+    for (size_t i = 0; i < loads; ++i) {
+      TowerArena* arena = tower_arena_create();
+      TowerNode* loaded = tower_snapshot_instantiate(tower_snapshot_view(data, bytes), arena);
+      checksum += tower_node_get_child_count(loaded);
+      tower_arena_destroy(arena);
+    }
+    auto loaded = std::chrono::high_resolution_clock::now();
+    printf("snapshot of %zu nodes (%zu bytes): create %.3f ms, load into arena %.3f ms (checksum %zu)\n",
+      node_count, bytes,
+      std::chrono::duration<double, std::milli>(created - start).count(),
+      std::chrono::duration<double, std::milli>(loaded - created).count() / loads, checksum);
+
+    tower_memory_free(data);
+    tower_node_release_ref(rules);
+    tower_type_unregister(type);
+    tower_node_release_ref(type);
+  }
+
+  // Stream a 1M node tree to JSON and read it back, like dumping a large parse tree
+  {
+    const size_t fanout = 1000;
+    TowerNode* type = tower_node_create();
+    TowerTypeInfo info = { "benchmarks.Match", nullptr, nullptr, nullptr, 0 };
+    tower_type_register(type, &info);
+    TowerNode* root = tower_node_create();
+    for (size_t i = 0; i < fanout; ++i) {
+      TowerNode* child = tower_node_create();
+      tower_node_attach(child, root);
+      for (size_t j = 0; j < fanout - 1; ++j) {
+        TowerNode* leaf = tower_node_create();
+        *(size_t*)tower_component_get_userdata(tower_component_create(leaf, type, sizeof(size_t) * 2, nullptr)) = j;
+        tower_node_attach(leaf, child);
+        tower_node_release_ref(leaf);
+      }
+      tower_node_release_ref(child);
+    }
+
+    std::vector<char> json;
+    json.reserve(64 * 1024 * 1024);
+    auto start = std::chrono::high_resolution_clock::now();
+    tower_json_write(root, [](const uint8_t* data, size_t length, void* userdata) {
+      std::vector<char>* json = (std::vector<char>*)userdata;
+      json->insert(json->end(), (const char*)data, (const char*)data + length);
+    }, &json);
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    printf("json write 1M nodes: %.2f MB/s (%zu bytes)\n", json.size() / seconds / 1e6, json.size());
+
+    TowerArena* arena = tower_arena_create();
+    TowerJsonReader* reader = tower_json_reader_create(arena);
+    start = std::chrono::high_resolution_clock::now();
+    const size_t chunk = 64 * 1024;
+    for (size_t offset = 0; offset < json.size(); offset += chunk) {
+      tower_json_reader_feed(reader, json.data() + offset, std::min(chunk, json.size() - offset));
+    }
+    TowerNode* loaded = tower_json_reader_finish(reader);
+    seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    printf("json read 1M nodes into arena: %.2f MB/s (%zu children)\n", json.size() / seconds / 1e6, tower_node_get_child_count(loaded));
+    tower_json_reader_destroy(reader);
+    tower_arena_destroy(arena);
+
+    tower_node_release_ref(root);
+    tower_type_unregister(type);
+    tower_node_release_ref(type);
+  }
+
+  // Instantiate a 200 node replacement template and change a single node in it, by copying the whole
+  // template (through a snapshot) compared to cloning it copy on write
+  {
+    const size_t branch_count = 10;
+    const size_t leaves_per_branch = 19;
+    TowerNode* type = tower_node_create();
+    TowerTypeInfo info = { "benchmarks.Template", nullptr, nullptr, nullptr, 0 };
+    tower_type_register(type, &info);
+
+    TowerNode* root = tower_node_create();
+    *(size_t*)tower_component_get_userdata(tower_component_create(root, type, sizeof(size_t) * 4, nullptr)) = 0;
+    for (size_t b = 0; b < branch_count; ++b) {
+      TowerNode* branch = tower_node_create();
+      *(size_t*)tower_component_get_userdata(tower_component_create(branch, type, sizeof(size_t) * 4, nullptr)) = b;
+      for (size_t l = 0; l < leaves_per_branch; ++l) {
+        TowerNode* leaf = tower_node_create();
+        *(size_t*)tower_component_get_userdata(tower_component_create(leaf, type, sizeof(size_t) * 4, nullptr)) = l;
+        tower_node_attach(leaf, branch);
+        tower_node_release_ref(leaf);
+      }
+      tower_node_attach(branch, root);
+      tower_node_release_ref(branch);
+    }
+    tower_node_freeze(root);
+    size_t bytes = 0;
+    void* data = tower_snapshot_create(root, &bytes);
+    const TowerSnapshot* snapshot = tower_snapshot_view(data, bytes);
+
+    const size_t instantiations = 100000;
+    size_t checksum = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < instantiations; ++i) {
+      TowerNode* copy = tower_snapshot_instantiate(snapshot, nullptr);
+      TowerNode* leaf = tower_node_get_child(tower_node_get_child(copy, i % branch_count), i % leaves_per_branch);
+      size_t* value = (size_t*)tower_component_get_userdata(tower_node_get_component_for_write(leaf, type));
+      checksum += ++*value;
+      tower_node_release_ref(copy);
+    }
+    double copy_mops = tower_benchmark_mops(start, instantiations);
+
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < instantiations; ++i) {
+      TowerNode* clone = tower_node_clone_cow(root);
+      TowerNode* leaf = tower_node_get_child(tower_node_get_child(clone, i % branch_count), i % leaves_per_branch);
+      size_t* value = (size_t*)tower_component_get_userdata(tower_node_get_component_for_write(leaf, type));
+      checksum += ++*value;
+      tower_node_release_ref(clone);
+    }
+    double clone_mops = tower_benchmark_mops(start, instantiations);
+    printf("instantiate %zu node template and change one node: copy %.3f Mops/s, copy on write clone %.3f Mops/s (checksum %zu)\n",
+      1 + branch_count * (1 + leaves_per_branch), copy_mops, clone_mops, checksum);
+
+    tower_memory_free(data);
+    tower_node_thaw(root);
+    tower_node_release_ref(root);
+    tower_type_unregister(type);
+    tower_node_release_ref(type);
+  }
+
+  // Hash a large tree, then keep it hashed while changing single leaves, and compare differing trees
+  {
+    const size_t branch_count = 1000;
+    const size_t leaves_per_branch = 1000;
+    TowerNode* type = tower_node_create();
+    const auto build = [&]() {
+      TowerNode* root = tower_node_create();
+      for (size_t b = 0; b < branch_count; ++b) {
+        TowerNode* branch = tower_node_create();
+        for (size_t l = 0; l < leaves_per_branch; ++l) {
+          TowerNode* leaf = tower_node_create();
+          *(size_t*)tower_component_get_userdata(tower_component_create(leaf, type, sizeof(size_t), nullptr)) = l;
+          tower_node_attach(leaf, branch);
+          tower_node_release_ref(leaf);
+        }
+        tower_node_attach(branch, root);
+        tower_node_release_ref(branch);
+      }
+      return root;
+    };
+    TowerNode* a = build();
+    TowerNode* b = build();
+
+    auto start = std::chrono::high_resolution_clock::now();
+    uint64_t checksum = tower_node_hash(a);
+    double full_mops = tower_benchmark_mops(start, branch_count * leaves_per_branch);
+
+    const size_t changes = 100000;
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < changes; ++i) {
+      TowerNode* leaf = tower_node_get_child(tower_node_get_child(a, i % branch_count), i % leaves_per_branch);
+      ++*(size_t*)tower_component_get_userdata(tower_node_get_component_for_write(leaf, type));
+      checksum += tower_node_hash(a);
+    }
+    double change_mops = tower_benchmark_mops(start, changes);
+
+    tower_node_hash(b);
+    size_t equal_count = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < changes; ++i) {
+      equal_count += tower_node_equal(a, b);
+    }
+    double equal_mops = tower_benchmark_mops(start, changes);
+    printf("hash 1M nodes: %.2f Mnodes/s, change a leaf and hash again: %.3f Mops/s, unequal compare: %.2f Mops/s (checksum %llu, equal %zu)\n",
+      full_mops, change_mops, equal_mops, (unsigned long long)checksum, equal_count);
+
+    tower_node_release_ref(a);
+    tower_node_release_ref(b);
+    tower_node_release_ref(type);
+  }
+
+  // Intern the parse tree of a large synthetic source file, where lines are made of tokens and tokens
+  // are made of per character nodes, much like the parser produces
+  {
+    const size_t line_count = 50000;
+    TowerNode* token_type = tower_node_create();
+    TowerNode* char_type = tower_node_create();
+    const size_t initial_node_count = tower_node_get_allocated_count();
+    const size_t initial_component_count = tower_component_get_allocated_count();
+    const size_t initial_memory_count = tower_memory_get_allocated_count();
+    TowerNode* root = tower_node_create();
+    char line[64];
+    for (size_t l = 0; l < line_count; ++l) {
+      snprintf(line, sizeof(line), "let x%zu = %zu + y ;", l % 100, l % 50);
+      TowerNode* line_node = tower_node_create();
+      size_t token_kind = 0;
+      for (const char* token = line; *token;) {
+        const char* end = strchr(token, ' ');
+        if (end == nullptr) {
+          end = token + strlen(token);
+        }
+        TowerNode* token_node = tower_node_create();
+        *(size_t*)tower_component_get_userdata(tower_component_create(token_node, token_type, sizeof(size_t), nullptr)) = token_kind++;
+        for (const char* c = token; c != end; ++c) {
+          TowerNode* char_node = tower_node_create();
+          *(char*)tower_component_get_userdata(tower_component_create(char_node, char_type, sizeof(char), nullptr)) = *c;
+          tower_node_attach(char_node, token_node);
+          tower_node_release_ref(char_node);
+        }
+        tower_node_attach(token_node, line_node);
+        tower_node_release_ref(token_node);
+        token = *end ? end + 1 : end;
+      }
+      tower_node_attach(line_node, root);
+      tower_node_release_ref(line_node);
+    }
+
+    const size_t node_count = tower_node_get_allocated_count() - initial_node_count;
+    const size_t component_count = tower_component_get_allocated_count() - initial_component_count;
+    const size_t memory_count = tower_memory_get_allocated_count() - initial_memory_count;
+    TowerInterner* interner = tower_interner_create();
+    auto start = std::chrono::high_resolution_clock::now();
+    root = tower_interner_intern(interner, root);
+    double mops = tower_benchmark_mops(start, node_count);
+    printf("intern %zu line source: nodes %zu -> %zu, components %zu -> %zu, allocations %zu -> %zu, %.2f Mnodes/s\n",
+      line_count, node_count, tower_node_get_allocated_count() - initial_node_count,
+      component_count, tower_component_get_allocated_count() - initial_component_count,
+      memory_count, tower_memory_get_allocated_count() - initial_memory_count, mops);
+
+    tower_interner_destroy(interner);
+    tower_node_release_ref(char_type);
+    tower_node_release_ref(token_type);
+  }
+
+  // Walk a 1M node tree (built a level at a time, so that pre-order jumps around in memory) with naive
+  // recursion compared to cursors
+  {
+    const size_t fanout = 100;
+    TowerNode* type = tower_node_create();
+    TowerNode* root = tower_node_create();
+    *(size_t*)tower_component_get_userdata(tower_component_create(root, type, sizeof(size_t), nullptr)) = 1;
+    std::vector<TowerNode*> level = { root };
+    size_t node_count = 1;
+    for (size_t depth = 0; depth < 3; ++depth) {
+      std::vector<TowerNode*> next_level;
+      for (size_t i = 0; i < fanout; ++i) {
+        for (TowerNode* parent : level) {
+          TowerNode* child = tower_node_create();
+          *(size_t*)tower_component_get_userdata(tower_component_create(child, type, sizeof(size_t), nullptr)) = 1;
+          tower_node_attach(child, parent);
+          tower_node_release_ref(child);
+          next_level.push_back(child);
+          ++node_count;
+        }
+      }
+      level.swap(next_level);
+    }
+
+    struct Recursion {
+      static size_t sum(TowerNode* node, TowerNode* type) {
+        size_t total = *(size_t*)tower_node_get_component_userdata(node, type);
+        size_t child_count = tower_node_get_child_count(node);
+        for (size_t i = 0; i < child_count; ++i) {
+          total += sum(tower_node_get_child(node, i), type);
+        }
+        return total;
+      }
+    };
+    const size_t walks = 5;
+    size_t checksum = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t w = 0; w < walks; ++w) {
+      checksum += Recursion::sum(root, type);
+    }
+    double recursion_mops = tower_benchmark_mops(start, node_count * walks);
+
+    double cursor_mops[3];
+    const TowerCursorOrder orders[3] = { TOWER_CURSOR_PRE_ORDER, TOWER_CURSOR_POST_ORDER, TOWER_CURSOR_LEVEL_ORDER };
+    for (size_t o = 0; o < 3; ++o) {
+      TowerCursor* cursor = tower_cursor_create(root, orders[o]);
+      start = std::chrono::high_resolution_clock::now();
+      for (size_t w = 0; w < walks; ++w) {
+        tower_cursor_reset(cursor, root);
+        while (TowerNode* node = tower_cursor_next(cursor)) {
+          checksum += *(size_t*)tower_node_get_component_userdata(node, type);
+        }
+      }
+      cursor_mops[o] = tower_benchmark_mops(start, node_count * walks);
+      tower_cursor_destroy(cursor);
+    }
+    printf("walk %zu nodes: recursion %.2f Mnodes/s, cursor pre-order %.2f Mnodes/s, post-order %.2f Mnodes/s, level order %.2f Mnodes/s (checksum %zu)\n",
+      node_count, recursion_mops, cursor_mops[0], cursor_mops[1], cursor_mops[2], checksum);
+
+    tower_node_release_ref(root);
+    tower_node_release_ref(type);
+  }
+
+  // Find every node with a component of a type under a subtree, by walking it compared to querying the
+  // type's index, in a 1M node tree where 1 in 100 nodes has the component
+  {
+    const size_t fanout = 100;
+    TowerNode* type = tower_node_create();
+    tower_type_set_indexed(type, true);
+    TowerNode* root = tower_node_create();
+    std::vector<TowerNode*> level = { root };
+    size_t node_count = 1;
+    for (size_t depth = 0; depth < 3; ++depth) {
+      std::vector<TowerNode*> next_level;
+      for (TowerNode* parent : level) {
+        for (size_t i = 0; i < fanout; ++i) {
+          TowerNode* child = tower_node_create();
+          if (node_count++ % 100 == 0) {
+            tower_component_create(child, type, sizeof(size_t), nullptr);
+          }
+          tower_node_attach(child, parent);
+          tower_node_release_ref(child);
+          next_level.push_back(child);
+        }
+      }
+      level.swap(next_level);
+    }
+
+    // Query each of the 100 subtrees under the root, then the whole tree
+    const size_t rounds = 10;
+    size_t walk_matches = 0;
+    TowerCursor* cursor = tower_cursor_create(root, TOWER_CURSOR_PRE_ORDER, type);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t r = 0; r < rounds; ++r) {
+      for (size_t i = 0; i < fanout; ++i) {
+        tower_cursor_reset(cursor, tower_node_get_child(root, i));
+        while (tower_cursor_next(cursor)) {
+          ++walk_matches;
+        }
+      }
+    }
+    double walk_mops = tower_benchmark_mops(start, rounds * fanout);
+    tower_cursor_destroy(cursor);
+
+    start = std::chrono::high_resolution_clock::now();
+    size_t count = 0;
+    tower_type_get_subtree_components(type, root, &count);
+    double label_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    size_t query_matches = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t r = 0; r < rounds; ++r) {
+      for (size_t i = 0; i < fanout; ++i) {
+        tower_type_get_subtree_components(type, tower_node_get_child(root, i), &count);
+        query_matches += count;
+      }
+    }
+    double query_mops = tower_benchmark_mops(start, rounds * fanout);
+    printf("find components under 10000 node subtrees of %zu nodes: walk %.4f Mqueries/s, index %.4f Mqueries/s after labeling in %.2f ms (matches %zu, %zu)\n",
+      node_count, walk_mops, query_mops, label_ms, walk_matches, query_matches);
+
+    tower_node_release_ref(root);
+    tower_type_set_indexed(type, false);
+    tower_node_release_ref(type);
+  }
+
+  // Attach and detach a node under a parent at depth 16, without any journals, with a journal on an
+  // unrelated tree, and with a journal on the root that is drained in batches
+  {
+    const size_t depth = 16;
+    const size_t iterations = 1000000;
+    TowerNode* root = tower_node_create();
+    TowerNode* parent = root;
+    for (size_t i = 0; i < depth; ++i) {
+      TowerNode* node = tower_node_create();
+      tower_node_attach(node, parent);
+      tower_node_release_ref(node);
+      parent = node;
+    }
+    TowerNode* child = tower_node_create();
+    TowerNode* unrelated = tower_node_create();
+    std::vector<TowerJournalEntry> entries(4096);
+    size_t drained = 0;
+
+    const auto run = [&](TowerJournal* journal) {
+      auto start = std::chrono::high_resolution_clock::now();
+      for (size_t i = 0; i < iterations; ++i) {
+        tower_node_attach(child, parent);
+        tower_node_detach(child);
+        if (journal && i % 1024 == 0) {
+          drained += tower_journal_drain(journal, entries.data(), entries.size(), nullptr);
+        }
+      }
+      return tower_benchmark_mops(start, iterations);
+    };
+
+    double none_mops = run(nullptr);
+    TowerJournal* journal = tower_journal_create(unrelated);
+    double unrelated_mops = run(nullptr);
+    tower_journal_destroy(journal);
+    journal = tower_journal_create(root);
+    double journaled_mops = run(journal);
+    drained += tower_journal_drain(journal, entries.data(), entries.size(), nullptr);
+    tower_journal_destroy(journal);
+    printf("attach/detach at depth %zu: no journal %.2f Mops/s, journal elsewhere %.2f Mops/s, journaled %.2f Mops/s (drained %zu)\n",
+      depth, none_mops, unrelated_mops, journaled_mops, drained);
+
+    tower_node_release_ref(unrelated);
+    tower_node_release_ref(child);
+    tower_node_release_ref(root);
+  }
+
+  // Create and release nodes with a component on several threads at once, which all update the
+  // allocation counts and take node ids
+  {
+    const size_t thread_count = 4;
+    const size_t per_thread = 500000;
+    TowerNode* type = tower_node_create();
+    tower_node_freeze(type);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t t = 0; t < thread_count; ++t) {
+      threads.emplace_back([&]() {
+        for (size_t i = 0; i < per_thread; ++i) {
+          TowerNode* node = tower_node_create();
+          tower_component_create(node, type, sizeof(size_t), nullptr);
+          tower_node_release_ref(node);
+        }
+      });
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    double mops = tower_benchmark_mops(start, thread_count * per_thread);
+    printf("tower_node_create/release with component on %zu threads: %.2f Mops/s\n", thread_count, mops);
+    tower_node_thaw(type);
+    tower_node_release_ref(type);
+  }
+  // Allocation churn with the sampling profiler disabled, and sampling at a typical interval
+  {
+    const size_t intervals[] = { 0, 512 * 1024 };
+    double mops[2];
+    for (size_t k = 0; k < 2; ++k) {
+      tower_profiler_set_sample_interval(intervals[k]);
+      auto start = std::chrono::high_resolution_clock::now();
+      for (size_t i = 0; i < iterations; ++i) {
+        for (size_t j = 0; j < batch; ++j) {
+          allocations[j] = tower_memory_allocate(64 + (j % 4) * 16);
+        }
+        for (size_t j = 0; j < batch; ++j) {
+          tower_memory_free(allocations[j]);
+        }
+      }
+      mops[k] = tower_benchmark_mops(start, operations);
+    }
+    tower_profiler_set_sample_interval(0);
+    printf("tower_memory_allocate/free: profiler disabled %.2f Mops/s, sampling every 512KB %.2f Mops/s\n", mops[0], mops[1]);
+  }
+}
+
+// Arena memory is bump allocated from chunks, each chunk starts with a link to the previous chunk
+// Allocations larger than a quarter of a chunk get their own dedicated chunk
+const size_t TOWER_ARENA_CHUNK_BYTES = 64 * 1024;
+const size_t TOWER_ARENA_ALIGNMENT = sizeof(size_t) * 2;
+
+struct TowerArenaChunk {
+  TowerArenaChunk* previous = nullptr;
+  bool dedicated = false;
+};
+
+struct TowerArena {
+  TowerArenaChunk* chunks = nullptr;
+  // Chunks kept by tower_arena_reset, which are used before allocating new ones
+  TowerArenaChunk* free_chunks = nullptr;
+  uint8_t* cursor = nullptr;
+  uint8_t* end = nullptr;
+
+  // How many nodes and components created within the arena are still alive
+  size_t node_count = 0;
+  size_t component_count = 0;
+
+  // Set while the arena is being torn down so that releasing references does not destroy nodes one by one
+  bool destroying = false;
+};
+
+void* tower_arena_allocate(TowerArena* arena, size_t size) {
+  size = (size + TOWER_ARENA_ALIGNMENT - 1) & ~(TOWER_ARENA_ALIGNMENT - 1);
+  if ((size_t)(arena->end - arena->cursor) < size) {
+    const size_t header_bytes = (sizeof(TowerArenaChunk) + TOWER_ARENA_ALIGNMENT - 1) & ~(TOWER_ARENA_ALIGNMENT - 1);
+    const bool dedicated = size > TOWER_ARENA_CHUNK_BYTES / 4;
+    const size_t chunk_bytes = dedicated ? header_bytes + size : TOWER_ARENA_CHUNK_BYTES;
+    TowerArenaChunk* chunk = dedicated ? nullptr : arena->free_chunks;
+    if (chunk) {
+      arena->free_chunks = chunk->previous;
+    } else {
+      chunk = new (tower_memory_allocate_tagged(chunk_bytes, TOWER_MEMORY_CATEGORY_ARENAS)) TowerArenaChunk();
+      chunk->dedicated = dedicated;
+    }
+    chunk->previous = arena->chunks;
+    arena->chunks = chunk;
+    uint8_t* memory = (uint8_t*)chunk + header_bytes;
+
+    // A dedicated chunk leaves the current chunk's remaining space to be used
+    if (dedicated) {
+      return memory;
+    }
+    arena->cursor = memory;
+    arena->end = (uint8_t*)chunk + chunk_bytes;
+  }
+
+  void* result = arena->cursor;
+  arena->cursor += size;
+  return result;
+}
+
+// Memory for nodes and everything they own either comes from their arena or the tower allocator
+void* tower_node_memory_allocate(TowerArena* arena, size_t size, TowerMemoryCategory category = TOWER_MEMORY_CATEGORY_NODES) {
+  return arena ? tower_arena_allocate(arena, size) : tower_memory_allocate_tagged(size, category);
+}
+
+void tower_node_memory_free(TowerArena* arena, void* memory) {
+  // Arena memory is only ever released all at once
+  if (!arena) {
+    tower_memory_free(memory);
+  }
+}
+
+// Lets std containers owned by a node allocate from the node's arena
+template <typename T>
+struct TowerArenaAllocator {
+  typedef T value_type;
+  TowerArena* arena = nullptr;
+
+  TowerArenaAllocator(TowerArena* arena) : arena(arena) {}
+
+  template <typename U>
+  TowerArenaAllocator(const TowerArenaAllocator<U>& other) : arena(other.arena) {}
+
+  T* allocate(size_t count) {
+    return (T*)tower_node_memory_allocate(arena, count * sizeof(T));
+  }
+
+  void deallocate(T* memory, size_t) {
+    tower_node_memory_free(arena, memory);
+  }
+
+  template <typename U>
+  bool operator==(const TowerArenaAllocator<U>& other) const {
+    return arena == other.arena;
+  }
+};
+
+template <typename T>
+using TowerArenaVector = std::vector<T, TowerArenaAllocator<T>>;
+
+// Once a node has this many named children, members are found through a hash table instead of a scan
+const size_t TOWER_MEMBER_INDEX_THRESHOLD = 16;
+
+struct TowerMemberIndexEntry {
+  // TOWER_ATOM_NONE marks an empty entry
+  TowerAtom member = TOWER_ATOM_NONE;
+  size_t slot = TOWER_INVALID_INDEX;
+};
+
+// An open addressing (linear probing) table that maps member atoms to slots within the children
+// The entries directly follow the index within the same allocation
+struct TowerMemberIndex {
+  // Always a power of two, and kept at most half full
+  size_t capacity = 0;
+  size_t count = 0;
+
+  TowerMemberIndexEntry* entries() {
+    return (TowerMemberIndexEntry*)(this + 1);
+  }
+};
+
+struct TowerShapeEntry {
+  // Null marks an empty entry
+  TowerNode* /*weak*/ type = nullptr;
+  size_t slot = TOWER_INVALID_INDEX;
+  // Whether the type's shape key holds the shape, which is never the case for types within arenas
+  // (whose memory may be gone by the time the shape is freed)
+  bool keyed = false;
+};
+
+// Nodes that have the same component types (added in the same order) share a shape, akin to hidden classes
+// The shape maps each type to the slot of the component in the node, so that finding a component never
+// has to look at the components themselves. Shapes are immutable once created (other than transitions),
+// and live until one of their types is destroyed, at which point no node can have the shape anymore
+// Shapes of types within arenas live for the lifetime of the program. Types are only used as keys
+struct TowerShape {
+  size_t component_count = 0;
+
+  // An open addressing (linear probing) table from type to slot, always a power of two and at most half full
+  size_t capacity = 0;
+  TowerShapeEntry* entries = nullptr;
+
+  // The shape this was reached from by adding the type, or null for the empty shape
+  TowerShape* parent = nullptr;
+  TowerNode* /*weak*/ added_type = nullptr;
+
+  // The shapes reached by adding one more component type to this shape, guarded by tower_shape_mutex
+  // Created on first use so that shapes remain constant initialized
+  std::unordered_map<TowerNode*, TowerShape*>* transitions = nullptr;
+};
+
+// Every shape that contains a type, so that they can be freed when the type is destroyed
+struct TowerShapeKey {
+  std::unordered_set<TowerShape*> shapes;
+};
+
+// Every node starts out with the empty shape
+TowerShape tower_shape_empty;
+std::mutex tower_shape_mutex;
+
+// Incremented whenever shapes are freed, which invalidates every thread's transition cache
+std::atomic<uint64_t> tower_shape_epoch = 0;
+
+// The transitions each thread has taken recently, so that adding a component doesn't need the mutex
+// A transition found here is always still valid while the type is alive, since only destroying
+// one of the types within a shape frees it (and that changes the epoch before the memory can be reused)
+struct TowerShapeCacheEntry {
+  TowerShape* shape;
+  TowerNode* type;
+  TowerShape* next;
+};
+
+struct TowerShapeCache {
+  static const size_t capacity = 256;
+  uint64_t epoch = 0;
+  TowerShapeCacheEntry entries[capacity] = {};
+};
+thread_local TowerShapeCache tower_shape_cache;
+
+// Nodes have room for this many component pointers before they need to allocate an array
+const size_t TOWER_NODE_INLINE_COMPONENT_SLOTS = 2;
+
+// Components stored inline within a node keep the same alignment as tower_memory_allocate
+const size_t TOWER_COMPONENT_ALIGNMENT = sizeof(size_t) * 2;
+
+inline size_t tower_align(size_t bytes, size_t alignment) {
+  return (bytes + alignment - 1) & ~(alignment - 1);
+}
+
+enum TowerNodeFlags : uint32_t {
+  // An arena node that was destroyed individually (it's memory remains until the arena is destroyed)
+  TOWER_NODE_FLAG_DESTROYED = 1 << 0,
+  // An arena node that has been recorded as holding children from outside of it's arena
+  TOWER_NODE_FLAG_ARENA_IMPORTS = 1 << 1,
+  // The reference count is shared between threads and is updated atomically (see tower_node_set_atomic_ref_count)
+  TOWER_NODE_FLAG_ATOMIC_REF_COUNT = 1 << 2,
+  // The node is part of a frozen subtree, and can't be modified or have it's reference count changed
+  TOWER_NODE_FLAG_FROZEN = 1 << 3,
+  // A clone whose children are still only those of it's source (see tower_node_materialize_children)
+  TOWER_NODE_FLAG_COW_CHILDREN = 1 << 4,
+  // A frozen canonical node from an interner, which can be a child of any number of parents (each holding
+  // a reference to it) without pointing back to them (see tower_interner_intern)
+  TOWER_NODE_FLAG_SHARED = 1 << 5,
+  // The root of the subtree of at least one journal (see tower_journal_create)
+  TOWER_NODE_FLAG_JOURNALED = 1 << 6,
+  // The node is within the subtree of at least one journal, so changes to it have to be recorded
+  // (see tower_node_mark_journaled)
+  TOWER_NODE_FLAG_JOURNAL_SUBTREE = 1 << 7,
+};
+
+// Memory use of one category or type, which is updated from any thread without a lock
+struct TowerMemoryCounters {
+  std::atomic<size_t> bytes = 0;
+  std::atomic<size_t> count = 0;
+  std::atomic<size_t> peak_bytes = 0;
+};
+
+// Add to (or subtract from) the counters, where the unsigned counters wrap around for negative changes
+inline void tower_memory_counters_change(TowerMemoryCounters& counters, ptrdiff_t bytes, ptrdiff_t count) {
+  counters.count.fetch_add((size_t)count, std::memory_order_relaxed);
+  const size_t in_use = counters.bytes.fetch_add((size_t)bytes, std::memory_order_relaxed) + (size_t)bytes;
+  // The peak rarely changes, so it's only written when it does
+  size_t peak = counters.peak_bytes.load(std::memory_order_relaxed);
+  while (bytes > 0 && in_use > peak && !counters.peak_bytes.compare_exchange_weak(peak, in_use, std::memory_order_relaxed)) {
+  }
+}
+
+inline TowerMemoryStats tower_memory_counters_load(const TowerMemoryCounters& counters) {
+  return {
+    counters.bytes.load(std::memory_order_relaxed),
+    counters.count.load(std::memory_order_relaxed),
+    counters.peak_bytes.load(std::memory_order_relaxed),
+  };
+}
+
+// The memory of every live component of a type outside of arenas, linked together so that all types can be dumped
+struct TowerTypeMemory {
+  TowerMemoryCounters counters;
+  TowerNode* type = nullptr;
+  TowerTypeMemory* previous = nullptr;
+  TowerTypeMemory* next = nullptr;
+};
+
+// Every live component of an indexed type in no particular order, until subtree queries sort them by
+// the labels of their owners (see tower_type_get_subtree_components)
+struct TowerComponentIndex {
+  std::mutex mutex;
+  std::vector<TowerComponent*> components;
+  // The labeling the components were last sorted for, or 0 if they have changed since
+  uint64_t sorted_epoch = 0;
+};
+
+// What only nodes that are component types need, created the first time any of it is (see tower_type_get_extra)
+struct TowerTypeExtra {
+  // The dense array of live components when the type is indexed (see tower_type_set_indexed)
+  TowerComponentIndex* component_index = nullptr;
+  // Created the first time a component of the type is allocated (see tower_type_get_memory_stats)
+  TowerTypeMemory* type_memory = nullptr;
+  // Created the first time a shape with the type is created
+  TowerShapeKey* shape_key = nullptr;
+};
+
+// What few nodes need, created the first time any of it is (see tower_node_get_extra)
+struct TowerNodeExtra {
+  // The frozen node this was cloned from, which owns any components that are still shared (see tower_node_clone_cow)
+  TowerNode* cow_source = nullptr;
+  // The pre-order labels of the node and the last node within it's subtree, which are globally unique
+  // and only valid while label_exit isn't 0 (see tower_node_label)
+  uint64_t label_enter = 0;
+  uint64_t label_exit = 0;
+};
+
+struct TowerNode {
+  // What visiting a node reads (the flags, shape, components and children) comes first, so that
+  // walks only need the first two cache lines of each node (see tower_cursor_prefetch_node)
+  uint32_t flags = 0;
+  // The slot in the handle table, or 0 if the node has never been given a handle (see tower_node_get_handle)
+  uint32_t handle_index = 0;
+  TowerShape* shape = &tower_shape_empty;
+  // Pointers to the components in the order they were added (the slots of the shape)
+  // This points at inline_component_slots until the node has more components than fit there
+  TowerComponent** components = inline_component_slots;
+  TowerComponent* inline_component_slots[TOWER_NODE_INLINE_COMPONENT_SLOTS] = {};
+  // The structural hash of the subtree, or 0 until it's computed (see tower_node_load_hash)
+  uint64_t hash = 0;
+  TowerNode* /*weak*/ parent = nullptr;
+  // How many of the children are tombstones
+  uint32_t child_tombstone_count = 0;
+  // How many of the children have a member name, and the index of them once there are many
+  uint32_t named_child_count = 0;
+
+  // A child of null is a tombstone left behind by detaching (see tower_node_compact_children)
+  // Member names are kept apart so that the children can be handed out directly (see tower_node_get_children)
+  TowerArenaVector<TowerNode* /*strong*/> children;
+  // The member name of each child, which stays empty until a child is attached with a name
+  TowerArenaVector<TowerAtom> child_members;
+  TowerMemberIndex* member_index = nullptr;
+
+  size_t id = TOWER_INVALID_INDEX;
+  size_t reference_count = 1;
+  // Created the first time a weak reference to the node is created (see tower_node_create_weak)
+  TowerWeak* weak = nullptr;
+  TowerTypeExtra* type_extra = nullptr;
+  TowerNodeExtra* extra = nullptr;
+  TowerArena* arena = nullptr;
+  // Where this node lives within the parent's children (including tombstones)
+  size_t parent_slot = TOWER_INVALID_INDEX;
+
+  uint32_t component_capacity = TOWER_NODE_INLINE_COMPONENT_SLOTS;
+  // Bytes reserved directly after the node (see tower_node_get_inline_components) for storing components
+  uint32_t inline_component_bytes = 0;
+  uint32_t inline_component_used = 0;
+
+  TowerNode(TowerArena* arena) :
+    children(TowerArenaAllocator<TowerNode*>(arena)),
+    child_members(TowerArenaAllocator<TowerAtom>(arena)),
+    arena(arena) {
+  }
+};
+
+// Types are commonly frozen and shared between threads, so this may be created by another thread
+inline TowerTypeExtra* tower_type_find_extra(TowerNode* type) {
+  return std::atomic_ref<TowerTypeExtra*>(type->type_extra).load(std::memory_order_acquire);
+}
+
+TowerTypeExtra* tower_type_get_extra(TowerNode* type) {
+  // Arenas free their nodes without destroying them, which would leak it
+  assert(type->arena == nullptr);
+  TowerTypeExtra* extra = tower_type_find_extra(type);
+  if (extra) {
+    return extra;
+  }
+  // Like the type memory, these aren't counted as tower allocations
+  TowerTypeExtra* created = new TowerTypeExtra();
+  if (!std::atomic_ref<TowerTypeExtra*>(type->type_extra).compare_exchange_strong(extra, created, std::memory_order_acq_rel)) {
+    delete created;
+    return extra;
+  }
+  return created;
+}
+
+inline TowerComponentIndex* tower_type_find_index(TowerNode* type) {
+  TowerTypeExtra* extra = tower_type_find_extra(type);
+  return extra ? extra->component_index : nullptr;
+}
+
+TowerNodeExtra* tower_node_get_extra(TowerNode* node) {
+  if (!node->extra) {
+    node->extra = new (tower_node_memory_allocate(node->arena, sizeof(TowerNodeExtra))) TowerNodeExtra();
+  }
+  return node->extra;
+}
+
+inline TowerNode* tower_node_get_cow_source(const TowerNode* node) {
+  return node->extra ? node->extra->cow_source : nullptr;
+}
+
+inline uint64_t tower_node_get_label_enter(const TowerNode* node) {
+  return node->extra ? node->extra->label_enter : 0;
+}
+
+inline uint64_t tower_node_get_label_exit(const TowerNode* node) {
+  return node->extra ? node->extra->label_exit : 0;
+}
+
+// Frozen nodes compute their hash the first time it's read, which may be from many threads at once (they
+// all store the same value), and a valid hash always has valid hashes below it
+inline uint64_t tower_node_load_hash(TowerNode* node) {
+  return std::atomic_ref<uint64_t>(node->hash).load(std::memory_order_relaxed);
+}
+
+inline void tower_node_store_hash(TowerNode* node, uint64_t hash) {
+  std::atomic_ref<uint64_t>(node->hash).store(hash, std::memory_order_relaxed);
+}
+
+const uint32_t TOWER_COMPONENT_NOT_INDEXED = UINT32_MAX;
+
+// The header stays aligned so that the userdata directly after it is aligned as well
+struct alignas(TOWER_COMPONENT_ALIGNMENT) TowerComponent {
+  TowerComponentDestructor destructor = nullptr;
+  TowerNode* type = nullptr;
+  TowerNode* owner = nullptr;
+  uint32_t data_bytes = 0;
+  // Where the component is within the dense array of it's type (see TowerComponentIndex)
+  uint32_t index_slot = TOWER_COMPONENT_NOT_INDEXED;
+};
+
+// Get the userdata without treating it as written to (see tower_component_get_userdata)
+inline void* tower_component_userdata(TowerComponent* component) {
+  return component ? ((uint8_t*)component) + sizeof(TowerComponent) : nullptr;
+}
+
+void tower_component_index_add(TowerComponentIndex* index, TowerComponent* component) {
+  std::lock_guard<std::mutex> lock(index->mutex);
+  component->index_slot = (uint32_t)index->components.size();
+  index->components.push_back(component);
+  index->sorted_epoch = 0;
+}
+
+// Components may be destroyed by the reclaimer thread, so they are removed under the lock
+void tower_component_index_remove(TowerComponentIndex* index, TowerComponent* component) {
+  std::lock_guard<std::mutex> lock(index->mutex);
+  TowerComponent* last = index->components.back();
+  index->components[component->index_slot] = last;
+  last->index_slot = component->index_slot;
+  index->components.pop_back();
+  component->index_slot = TOWER_COMPONENT_NOT_INDEXED;
+  index->sorted_epoch = 0;
+}
+
+// The bytes a component takes up within it's node or allocation, including the component itself
+inline size_t tower_component_get_total_bytes(size_t data_bytes) {
+  return tower_align(sizeof(TowerComponent) + data_bytes, TOWER_COMPONENT_ALIGNMENT);
+}
+
+// The start of the bytes reserved for components directly after the node
+inline uint8_t* tower_node_get_inline_components(TowerNode* node) {
+  return (uint8_t*)node + tower_align(sizeof(TowerNode), TOWER_COMPONENT_ALIGNMENT);
+}
+
+inline bool tower_node_is_component_inline(TowerNode* node, TowerComponent* component) {
+  uint8_t* inline_components = tower_node_get_inline_components(node);
+  return (uint8_t*)component >= inline_components && (uint8_t*)component < inline_components + node->inline_component_bytes;
+}
+
+// Everything the arena must visit when it's destroyed, allocated within the arena itself
+struct TowerArenaRecords {
+  // Components with destructors (the destructor is cleared once it has run)
+  TowerArenaVector<TowerComponent*> destructible_components;
+  // Arena nodes that hold children from outside of the arena
+  TowerArenaVector<TowerNode*> importing_parents;
+  // The arena holds one reference to each component type used within it
+  TowerArenaVector<TowerNode*> types;
+  // The type most recently added to types, since components of the same type tend to be created together
+  TowerNode* last_type = nullptr;
+  // Arena nodes that were given a handle, which must be invalidated when the arena is destroyed
+  TowerArenaVector<TowerNode*> handle_nodes;
+  // Arena nodes that have weak references, which must be invalidated when the arena is destroyed
+  TowerArenaVector<TowerNode*> weak_nodes;
+  // Arena nodes that were cloned, whose reference to their source must be released when the arena is destroyed
+  TowerArenaVector<TowerNode*> clone_nodes;
+  // Components of indexed types, which must be removed from their index when the arena is destroyed
+  TowerArenaVector<TowerComponent*> indexed_components;
+
+  TowerArenaRecords(TowerArena* arena) :
+    destructible_components(TowerArenaAllocator<TowerComponent*>(arena)),
+    importing_parents(TowerArenaAllocator<TowerNode*>(arena)),
+    types(TowerArenaAllocator<TowerNode*>(arena)),
+    handle_nodes(TowerArenaAllocator<TowerNode*>(arena)),
+    weak_nodes(TowerArenaAllocator<TowerNode*>(arena)),
+    clone_nodes(TowerArenaAllocator<TowerNode*>(arena)),
+    indexed_components(TowerArenaAllocator<TowerComponent*>(arena)) {
+  }
+};
+
+TowerArenaRecords* tower_arena_get_records(TowerArena* arena) {
+  return (TowerArenaRecords*)(arena + 1);
+}
+
+// Counters that every thread changes constantly are split into a shard per thread, so that threads never
+// write to the same cache line, and reading a counter adds up every shard
+enum TowerCounter {
+  TOWER_COUNTER_MEMORY,
+  TOWER_COUNTER_NODES,
+  TOWER_COUNTER_COMPONENTS,
+  TOWER_COUNTER_COUNT,
+};
+
+// Each thread reserves node ids from the shared counter this many at a time
+const size_t TOWER_NODE_ID_BLOCK = 1024;
+
+// This is trivially destructible so that it remains usable until the thread has fully exited
+struct TowerCounterShard {
+  // Only ever written by the owning thread, and atomic only so that other threads can read them
+  // Frees on another thread than the allocation make a shard negative, which wraps around
+  std::atomic<size_t> counts[TOWER_COUNTER_COUNT] = {};
+  // The ids left in the block the thread reserved
+  size_t next_id = 0;
+  size_t end_id = 0;
+  TowerCounterShard* previous = nullptr;
+  TowerCounterShard* next = nullptr;
+  bool registered = false;
+  // Once the thread is exiting, counts are added straight to the retired totals
+  bool retired = false;
+};
+thread_local TowerCounterShard tower_counter_shard;
+
+// Shared between all threads, where the shards are guarded by the mutex
+// Note: Everything here must be constant initialized, since nodes are created during static initialization
+struct TowerCounterShards {
+  std::mutex mutex;
+  TowerCounterShard* head = nullptr;
+  // The totals of every shard whose thread has exited
+  std::atomic<size_t> retired[TOWER_COUNTER_COUNT] = {};
+};
+TowerCounterShards tower_counter_shards;
+std::atomic<size_t> tower_node_id_next = 0;
+
+// Fold a thread's shard into the retired totals when the thread exits
+struct TowerCounterShardRetirer {
+  ~TowerCounterShardRetirer() {
+    TowerCounterShard& shard = tower_counter_shard;
+    std::lock_guard<std::mutex> lock(tower_counter_shards.mutex);
+    for (size_t i = 0; i < TOWER_COUNTER_COUNT; ++i) {
+      tower_counter_shards.retired[i].fetch_add(shard.counts[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    if (shard.previous) {
+      shard.previous->next = shard.next;
+    } else {
+      tower_counter_shards.head = shard.next;
+    }
+    if (shard.next) {
+      shard.next->previous = shard.previous;
+    }
+    shard.registered = false;
+    shard.retired = true;
+  }
+};
+thread_local TowerCounterShardRetirer tower_counter_shard_retirer;
+
+void tower_counter_shard_register(TowerCounterShard& shard) {
+  // Touching the retirer ensures it is constructed (and later destructed) for this thread
+  (void)&tower_counter_shard_retirer;
+  std::lock_guard<std::mutex> lock(tower_counter_shards.mutex);
+  shard.next = tower_counter_shards.head;
+  if (shard.next) {
+    shard.next->previous = &shard;
+  }
+  tower_counter_shards.head = &shard;
+  shard.registered = true;
+}
+
+inline void tower_counter_add(TowerCounter counter, size_t amount) {
+  TowerCounterShard& shard = tower_counter_shard;
+  if (!shard.registered) {
+    if (shard.retired) {
+      tower_counter_shards.retired[counter].fetch_add(amount, std::memory_order_relaxed);
+      return;
+    }
+    tower_counter_shard_register(shard);
+  }
+  // No other thread writes to the shard, so this doesn't need to be an atomic increment
+  std::atomic<size_t>& count = shard.counts[counter];
+  count.store(count.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+inline void tower_counter_subtract(TowerCounter counter, size_t amount) {
+  tower_counter_add(counter, (size_t)0 - amount);
+}
+
+size_t tower_counter_read(TowerCounter counter) {
+  std::lock_guard<std::mutex> lock(tower_counter_shards.mutex);
+  size_t total = tower_counter_shards.retired[counter].load(std::memory_order_relaxed);
+  for (TowerCounterShard* shard = tower_counter_shards.head; shard; shard = shard->next) {
+    total += shard->counts[counter].load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+// Ids are unique, and increase within each thread, but threads hand them out from different blocks
+inline size_t tower_node_next_id() {
+  TowerCounterShard& shard = tower_counter_shard;
+  if (shard.next_id == shard.end_id) {
+    shard.next_id = tower_node_id_next.fetch_add(TOWER_NODE_ID_BLOCK, std::memory_order_relaxed);
+    shard.end_id = shard.next_id + TOWER_NODE_ID_BLOCK;
+  }
+  return shard.next_id++;
+}
+
+// This will truncate to 4 bytes on 32 bit systems
+const size_t TOWER_MEMORY_GUARD = (size_t)0xDEADBEEFDEADBEEF;
+
+// Every allocation is preceded by a header of two words: the size, and a tag byte (the category, and
+// whether the profiler sampled it) which shares it's word with a guard (only checked in debug)
+// Keeping the header the same size in all builds keeps the alignment of returned memory identical
+const size_t TOWER_MEMORY_HEADER_WORDS = 2;
+const size_t TOWER_MEMORY_TAG_MASK = 0xFF;
+const size_t TOWER_MEMORY_CATEGORY_MASK = 0x3F;
+const size_t TOWER_MEMORY_TAG_SAMPLED = 0x40;
+const size_t TOWER_MEMORY_MAX_CATEGORIES = TOWER_MEMORY_CATEGORY_MASK + 1;
+
+// Categories are never removed, and a category's name is published before the count that includes it
+// Note: Everything here must be constant initialized, since nodes are created during static initialization
+TowerMemoryCounters tower_memory_categories[TOWER_MEMORY_MAX_CATEGORIES];
+const char* tower_memory_category_names[TOWER_MEMORY_MAX_CATEGORIES] = { "general", "nodes", "components", "arenas" };
+std::atomic<uint32_t> tower_memory_category_count = 4;
+std::mutex tower_memory_category_mutex;
+#ifdef NDEBUG
+const size_t TOWER_MEMORY_FOOTER_WORDS = 0;
+#else
+const size_t TOWER_MEMORY_FOOTER_WORDS = 1;
+#endif
+
+// Small blocks (headers included) are rounded up into size classes and carved out of large slabs
+// Anything bigger than the largest size class goes straight to malloc
+const size_t TOWER_MEMORY_SLAB_GRANULARITY = 16;
+const size_t TOWER_MEMORY_SLAB_MAX_BLOCK_BYTES = 512;
+const size_t TOWER_MEMORY_SLAB_CLASS_COUNT = TOWER_MEMORY_SLAB_MAX_BLOCK_BYTES / TOWER_MEMORY_SLAB_GRANULARITY;
+const size_t TOWER_MEMORY_SLAB_BYTES = 64 * 1024;
+
+// Each thread caches free blocks per size class so that the common path never takes a lock
+// When a thread holds too many free blocks of a class, a batch is handed back to the shared pool
+const size_t TOWER_MEMORY_CACHE_LIMIT = 512;
+const size_t TOWER_MEMORY_CACHE_BATCH = 128;
+
+struct TowerMemoryFreeBlock {
+  TowerMemoryFreeBlock* next;
+};
+
+struct TowerMemoryFreeList {
+  TowerMemoryFreeBlock* head = nullptr;
+  size_t count = 0;
+};
+
+// Shared between all threads and guarded by the mutex
+// Note: Everything here must be constant initialized, since nodes are created during static initialization
+struct TowerMemoryPool {
+  std::mutex mutex;
+  TowerMemoryFreeList free_lists[TOWER_MEMORY_SLAB_CLASS_COUNT];
+
+  // The unused remainder of the slab currently being carved for each size class
+  // Slabs are never returned to the system, their blocks are recycled through the free lists
+  uint8_t* slab_cursors[TOWER_MEMORY_SLAB_CLASS_COUNT] = {};
+  uint8_t* slab_ends[TOWER_MEMORY_SLAB_CLASS_COUNT] = {};
+};
+TowerMemoryPool tower_memory_pool;
+
+// Each thread keeps the changes to a category's memory to itself until they add up to this many bytes
+// either way, so shared counters (and peaks) are only behind by less than this per thread
+const ptrdiff_t TOWER_MEMORY_CATEGORY_FLUSH_BYTES = 64 * 1024;
+
+// This is trivially destructible so that it remains usable until the thread has fully exited
+struct TowerMemoryCache {
+  TowerMemoryFreeList free_lists[TOWER_MEMORY_SLAB_CLASS_COUNT];
+  // Changes to the memory of each category that haven't been added to the shared counters yet
+  ptrdiff_t category_bytes[TOWER_MEMORY_MAX_CATEGORIES] = {};
+  ptrdiff_t category_counts[TOWER_MEMORY_MAX_CATEGORIES] = {};
+  // Set once the thread has a flusher that will add it's changes when it exits
+  bool flusher_created = false;
+  // Counts down the bytes allocated until the next sample is taken for the profiler
+  ptrdiff_t bytes_until_sample = 0;
+  // The state of the random number generator that spaces out samples, which is seeded on first use
+  uint64_t sample_random = 0;
+  // Whether the countdown is until a sample, rather than until checking if the profiler has been enabled
+  bool sample_armed = false;
+  // Once the thread is exiting, blocks are freed directly to the shared pool
+  bool flushed = false;
+};
+thread_local TowerMemoryCache tower_memory_cache;
+
+void tower_memory_category_flush(TowerMemoryCache& cache, TowerMemoryCategory category) {
+  tower_memory_counters_change(tower_memory_categories[category], cache.category_bytes[category], cache.category_counts[category]);
+  cache.category_bytes[category] = 0;
+  cache.category_counts[category] = 0;
+}
+
+// Add all of the calling thread's changes to the shared counters, so that it sees it's own allocations
+void tower_memory_categories_flush() {
+  TowerMemoryCache& cache = tower_memory_cache;
+  const size_t count = tower_memory_category_count.load(std::memory_order_acquire);
+  for (size_t i = 0; i < count; ++i) {
+    if (cache.category_counts[i] != 0 || cache.category_bytes[i] != 0) {
+      tower_memory_category_flush(cache, (TowerMemoryCategory)i);
+    }
+  }
+}
+
+// Move up to count blocks from one free list to another
+void tower_memory_free_list_move(TowerMemoryFreeList& from, TowerMemoryFreeList& to, size_t count) {
+  while (count != 0 && from.head) {
+    TowerMemoryFreeBlock* block = from.head;
+    from.head = block->next;
+    --from.count;
+    block->next = to.head;
+    to.head = block;
+    ++to.count;
+    --count;
+  }
+}
+
+// Return all of a thread's cached blocks to the shared pool when the thread exits
+struct TowerMemoryCacheFlusher {
+  ~TowerMemoryCacheFlusher() {
+    tower_memory_categories_flush();
+    std::lock_guard<std::mutex> lock(tower_memory_pool.mutex);
+    for (size_t i = 0; i < TOWER_MEMORY_SLAB_CLASS_COUNT; ++i) {
+      TowerMemoryFreeList& list = tower_memory_cache.free_lists[i];
+      tower_memory_free_list_move(list, tower_memory_pool.free_lists[i], list.count);
+    }
+    tower_memory_cache.flushed = true;
+  }
+};
+thread_local TowerMemoryCacheFlusher tower_memory_cache_flusher;
+
+inline void tower_memory_category_change(TowerMemoryCategory category, ptrdiff_t bytes, ptrdiff_t count) {
+  TowerMemoryCache& cache = tower_memory_cache;
+  // Threads that only free memory never refill, which is otherwise where the flusher is created
+  if (!cache.flusher_created) {
+    (void)&tower_memory_cache_flusher;
+    cache.flusher_created = true;
+  }
+  cache.category_bytes[category] += bytes;
+  cache.category_counts[category] += count;
+  const ptrdiff_t pending = cache.category_bytes[category];
+  if (pending >= TOWER_MEMORY_CATEGORY_FLUSH_BYTES || pending <= -TOWER_MEMORY_CATEGORY_FLUSH_BYTES || cache.flushed) {
+    tower_memory_category_flush(cache, category);
+  }
+}
+
+// Refill a thread's free list with a batch of blocks, either recycled or carved from a slab
+void tower_memory_cache_refill(TowerMemoryFreeList& list, size_t class_index) {
+  // Touching the flusher ensures it is constructed (and later destructed) for this thread
+  (void)&tower_memory_cache_flusher;
+
+  std::lock_guard<std::mutex> lock(tower_memory_pool.mutex);
+  tower_memory_free_list_move(tower_memory_pool.free_lists[class_index], list, TOWER_MEMORY_CACHE_BATCH);
+  if (list.head) {
+    return;
+  }
+
+  const size_t block_bytes = (class_index + 1) * TOWER_MEMORY_SLAB_GRANULARITY;
+  uint8_t*& cursor = tower_memory_pool.slab_cursors[class_index];
+  uint8_t*& end = tower_memory_pool.slab_ends[class_index];
+  for (size_t i = 0; i < TOWER_MEMORY_CACHE_BATCH; ++i) {
+    if (cursor == nullptr || (size_t)(end - cursor) < block_bytes) {
+      cursor = (uint8_t*)malloc(TOWER_MEMORY_SLAB_BYTES);
+      if (cursor == nullptr) {
+        end = nullptr;
+        return;
+      }
+      end = cursor + TOWER_MEMORY_SLAB_BYTES;
+    }
+
+    TowerMemoryFreeBlock* block = (TowerMemoryFreeBlock*)cursor;
+    cursor += block_bytes;
+    block->next = list.head;
+    list.head = block;
+    ++list.count;
+  }
+}
+
+void* tower_memory_block_allocate(size_t block_bytes) {
+  if (block_bytes > TOWER_MEMORY_SLAB_MAX_BLOCK_BYTES) {
+    return malloc(block_bytes);
+  }
+
+  const size_t class_index = (block_bytes - 1) / TOWER_MEMORY_SLAB_GRANULARITY;
+  TowerMemoryFreeList& list = tower_memory_cache.free_lists[class_index];
+  if (list.head == nullptr) {
+    tower_memory_cache_refill(list, class_index);
+    if (list.head == nullptr) {
+      return nullptr;
+    }
+  }
+
+  TowerMemoryFreeBlock* block = list.head;
+  list.head = block->next;
+  --list.count;
+  return block;
+}
+
+void tower_memory_block_free(void* memory, size_t block_bytes) {
+  if (block_bytes > TOWER_MEMORY_SLAB_MAX_BLOCK_BYTES) {
+    free(memory);
+    return;
+  }
+
+  const size_t class_index = (block_bytes - 1) / TOWER_MEMORY_SLAB_GRANULARITY;
+  TowerMemoryFreeBlock* block = (TowerMemoryFreeBlock*)memory;
+
+  if (tower_memory_cache.flushed) {
+    std::lock_guard<std::mutex> lock(tower_memory_pool.mutex);
+    TowerMemoryFreeList& pool_list = tower_memory_pool.free_lists[class_index];
+    block->next = pool_list.head;
+    pool_list.head = block;
+    ++pool_list.count;
+    return;
+  }
+
+  TowerMemoryFreeList& list = tower_memory_cache.free_lists[class_index];
+  block->next = list.head;
+  list.head = block;
+  ++list.count;
+
+  if (list.count > TOWER_MEMORY_CACHE_LIMIT) {
+    std::lock_guard<std::mutex> lock(tower_memory_pool.mutex);
+    tower_memory_free_list_move(list, tower_memory_pool.free_lists[class_index], TOWER_MEMORY_CACHE_BATCH);
+  }
+}
+
+// The profiler samples allocations on a Poisson schedule, where every byte allocated has the same chance of
+// being sampled. A sample records the stack that made the allocation and stands in for all the bytes
+// allocated by the same stack that weren't sampled (see tower_profiler_set_sample_interval)
+const size_t TOWER_PROFILER_MAX_FRAMES = 32;
+// While the profiler is disabled, threads only check whether it has been enabled after this many bytes
+const ptrdiff_t TOWER_PROFILER_DISABLED_CHECK_BYTES = 1024 * 1024;
+// A caller's frame is never further away than this, otherwise the frame chain is considered broken
+const uintptr_t TOWER_PROFILER_MAX_FRAME_BYTES = 1024 * 1024;
+
+// A stack starts with how many scope names it has, then the names outermost first, and then the
+// return addresses innermost first
+typedef std::vector<uintptr_t> TowerProfilerStack;
+
+struct TowerProfilerStackHash {
+  size_t operator()(const TowerProfilerStack& stack) const {
+    size_t hash = stack.size();
+    for (uintptr_t value : stack) {
+      hash = hash * 31 + std::hash<uintptr_t>()(value);
+    }
+    return hash;
+  }
+};
+
+// Estimated totals of every allocation made by a stack, and of those that are still live
+struct TowerProfilerSite {
+  size_t total_bytes = 0;
+  size_t total_count = 0;
+  size_t live_bytes = 0;
+  size_t live_count = 0;
+};
+
+struct TowerProfilerSample {
+  TowerProfilerSite* site;
+  size_t bytes;
+  size_t count;
+};
+
+// The profiler's own memory comes from malloc, so that it never samples itself
+struct TowerProfiler {
+  std::mutex mutex;
+  std::unordered_map<TowerProfilerStack, TowerProfilerSite, TowerProfilerStackHash> sites;
+  // Sampled allocations that haven't been freed yet, by their memory
+  std::unordered_map<void*, TowerProfilerSample> live;
+};
+
+// Constructed on first use since memory is allocated during static initialization
+TowerProfiler& tower_profiler() {
+  static TowerProfiler profiler;
+  return profiler;
+}
+
+// The mean bytes between samples, or 0 while the profiler is disabled
+std::atomic<size_t> tower_profiler_interval = 0;
+
+// The names of the scopes the thread is within, where only the outermost ones are kept when it's too deep
+// This is trivially destructible so that it remains usable until the thread has fully exited
+struct TowerProfilerScopes {
+  const char* names[TOWER_PROFILER_MAX_FRAMES];
+  size_t depth = 0;
+};
+thread_local TowerProfilerScopes tower_profiler_scopes;
+
+// Get how many bytes to allocate before the next sample, which are exponentially distributed
+ptrdiff_t tower_profiler_next_sample_bytes(TowerMemoryCache& cache, size_t interval) {
+  uint64_t& random = cache.sample_random;
+  if (random == 0) {
+    random = (uint64_t)(uintptr_t)&cache | 1;
+  }
+  // xorshift64*, where the top 53 bits make a uniform double in (0, 1]
+  random ^= random >> 12;
+  random ^= random << 25;
+  random ^= random >> 27;
+  const double uniform = (double)(((random * 0x2545F4914F6CDD1DULL) >> 11) + 1) / (double)(1ULL << 53);
+  const double bytes = -std::log(uniform) * (double)interval;
+  return (ptrdiff_t)std::min(bytes, (double)PTRDIFF_MAX / 2);
+}
+
+// Walk the frame pointers of the calling thread, which needs every frame to have one (the build forces
+// them on with -fno-omit-frame-pointer), and stops at the first frame that doesn't look like a caller's
+// WebAssembly has no stack in memory that can be walked, so only the scopes are recorded there
+#if defined(__GNUC__)
+__attribute__((noinline, no_sanitize_address))
+#endif
+void tower_profiler_walk_frames(TowerProfilerStack& stack) {
+#if !defined(__wasm__) && defined(__GNUC__)
+  uintptr_t* frame = (uintptr_t*)__builtin_frame_address(0);
+  for (size_t i = 0; frame && i < TOWER_PROFILER_MAX_FRAMES; ++i) {
+    const uintptr_t return_address = frame[1];
+    if (return_address == 0) {
+      break;
+    }
+    stack.push_back(return_address);
+    // Stacks grow down on every supported target, so callers' frames are always above
+    uintptr_t* caller = (uintptr_t*)frame[0];
+    if (caller <= frame || (uintptr_t)caller - (uintptr_t)frame > TOWER_PROFILER_MAX_FRAME_BYTES || ((uintptr_t)caller % sizeof(uintptr_t)) != 0) {
+      break;
+    }
+    frame = caller;
+  }
+#endif
+}
+
+// Called whenever the thread's countdown runs out, returning true if the allocation was sampled
+bool tower_profiler_sample(TowerMemoryCache& cache, void* memory, size_t size) {
+  const size_t interval = tower_profiler_interval.load(std::memory_order_relaxed);
+  if (interval == 0) {
+    cache.bytes_until_sample = TOWER_PROFILER_DISABLED_CHECK_BYTES;
+    cache.sample_armed = false;
+    return false;
+  }
+  cache.bytes_until_sample = tower_profiler_next_sample_bytes(cache, interval);
+  // A countdown that was only checking whether the profiler is enabled says nothing about this allocation
+  if (!cache.sample_armed) {
+    cache.sample_armed = true;
+    return false;
+  }
+
+  TowerProfilerStack stack;
+  const TowerProfilerScopes& scopes = tower_profiler_scopes;
+  const size_t scope_count = std::min(scopes.depth, TOWER_PROFILER_MAX_FRAMES);
+  stack.push_back(scope_count);
+  for (size_t i = 0; i < scope_count; ++i) {
+    stack.push_back((uintptr_t)scopes.names[i]);
+  }
+  tower_profiler_walk_frames(stack);
+
+  // Larger allocations are more likely to be sampled, so each sample stands in for 1 / probability
+  // allocations of the same size
+  const double probability = 1.0 - std::exp(-(double)size / (double)interval);
+  const size_t count = std::max<size_t>(1, (size_t)std::llround(1.0 / probability));
+
+  TowerProfiler& profiler = tower_profiler();
+  std::lock_guard<std::mutex> lock(profiler.mutex);
+  TowerProfilerSite& site = profiler.sites[std::move(stack)];
+  site.total_bytes += size * count;
+  site.total_count += count;
+  site.live_bytes += size * count;
+  site.live_count += count;
+  profiler.live[memory] = { &site, size * count, count };
+  return true;
+}
+
+void tower_profiler_forget(void* memory) {
+  TowerProfiler& profiler = tower_profiler();
+  std::lock_guard<std::mutex> lock(profiler.mutex);
+  auto found = profiler.live.find(memory);
+  assert(found != profiler.live.end());
+  TowerProfilerSample& sample = found->second;
+  sample.site->live_bytes -= sample.bytes;
+  sample.site->live_count -= sample.count;
+  profiler.live.erase(found);
+}
+
+void* tower_memory_allocate(size_t size) {
+  return tower_memory_allocate_tagged(size, TOWER_MEMORY_CATEGORY_GENERAL);
+}
+
+void* tower_memory_allocate_tagged(size_t size, TowerMemoryCategory category) {
+  assert(category < tower_memory_category_count);
+  // Round up to make sure the size is aligned
+  if (size % sizeof(size_t) != 0) {
+    size += sizeof(size_t) - (size % sizeof(size_t));
+  }
+
+  const size_t block_bytes = size + sizeof(size_t) * (TOWER_MEMORY_HEADER_WORDS + TOWER_MEMORY_FOOTER_WORDS);
+  size_t* mem = (size_t*)tower_memory_block_allocate(block_bytes);
+  if (mem == nullptr) {
+    return nullptr;
+  }
+  tower_counter_add(TOWER_COUNTER_MEMORY, 1);
+  tower_memory_category_change(category, (ptrdiff_t)size, 1);
+
+  mem[0] = size;
+  void* result = &mem[TOWER_MEMORY_HEADER_WORDS];
+  size_t tag = category;
+  // While the profiler is disabled, this is the only cost it has on most allocations
+  TowerMemoryCache& cache = tower_memory_cache;
+  cache.bytes_until_sample -= (ptrdiff_t)size;
+  if (cache.bytes_until_sample < 0 && tower_profiler_sample(cache, result, size)) {
+    tag |= TOWER_MEMORY_TAG_SAMPLED;
+  }
+#ifdef NDEBUG
+  mem[1] = tag;
+#else
+  // One guard at the beginning (after the size), and one for the guard at the end
+  size_t end_guard_index = (size / sizeof(size_t)) + TOWER_MEMORY_HEADER_WORDS;
+  mem[1] = (TOWER_MEMORY_GUARD & ~TOWER_MEMORY_TAG_MASK) | tag;
+  mem[end_guard_index] = TOWER_MEMORY_GUARD;
+
+  // Clear the memory to a pattern that simulates uninitialized memory
+  memset(result, 0xDB, size);
+#endif
+  return result;
+}
+
+// Free the memory without touching the allocation count
+void tower_memory_release(void* memory) {
+  // Back up to the start of the allocation
+  size_t* mem = ((size_t*)memory) - TOWER_MEMORY_HEADER_WORDS;
+
+  // Validate the first guard before checking size in case size has been corrupted
+  assert((mem[1] & ~TOWER_MEMORY_TAG_MASK) == (TOWER_MEMORY_GUARD & ~TOWER_MEMORY_TAG_MASK));
+
+  size_t size = mem[0];
+  tower_memory_category_change((TowerMemoryCategory)(mem[1] & TOWER_MEMORY_CATEGORY_MASK), -(ptrdiff_t)size, -1);
+  if (mem[1] & TOWER_MEMORY_TAG_SAMPLED) {
+    tower_profiler_forget(memory);
+  }
+  const size_t block_bytes = size + sizeof(size_t) * (TOWER_MEMORY_HEADER_WORDS + TOWER_MEMORY_FOOTER_WORDS);
+#ifndef NDEBUG
+  size_t end_guard_index = (size / sizeof(size_t)) + TOWER_MEMORY_HEADER_WORDS;
+  assert(mem[end_guard_index] == TOWER_MEMORY_GUARD);
+
+  // Clear the guards and all memory so that we can possibly detect double free
+  memset(mem, 0xFE, block_bytes);
+#endif
+  tower_memory_block_free(mem, block_bytes);
+}
+
+void tower_memory_free(void* memory) {
+  tower_counter_subtract(TOWER_COUNTER_MEMORY, 1);
+  tower_memory_release(memory);
+}
+
+// Free many allocations at once, only touching the allocation count once
+void tower_memory_free_batch(void** memory, size_t count) {
+  tower_counter_subtract(TOWER_COUNTER_MEMORY, count);
+  for (size_t i = 0; i < count; ++i) {
+    tower_memory_release(memory[i]);
+  }
+}
+
+// Collects allocations to be freed together (see tower_memory_free_batch)
+struct TowerMemoryFreeBatch {
+  static const size_t capacity = 64;
+  void* memory[capacity];
+  size_t count = 0;
+
+  void free(void* pointer) {
+    memory[count++] = pointer;
+    if (count == capacity) {
+      flush();
+    }
+  }
+
+  void flush() {
+    if (count != 0) {
+      tower_memory_free_batch(memory, count);
+      count = 0;
+    }
+  }
+};
+
+size_t tower_memory_get_allocated_count() {
+  return tower_counter_read(TOWER_COUNTER_MEMORY);
+}
+
+TowerMemoryCategory tower_memory_category_create(const char* name) {
+  assert(name && *name != '\0');
+  std::lock_guard<std::mutex> lock(tower_memory_category_mutex);
+  const uint32_t count = tower_memory_category_count.load(std::memory_order_relaxed);
+  for (uint32_t i = 0; i < count; ++i) {
+    if (strcmp(tower_memory_category_names[i], name) == 0) {
+      return i;
+    }
+  }
+  assert(count < TOWER_MEMORY_MAX_CATEGORIES);
+  // Atom strings live for the lifetime of the program, the same as categories
+  tower_memory_category_names[count] = tower_atom_get_string(tower_atom_intern(name));
+  tower_memory_category_count.store(count + 1, std::memory_order_release);
+  return count;
+}
+
+size_t tower_memory_get_category_count() {
+  return tower_memory_category_count.load(std::memory_order_acquire);
+}
+
+const char* tower_memory_category_get_name(TowerMemoryCategory category) {
+  assert(category < tower_memory_get_category_count());
+  return tower_memory_category_names[category];
+}
+
+TowerMemoryStats tower_memory_get_stats(TowerMemoryCategory category) {
+  assert(category < tower_memory_get_category_count());
+  tower_memory_categories_flush();
+  return tower_memory_counters_load(tower_memory_categories[category]);
+}
+
+size_t tower_memory_snapshot(TowerMemoryStats* stats, size_t max_count) {
+  tower_memory_categories_flush();
+  const size_t count = tower_memory_get_category_count();
+  for (size_t i = 0; i < count && i < max_count; ++i) {
+    stats[i] = tower_memory_counters_load(tower_memory_categories[i]);
+  }
+  return count;
+}
+
+std::mutex tower_type_memory_mutex;
+TowerTypeMemory* tower_type_memory_list = nullptr;
+
+TowerTypeMemory* tower_type_get_memory(TowerNode* type) {
+  TowerTypeExtra* extra = tower_type_get_extra(type);
+  TowerTypeMemory* memory = std::atomic_ref<TowerTypeMemory*>(extra->type_memory).load(std::memory_order_acquire);
+  if (memory) {
+    return memory;
+  }
+
+  std::lock_guard<std::mutex> lock(tower_type_memory_mutex);
+  memory = extra->type_memory;
+  if (memory) {
+    return memory;
+  }
+  // These aren't counted as tower allocations so that they never show up in the stats themselves
+  memory = new TowerTypeMemory();
+  memory->type = type;
+  memory->next = tower_type_memory_list;
+  if (memory->next) {
+    memory->next->previous = memory;
+  }
+  tower_type_memory_list = memory;
+  std::atomic_ref<TowerTypeMemory*>(extra->type_memory).store(memory, std::memory_order_release);
+  return memory;
+}
+
+// Only called once every component of the type has been destroyed, since they hold references to it
+void tower_type_destroy_memory(TowerNode* type) {
+  std::lock_guard<std::mutex> lock(tower_type_memory_mutex);
+  TowerTypeMemory* memory = type->type_extra->type_memory;
+  if (memory->previous) {
+    memory->previous->next = memory->next;
+  } else {
+    tower_type_memory_list = memory->next;
+  }
+  if (memory->next) {
+    memory->next->previous = memory->previous;
+  }
+  type->type_extra->type_memory = nullptr;
+  delete memory;
+}
+
+void tower_memory_reset_peaks() {
+  tower_memory_categories_flush();
+  const size_t count = tower_memory_get_category_count();
+  for (size_t i = 0; i < count; ++i) {
+    TowerMemoryCounters& counters = tower_memory_categories[i];
+    counters.peak_bytes.store(counters.bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  }
+  std::lock_guard<std::mutex> lock(tower_type_memory_mutex);
+  for (TowerTypeMemory* memory = tower_type_memory_list; memory; memory = memory->next) {
+    memory->counters.peak_bytes.store(memory->counters.bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  }
+}
+
+// Atom strings are stored in fixed size pages so that reading them never needs a lock
+// Pages are never moved or freed, and an atom is only published after it's string is written
+const size_t TOWER_ATOM_PAGE_SIZE = 1024;
+const size_t TOWER_ATOM_MAX_PAGES = 4096;
+const char** tower_atom_pages[TOWER_ATOM_MAX_PAGES] = {};
+std::mutex tower_atom_mutex;
+// Atom 0 is reserved for TOWER_ATOM_NONE
+TowerAtom tower_atom_count = 1;
+
+// Constructed on first use since nodes (and members) can be created during static initialization
+std::unordered_map<std::string_view, TowerAtom>& tower_atom_table() {
+  static std::unordered_map<std::string_view, TowerAtom> table;
+  return table;
+}
+
+TowerAtom tower_atom_intern(const char* string) {
+  if (string == nullptr || *string == '\0') {
+    return TOWER_ATOM_NONE;
+  }
+
+  std::lock_guard<std::mutex> lock(tower_atom_mutex);
+  auto& table = tower_atom_table();
+  auto found = table.find(std::string_view(string));
+  if (found != table.end()) {
+    return found->second;
+  }
+
+  TowerAtom atom = tower_atom_count++;
+  size_t page_index = atom / TOWER_ATOM_PAGE_SIZE;
+  assert(page_index < TOWER_ATOM_MAX_PAGES);
+  const char**& page = tower_atom_pages[page_index];
+  if (page == nullptr) {
+    page = new const char*[TOWER_ATOM_PAGE_SIZE];
+  }
+
+  // Atoms live for the lifetime of the program, so they aren't counted as tower allocations
+  size_t length = strlen(string);
+  char* copy = new char[length + 1];
+  memcpy(copy, string, length + 1);
+  page[atom % TOWER_ATOM_PAGE_SIZE] = copy;
+
+  table.emplace(std::string_view(copy, length), atom);
+  return atom;
+}
+
+TowerAtom tower_atom_find(const char* string) {
+  if (string == nullptr || *string == '\0') {
+    return TOWER_ATOM_NONE;
+  }
+
+  std::lock_guard<std::mutex> lock(tower_atom_mutex);
+  auto& table = tower_atom_table();
+  auto found = table.find(std::string_view(string));
+  return (found == table.end()) ? TOWER_ATOM_NONE : found->second;
+}
+
+const char* tower_atom_get_string(TowerAtom atom) {
+  if (atom == TOWER_ATOM_NONE) {
+    return nullptr;
+  }
+  return tower_atom_pages[atom / TOWER_ATOM_PAGE_SIZE][atom % TOWER_ATOM_PAGE_SIZE];
+}
+
+// A handle is the index of a slot in the handle table, and the generation of the slot when it was handed out
+// Slots are stored in pages that never move or get freed, so they can be read without a lock
+struct TowerHandleSlot {
+  TowerNode* node = nullptr;
+  uint32_t generation = 1;
+  // The next slot in the free list when the slot is not in use
+  uint32_t next_free = 0;
+};
+
+const size_t TOWER_HANDLE_PAGE_SIZE = 1024;
+const size_t TOWER_HANDLE_MAX_PAGES = 16384;
+TowerHandleSlot* tower_handle_pages[TOWER_HANDLE_MAX_PAGES] = {};
+std::mutex tower_handle_mutex;
+// Slot 0 is reserved so that no handle is ever TOWER_HANDLE_NONE
+uint32_t tower_handle_count = 1;
+uint32_t tower_handle_free = 0;
+
+inline TowerHandleSlot& tower_handle_get_slot(uint32_t index) {
+  return tower_handle_pages[index / TOWER_HANDLE_PAGE_SIZE][index % TOWER_HANDLE_PAGE_SIZE];
+}
+
+inline TowerHandle tower_handle_make(uint32_t index, uint32_t generation) {
+  return ((TowerHandle)generation << 32) | index;
+}
+
+TowerHandle tower_node_get_handle(TowerNode* node) {
+  assert(!(node->flags & TOWER_NODE_FLAG_DESTROYED));
+  // Frozen nodes can be shared between threads, so the index may be assigned by another thread
+  uint32_t index = std::atomic_ref<uint32_t>(node->handle_index).load(std::memory_order_acquire);
+  if (index != 0) {
+    return tower_handle_make(index, tower_handle_get_slot(index).generation);
+  }
+
+  std::lock_guard<std::mutex> lock(tower_handle_mutex);
+  index = node->handle_index;
+  if (index != 0) {
+    return tower_handle_make(index, tower_handle_get_slot(index).generation);
+  }
+
+  if (tower_handle_free != 0) {
+    index = tower_handle_free;
+    tower_handle_free = tower_handle_get_slot(index).next_free;
+  } else {
+    index = tower_handle_count++;
+    size_t page = index / TOWER_HANDLE_PAGE_SIZE;
+    assert(page < TOWER_HANDLE_MAX_PAGES);
+    if (tower_handle_pages[page] == nullptr) {
+      // Pages live for the lifetime of the program, so they don't count as tower allocations
+      tower_handle_pages[page] = new TowerHandleSlot[TOWER_HANDLE_PAGE_SIZE];
+    }
+  }
+
+  TowerHandleSlot& slot = tower_handle_get_slot(index);
+  slot.node = node;
+  if (node->arena) {
+    tower_arena_get_records(node->arena)->handle_nodes.push_back(node);
+  }
+  std::atomic_ref<uint32_t>(node->handle_index).store(index, std::memory_order_release);
+  return tower_handle_make(index, slot.generation);
+}
+
+TowerNode* tower_node_from_handle(TowerHandle handle) {
+  uint32_t index = (uint32_t)handle;
+  uint32_t generation = (uint32_t)(handle >> 32);
+  if (index == 0 || index >= TOWER_HANDLE_PAGE_SIZE * TOWER_HANDLE_MAX_PAGES) {
+    return nullptr;
+  }
+  TowerHandleSlot* page = tower_handle_pages[index / TOWER_HANDLE_PAGE_SIZE];
+  if (page == nullptr) {
+    return nullptr;
+  }
+  TowerHandleSlot& slot = page[index % TOWER_HANDLE_PAGE_SIZE];
+  return (slot.generation == generation) ? slot.node : nullptr;
+}
+
+// Invalidate the node's handle when it's destroyed, so that the slot can be reused
+void tower_node_release_handle(TowerNode* node) {
+  std::lock_guard<std::mutex> lock(tower_handle_mutex);
+  uint32_t index = node->handle_index;
+  TowerHandleSlot& slot = tower_handle_get_slot(index);
+  assert(slot.node == node);
+  slot.node = nullptr;
+  // Generation 0 is never used, so that a handle is never TOWER_HANDLE_NONE
+  if (++slot.generation == 0) {
+    slot.generation = 1;
+  }
+  slot.next_free = tower_handle_free;
+  tower_handle_free = index;
+  node->handle_index = 0;
+}
+
+// The block shared by a node and all weak references to it
+// Each block has it's own lock, which is only held to upgrade or to invalidate when the node is destroyed
+struct TowerWeak {
+  // Null once the node has been destroyed
+  TowerNode* node = nullptr;
+  std::atomic_flag lock = ATOMIC_FLAG_INIT;
+  // Every weak reference holds a count, and so does the node until it's destroyed
+  std::atomic<size_t> count = 1;
+};
+
+inline void tower_weak_lock(TowerWeak* weak) {
+  while (weak->lock.test_and_set(std::memory_order_acquire)) {
+    std::this_thread::yield();
+  }
+}
+
+inline void tower_weak_unlock(TowerWeak* weak) {
+  weak->lock.clear(std::memory_order_release);
+}
+
+void tower_weak_release(TowerWeak* weak) {
+  size_t old_count = weak->count.fetch_sub(1, std::memory_order_acq_rel);
+  assert(old_count >= 1);
+  if (old_count == 1) {
+    weak->~TowerWeak();
+    tower_memory_free(weak);
+  }
+}
+
+TowerWeak* tower_weak_add_ref(TowerWeak* weak) {
+  size_t old_count = weak->count.fetch_add(1, std::memory_order_relaxed);
+  assert(old_count >= 1);
+  return weak;
+}
+
+// Invalidate weak references to the node when it's destroyed
+void tower_node_release_weak(TowerNode* node) {
+  TowerWeak* weak = node->weak;
+  tower_weak_lock(weak);
+  weak->node = nullptr;
+  tower_weak_unlock(weak);
+  node->weak = nullptr;
+  tower_weak_release(weak);
+}
+
+size_t tower_node_get_allocated_count() {
+  return tower_counter_read(TOWER_COUNTER_NODES);
+}
+
+TowerArena* tower_arena_create() {
+  // The records live directly after the arena so that a single allocation holds both
+  void* memory = tower_memory_allocate_tagged(sizeof(TowerArena) + sizeof(TowerArenaRecords), TOWER_MEMORY_CATEGORY_ARENAS);
+  TowerArena* arena = new (memory) TowerArena();
+  new (tower_arena_get_records(arena)) TowerArenaRecords(arena);
+  return arena;
+}
+
+inline bool tower_node_drop_cow_source(TowerNode* node);
+inline bool tower_node_drop_shared_ref(TowerNode* node);
+void tower_node_release_destroy(TowerNode* node);
+
+// Destroy every node within the arena and release what the arena holds, leaving only it's memory
+void tower_arena_destroy_nodes(TowerArena* arena) {
+  TowerArenaRecords* records = tower_arena_get_records(arena);
+  arena->destroying = true;
+
+  // Nodes that were destroyed individually have already released their handle and weak references
+  for (TowerNode* node : records->handle_nodes) {
+    if (node->handle_index != 0) {
+      tower_node_release_handle(node);
+    }
+  }
+  for (TowerNode* node : records->weak_nodes) {
+    if (node->weak) {
+      tower_node_release_weak(node);
+    }
+  }
+  for (TowerNode* node : records->clone_nodes) {
+    TowerNode* source = tower_node_get_cow_source(node);
+    if (source && tower_node_drop_cow_source(node)) {
+      tower_node_release_destroy(source);
+    }
+  }
+
+  // Components that were destroyed individually have already been removed from their index
+  for (TowerComponent* component : records->indexed_components) {
+    if (component->index_slot != TOWER_COMPONENT_NOT_INDEXED) {
+      tower_component_index_remove(component->type->type_extra->component_index, component);
+    }
+  }
+
+  // Run the destructors of every component that is still alive
+  for (TowerComponent* component : records->destructible_components) {
+    TowerComponentDestructor destructor = component->destructor;
+    if (destructor) {
+      component->destructor = nullptr;
+      destructor(component, tower_component_userdata(component));
+    }
+  }
+
+  // Detach any children from outside the arena that are still held by living arena nodes
+  for (TowerNode* parent : records->importing_parents) {
+    if (parent->flags & TOWER_NODE_FLAG_DESTROYED) {
+      continue;
+    }
+    for (TowerNode* child : parent->children) {
+      if (child == nullptr || child->arena == arena) {
+        continue;
+      }
+      if (child->flags & TOWER_NODE_FLAG_SHARED) {
+        if (tower_node_drop_shared_ref(child)) {
+          tower_node_release_destroy(child);
+        }
+        continue;
+      }
+      // This logic needs to mimic tower_node_detach
+      child->parent = nullptr;
+      child->parent_slot = TOWER_INVALID_INDEX;
+      tower_node_release_ref(child);
+    }
+  }
+
+  for (TowerNode* type : records->types) {
+    tower_node_release_ref(type);
+  }
+
+  tower_counter_subtract(TOWER_COUNTER_NODES, arena->node_count);
+  tower_counter_subtract(TOWER_COUNTER_COMPONENTS, arena->component_count);
+  records->~TowerArenaRecords();
+}
+
+void tower_arena_free_chunks(TowerArenaChunk* chunk) {
+  while (chunk) {
+    TowerArenaChunk* previous = chunk->previous;
+    tower_memory_free(chunk);
+    chunk = previous;
+  }
+}
+
+void tower_arena_destroy(TowerArena* arena) {
+  tower_arena_destroy_nodes(arena);
+  tower_arena_free_chunks(arena->chunks);
+  tower_arena_free_chunks(arena->free_chunks);
+  arena->~TowerArena();
+  tower_memory_free(arena);
+}
+
+void tower_arena_reset(TowerArena* arena) {
+  tower_arena_destroy_nodes(arena);
+
+  // Chunks of the standard size are kept to be reused, while dedicated chunks are rarely the size needed again
+  TowerArenaChunk* free_chunks = arena->free_chunks;
+  TowerArenaChunk* chunk = arena->chunks;
+  while (chunk) {
+    TowerArenaChunk* previous = chunk->previous;
+    if (chunk->dedicated) {
+      tower_memory_free(chunk);
+    } else {
+      chunk->previous = free_chunks;
+      free_chunks = chunk;
+    }
+    chunk = previous;
+  }
+
+  arena->~TowerArena();
+  new (arena) TowerArena();
+  arena->free_chunks = free_chunks;
+  new (tower_arena_get_records(arena)) TowerArenaRecords(arena);
+}
+
+TowerNode* tower_node_create() {
+  return tower_node_create_in_arena(nullptr);
+}
+
+TowerNode* tower_node_create_in_arena(TowerArena* arena) {
+  // Many nodes never have components, so only callers that know what they'll add reserve room for them
+  // (such as the parser, which reserves a Match within every parse node)
+  return tower_node_create_with_capacity(arena, 0, 0);
+}
+
+TowerNode* tower_node_create_with_capacity(TowerArena* arena, size_t component_count, size_t component_data_bytes) {
+  // Every component needs it's own header in addition to it's data, and each component's data may
+  // need padding up to the alignment (which the last component's data shares with the whole block)
+  size_t inline_bytes = 0;
+  if (component_count != 0) {
+    inline_bytes = tower_component_get_total_bytes(0) * component_count +
+      tower_align(component_data_bytes + (component_count - 1) * (TOWER_COMPONENT_ALIGNMENT - 1), TOWER_COMPONENT_ALIGNMENT);
+  }
+
+  size_t node_bytes = tower_align(sizeof(TowerNode), TOWER_COMPONENT_ALIGNMENT) + inline_bytes;
+  void* memory = tower_node_memory_allocate(arena, node_bytes);
+  tower_counter_add(TOWER_COUNTER_NODES, 1);
+  size_t id = tower_node_next_id();
+  TowerNode* node = new (memory) TowerNode(arena);
+  node->id = id;
+  node->inline_component_bytes = inline_bytes;
+  if (arena) {
+    ++arena->node_count;
+  }
+  return node;
+}
+
+TowerArena* tower_node_get_arena(TowerNode* node) {
+  return node->arena;
+}
+
+void tower_node_set_atomic_ref_count(TowerNode* node, bool atomic) {
+  assert(!(node->flags & TOWER_NODE_FLAG_FROZEN));
+  if (atomic) {
+    node->flags |= TOWER_NODE_FLAG_ATOMIC_REF_COUNT;
+  } else {
+    node->flags &= ~TOWER_NODE_FLAG_ATOMIC_REF_COUNT;
+  }
+}
+
+bool tower_node_get_atomic_ref_count(TowerNode* node) {
+  return (node->flags & TOWER_NODE_FLAG_ATOMIC_REF_COUNT) != 0;
+}
+
+size_t tower_node_add_ref(TowerNode* node) {
+  // Frozen nodes are pinned by the freeze, so references to them are not counted
+  if (node->flags & TOWER_NODE_FLAG_FROZEN) {
+    return node->reference_count;
+  }
+  if (node->flags & TOWER_NODE_FLAG_ATOMIC_REF_COUNT) {
+    // The caller already holds a reference, so taking another doesn't need to be ordered with anything
+    size_t old_count = std::atomic_ref<size_t>(node->reference_count).fetch_add(1, std::memory_order_relaxed);
+    assert(old_count >= 1);
+    return old_count + 1;
+  }
+  assert(node->reference_count >= 1);
+  return ++node->reference_count;
+}
+
+// Increment the reference count only if the node is still alive, returning false if it has reached zero
+inline bool tower_node_try_add_ref(TowerNode* node) {
+  if (node->flags & TOWER_NODE_FLAG_FROZEN) {
+    return true;
+  }
+  if (node->flags & TOWER_NODE_FLAG_ATOMIC_REF_COUNT) {
+    std::atomic_ref<size_t> count(node->reference_count);
+    size_t old_count = count.load(std::memory_order_relaxed);
+    while (old_count != 0) {
+      if (count.compare_exchange_weak(old_count, old_count + 1, std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+    return false;
+  }
+  if (node->reference_count == 0) {
+    return false;
+  }
+  ++node->reference_count;
+  return true;
+}
+
+// Decrement the reference count by count and return the new count
+inline size_t tower_node_subtract_ref(TowerNode* node, size_t count) {
+  if (node->flags & TOWER_NODE_FLAG_FROZEN) {
+    return node->reference_count;
+  }
+  if (node->flags & TOWER_NODE_FLAG_ATOMIC_REF_COUNT) {
+    // Each release publishes the releasing thread's writes to the node, and the final release
+    // acquires all of them before the node is destroyed
+    size_t old_count = std::atomic_ref<size_t>(node->reference_count).fetch_sub(count, std::memory_order_acq_rel);
+    assert(old_count >= count);
+    return old_count - count;
+  }
+  assert(node->reference_count >= count);
+  return node->reference_count -= count;
+}
+
+// Returns true if a node whose reference count has reached new_count should now be destroyed
+inline bool tower_node_should_destroy(TowerNode* node, size_t new_count) {
+  // While an arena is being destroyed, it's nodes are all released at once
+  return new_count == 0 && !(node->arena && node->arena->destroying);
+}
+
+// Decrement the reference count, returning true if the node should now be destroyed
+inline bool tower_node_decrement_ref(TowerNode* node) {
+  return tower_node_should_destroy(node, tower_node_subtract_ref(node, 1));
+}
+
+// Destruct the node and all it's components, and release references to children
+// Any nodes whose last reference was held by the node (children or component types) are destroyed
+// iteratively without recursion, so that long chains can't overflow the stack. Since a node being
+// destroyed can't have a parent, the pending nodes are linked together through their parent pointer
+// If released_types is not null, references to component types are handed back rather than released,
+// so that the owning thread can release them (see TowerReclaimer)
+struct TowerReleasedType {
+  TowerNode* type;
+  size_t count;
+};
+
+void tower_type_destroy_index(TowerNode* type);
+
+// Free every shape that contains the type, which is being destroyed
+void tower_shape_forget_type(TowerNode* type) {
+  TowerShapeKey* key = type->type_extra->shape_key;
+  type->type_extra->shape_key = nullptr;
+  std::lock_guard<std::mutex> lock(tower_shape_mutex);
+  tower_shape_epoch.fetch_add(1, std::memory_order_release);
+  for (TowerShape* shape : key->shapes) {
+    // Shapes reached from the freed ones are freed along with them, which leaves only the first edge
+    if (shape->added_type == type) {
+      shape->parent->transitions->erase(type);
+    }
+    // The other keyed types are still alive, since destroying any of them would have freed the shape
+    for (size_t i = 0; i < shape->capacity; ++i) {
+      TowerNode* other = shape->entries[i].type;
+      if (shape->entries[i].keyed && other != type) {
+        other->type_extra->shape_key->shapes.erase(shape);
+      }
+    }
+  }
+  for (TowerShape* shape : key->shapes) {
+    delete shape->transitions;
+    delete[] shape->entries;
+    delete shape;
+  }
+  delete key;
+}
+
+// Clones count their reference to the source, and parents their reference to a shared child, even
+// though the node is frozen (when no other references are counted), so that it outlives them
+inline void tower_node_add_frozen_ref(TowerNode* node) {
+  std::atomic_ref<size_t>(node->reference_count).fetch_add(1, std::memory_order_relaxed);
+}
+
+// Drop a reference to a shared node held by a parent, clone or the interner, returning true if it
+// was the last and the node should now be destroyed
+// Shared nodes stay frozen for as long as anything holds them, which leaves only the freeze's pin
+inline bool tower_node_drop_shared_ref(TowerNode* node) {
+  if (std::atomic_ref<size_t>(node->reference_count).fetch_sub(1, std::memory_order_acq_rel) != 2) {
+    return false;
+  }
+  // Each shared node is frozen on it's own (it's children are shared as well), so this is the whole thaw
+  node->flags &= ~TOWER_NODE_FLAG_FROZEN;
+  node->reference_count = 0;
+  return true;
+}
+
+// Drop a clone's reference to it's source, returning true if the source should now be destroyed
+inline bool tower_node_drop_cow_source(TowerNode* node) {
+  TowerNode* source = node->extra->cow_source;
+  node->extra->cow_source = nullptr;
+  if (source->flags & TOWER_NODE_FLAG_SHARED) {
+    return tower_node_drop_shared_ref(source);
+  }
+  // The freeze pins the source, so it's count can't reach zero while frozen
+  if (source->flags & TOWER_NODE_FLAG_FROZEN) {
+    std::atomic_ref<size_t>(source->reference_count).fetch_sub(1, std::memory_order_relaxed);
+    return false;
+  }
+  return tower_node_decrement_ref(source);
+}
+
+void tower_node_destroy(TowerNode* pending, std::vector<TowerReleasedType>* released_types) {
+  TowerMemoryFreeBatch frees;
+  size_t destroyed_node_count = 0;
+  size_t destroyed_component_count = 0;
+
+  const auto release = [&](TowerNode* node) {
+    if (tower_node_decrement_ref(node)) {
+      node->parent = pending;
+      pending = node;
+    }
+  };
+
+  while (pending) {
+    TowerNode* node = pending;
+    pending = node->parent;
+    node->parent = nullptr;
+    TowerArena* arena = node->arena;
+
+    for (size_t i = 0; i < node->children.size(); ++i) {
+      TowerNode* child = node->children[i];
+      if (child == nullptr) {
+        continue;
+      }
+      // Shared children don't point back to their parents, and count their references separately
+      if (child->flags & TOWER_NODE_FLAG_SHARED) {
+        if (tower_node_drop_shared_ref(child)) {
+          child->parent = pending;
+          pending = child;
+        }
+        continue;
+      }
+      // This logic needs to mimic tower_node_detach
+      child->parent = nullptr;
+      child->parent_slot = TOWER_INVALID_INDEX;
+      release(child);
+    }
+
+    const size_t component_count = node->shape->component_count;
+    for (size_t i = 0; i < component_count; ++i) {
+      TowerComponent* component = node->components[i];
+      // Components shared with the source of a clone belong to the source
+      if (component->owner != node) {
+        continue;
+      }
+      ++destroyed_component_count;
+      // Within an arena, the arena holds the reference to the type
+      if (!arena) {
+        if (released_types) {
+          // Siblings tend to share types, so consecutive releases of the same type are combined
+          if (!released_types->empty() && released_types->back().type == component->type) {
+            ++released_types->back().count;
+          } else {
+            released_types->push_back({ component->type, 1 });
+          }
+        } else {
+          release(component->type);
+        }
+      }
+      if (component->destructor) {
+        component->destructor(component, tower_component_userdata(component));
+      }
+      if (component->index_slot != TOWER_COMPONENT_NOT_INDEXED) {
+        tower_component_index_remove(component->type->type_extra->component_index, component);
+      }
+
+      if (arena) {
+        // The arena still visits the component when it's destroyed, so leave it without a destructor
+        component->destructor = nullptr;
+        --arena->component_count;
+      } else {
+        TowerTypeExtra* type_extra = component->type->type_extra;
+        if (type_extra && type_extra->type_memory) {
+          tower_memory_counters_change(type_extra->type_memory->counters, -(ptrdiff_t)tower_component_get_total_bytes(component->data_bytes), -1);
+        }
+        component->~TowerComponent();
+        // Inline components are freed along with the node
+        if (!tower_node_is_component_inline(node, component)) {
+          frees.free(component);
+        }
+      }
+    }
+
+    if (node->handle_index != 0) {
+      tower_node_release_handle(node);
+    }
+    if (node->weak) {
+      tower_node_release_weak(node);
+    }
+    if (TowerTypeExtra* type_extra = node->type_extra) {
+      if (type_extra->component_index) {
+        tower_type_destroy_index(node);
+      }
+      if (type_extra->type_memory) {
+        tower_type_destroy_memory(node);
+      }
+      if (type_extra->shape_key) {
+        tower_shape_forget_type(node);
+      }
+      node->type_extra = nullptr;
+      delete type_extra;
+    }
+    // Shared components were skipped above, so the source can go now
+    TowerNode* cow_source = tower_node_get_cow_source(node);
+    if (cow_source && tower_node_drop_cow_source(node)) {
+      cow_source->parent = pending;
+      pending = cow_source;
+    }
+
+    ++destroyed_node_count;
+    if (arena) {
+      // The memory remains valid until the arena is destroyed, which may still look at the node
+      node->flags |= TOWER_NODE_FLAG_DESTROYED;
+      --arena->node_count;
+    } else {
+      if (node->components != node->inline_component_slots) {
+        frees.free(node->components);
+      }
+      if (node->member_index) {
+        frees.free(node->member_index);
+      }
+      if (node->extra) {
+        frees.free(node->extra);
+      }
+      node->~TowerNode();
+      frees.free(node);
+    }
+  }
+
+  frees.flush();
+  tower_counter_subtract(TOWER_COUNTER_NODES, destroyed_node_count);
+  tower_counter_subtract(TOWER_COUNTER_COMPONENTS, destroyed_component_count);
+}
+
+size_t tower_node_release_refs(TowerNode* node, size_t count);
+
+// Destroys released subtrees on a background thread while deferred reclamation is enabled
+// Nodes are queued through their parent pointer, the same as within tower_node_destroy
+// Component types are shared between subtrees, so rather than the reclaimer thread releasing them,
+// they are handed back and released by whichever thread next queues a node or flushes
+struct TowerReclaimer {
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable idle;
+  TowerNode* queued = nullptr;
+  std::vector<TowerReleasedType> released_types;
+  bool busy = false;
+  bool stopping = false;
+  std::thread* thread = nullptr;
+};
+
+TowerReclaimer tower_reclaimer;
+std::atomic<bool> tower_reclaim_deferred = false;
+
+void tower_reclaim_thread() {
+  TowerReclaimer& reclaimer = tower_reclaimer;
+  std::vector<TowerReleasedType> released_types;
+  std::unique_lock<std::mutex> lock(reclaimer.mutex);
+  for (;;) {
+    reclaimer.wake.wait(lock, [&]() { return reclaimer.queued || reclaimer.stopping; });
+    if (!reclaimer.queued) {
+      break;
+    }
+    TowerNode* queued = reclaimer.queued;
+    reclaimer.queued = nullptr;
+    reclaimer.busy = true;
+
+    lock.unlock();
+    tower_node_destroy(queued, &released_types);
+    lock.lock();
+
+    reclaimer.released_types.insert(reclaimer.released_types.end(), released_types.begin(), released_types.end());
+    released_types.clear();
+    reclaimer.busy = false;
+    reclaimer.idle.notify_all();
+  }
+}
+
+// Release the component types handed back by the reclaimer thread, must be called without the lock held
+void tower_reclaim_release_types(std::vector<TowerReleasedType>& released_types) {
+  for (const TowerReleasedType& released : released_types) {
+    tower_node_release_refs(released.type, released.count);
+  }
+  released_types.clear();
+}
+
+void tower_reclaim_enqueue(TowerNode* node) {
+  TowerReclaimer& reclaimer = tower_reclaimer;
+  std::vector<TowerReleasedType> released_types;
+  {
+    std::lock_guard<std::mutex> lock(reclaimer.mutex);
+    node->parent = reclaimer.queued;
+    reclaimer.queued = node;
+    if (!reclaimer.thread) {
+      reclaimer.stopping = false;
+      reclaimer.thread = new std::thread(tower_reclaim_thread);
+    }
+    released_types.swap(reclaimer.released_types);
+  }
+  reclaimer.wake.notify_one();
+  tower_reclaim_release_types(released_types);
+}
+
+void tower_reclaim_flush() {
+  TowerReclaimer& reclaimer = tower_reclaimer;
+  std::vector<TowerReleasedType> released_types;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(reclaimer.mutex);
+      reclaimer.idle.wait(lock, [&]() { return !reclaimer.queued && !reclaimer.busy; });
+      released_types.swap(reclaimer.released_types);
+    }
+    // Releasing the types may queue them to be destroyed as well
+    if (released_types.empty()) {
+      break;
+    }
+    tower_reclaim_release_types(released_types);
+  }
+}
+
+void tower_reclaim_set_deferred(bool deferred) {
+  TowerReclaimer& reclaimer = tower_reclaimer;
+  tower_reclaim_deferred = deferred;
+  if (deferred) {
+    return;
+  }
+
+  tower_reclaim_flush();
+  std::thread* thread = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(reclaimer.mutex);
+    reclaimer.stopping = true;
+    std::swap(thread, reclaimer.thread);
+  }
+  if (thread) {
+    reclaimer.wake.notify_one();
+    thread->join();
+    delete thread;
+  }
+}
+
+bool tower_reclaim_get_deferred() {
+  return tower_reclaim_deferred;
+}
+
+// Destroy a node that was released to a count of zero, or queue it for deferred reclamation
+void tower_node_release_destroy(TowerNode* node) {
+  // Arena nodes are never freed individually, so there's nothing to gain from deferring them
+  if (!node->arena && tower_reclaim_deferred.load(std::memory_order_relaxed)) {
+    tower_reclaim_enqueue(node);
+  } else {
+    tower_node_destroy(node, nullptr);
+  }
+}
+
+// Release several references to a node at once, destroying it if they were the last
+size_t tower_node_release_refs(TowerNode* node, size_t count) {
+  size_t new_count = tower_node_subtract_ref(node, count);
+  if (tower_node_should_destroy(node, new_count)) {
+    tower_node_release_destroy(node);
+  }
+  return new_count;
+}
+
+size_t tower_node_release_ref(TowerNode* node) {
+  size_t new_count = tower_node_subtract_ref(node, 1);
+  if (tower_node_should_destroy(node, new_count)) {
+    tower_node_release_destroy(node);
+  }
+  return new_count;
+}
+
+size_t tower_node_get_ref_count(TowerNode* node) {
+  if (node->flags & TOWER_NODE_FLAG_ATOMIC_REF_COUNT) {
+    return std::atomic_ref<size_t>(node->reference_count).load(std::memory_order_relaxed);
+  }
+  return node->reference_count;
+}
+
+size_t tower_node_get_id(TowerNode* node) {
+  return node->id;
+}
+
+size_t tower_member_index_hash(TowerAtom member, size_t capacity) {
+  // Fibonacci hashing spreads sequential atoms across the table
+  return (size_t)((member * 0x9E3779B9u) ^ (member >> 7)) & (capacity - 1);
+}
+
+void tower_member_index_insert(TowerMemberIndex* index, TowerAtom member, size_t slot) {
+  TowerMemberIndexEntry* entries = index->entries();
+  size_t i = tower_member_index_hash(member, index->capacity);
+  while (entries[i].member != TOWER_ATOM_NONE) {
+    if (entries[i].member == member) {
+      entries[i].slot = slot;
+      return;
+    }
+    i = (i + 1) & (index->capacity - 1);
+  }
+  entries[i].member = member;
+  entries[i].slot = slot;
+  ++index->count;
+}
+
+TowerMemberIndexEntry* tower_member_index_find(TowerMemberIndex* index, TowerAtom member) {
+  TowerMemberIndexEntry* entries = index->entries();
+  size_t i = tower_member_index_hash(member, index->capacity);
+  while (entries[i].member != TOWER_ATOM_NONE) {
+    if (entries[i].member == member) {
+      return &entries[i];
+    }
+    i = (i + 1) & (index->capacity - 1);
+  }
+  return nullptr;
+}
+
+void tower_member_index_erase(TowerMemberIndex* index, TowerAtom member) {
+  TowerMemberIndexEntry* entries = index->entries();
+  const size_t mask = index->capacity - 1;
+  TowerMemberIndexEntry* found = tower_member_index_find(index, member);
+  if (!found) {
+    return;
+  }
+
+  // Shift back any following entries that were displaced past the hole, so probing never needs tombstones
+  size_t hole = found - entries;
+  size_t i = hole;
+  for (;;) {
+    i = (i + 1) & mask;
+    if (entries[i].member == TOWER_ATOM_NONE) {
+      break;
+    }
+    size_t home = tower_member_index_hash(entries[i].member, index->capacity);
+    // Move the entry if the hole lies cyclically between it's home and where it is now
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      entries[hole] = entries[i];
+      hole = i;
+    }
+  }
+  entries[hole] = TowerMemberIndexEntry();
+  --index->count;
+}
+
+// Rebuild the member index from the children, sized for the current number of named children
+// Also used after compaction since the slots of children move
+void tower_node_rebuild_member_index(TowerNode* node) {
+  if (node->member_index) {
+    tower_node_memory_free(node->arena, node->member_index);
+    node->member_index = nullptr;
+  }
+  if (node->named_child_count < TOWER_MEMBER_INDEX_THRESHOLD) {
+    return;
+  }
+
+  size_t capacity = TOWER_MEMBER_INDEX_THRESHOLD * 2;
+  while (capacity < node->named_child_count * 4) {
+    capacity *= 2;
+  }
+
+  size_t bytes = sizeof(TowerMemberIndex) + sizeof(TowerMemberIndexEntry) * capacity;
+  TowerMemberIndex* index = new (tower_node_memory_allocate(node->arena, bytes)) TowerMemberIndex();
+  index->capacity = capacity;
+  TowerMemberIndexEntry* entries = index->entries();
+  for (size_t i = 0; i < capacity; ++i) {
+    new (&entries[i]) TowerMemberIndexEntry();
+  }
+
+  for (size_t i = 0; i < node->child_members.size(); ++i) {
+    if (node->child_members[i] != TOWER_ATOM_NONE) {
+      tower_member_index_insert(index, node->child_members[i], i);
+    }
+  }
+  node->member_index = index;
+}
+
+void tower_node_materialize_children(TowerNode* node);
+
+// Mark the labels of the node and the nodes above it as out of date after it's children change
+inline void tower_node_invalidate_labels(TowerNode* node) {
+  // The same as hashes, invalid labels always have invalid labels above them
+  while (node && tower_node_get_label_exit(node) != 0) {
+    node->extra->label_exit = 0;
+    node = node->parent;
+  }
+}
+
+void tower_node_invalidate_hash(TowerNode* node) {
+  // A node with an invalid hash always has invalid hashes above it, so this stops at the first one
+  while (node && tower_node_load_hash(node) != 0) {
+    // Frozen nodes never change, so their hashes never have to be invalidated
+    assert(!(node->flags & TOWER_NODE_FLAG_FROZEN));
+    tower_node_store_hash(node, 0);
+    node = node->parent;
+  }
+}
+
+struct TowerJournal {
+  TowerNode* root;
+  // A ring buffer whose size is a power of 2, where the entries between read and write are waiting to be drained
+  std::vector<TowerJournalEntry> entries;
+  uint64_t read = 0;
+  uint64_t write = 0;
+  // How many entries were overwritten before being drained since the last drain
+  size_t dropped = 0;
+};
+
+// Every journal, guarded by the mutex along with their entries
+std::mutex tower_journal_mutex;
+std::vector<TowerJournal*> tower_journals;
+// Checked before recording anything, so that changes cost almost nothing while there are no journals
+std::atomic<size_t> tower_journal_count = 0;
+
+// Record the change into every journal whose root is the node or above it
+void tower_journal_record_slow(TowerJournalEvent event, TowerNode* node, TowerNode* subject, TowerAtom member) {
+  TowerJournalEntry entry = { event, TOWER_HANDLE_NONE, TOWER_HANDLE_NONE, member };
+  // Nodes above the last journal root are no longer marked
+  for (TowerNode* root = node; root && (root->flags & TOWER_NODE_FLAG_JOURNAL_SUBTREE); root = root->parent) {
+    if (!(root->flags & TOWER_NODE_FLAG_JOURNALED)) {
+      continue;
+    }
+    // Only changes that are journaled give their nodes handles
+    if (entry.node == TOWER_HANDLE_NONE) {
+      entry.node = tower_node_get_handle(node);
+      entry.subject = tower_node_get_handle(subject);
+    }
+    std::lock_guard<std::mutex> lock(tower_journal_mutex);
+    for (TowerJournal* journal : tower_journals) {
+      if (journal->root != root) {
+        continue;
+      }
+      const uint64_t capacity = journal->entries.size();
+      if (journal->write - journal->read == capacity) {
+        ++journal->read;
+        ++journal->dropped;
+      }
+      journal->entries[journal->write++ & (capacity - 1)] = entry;
+    }
+  }
+}
+
+inline void tower_journal_record(TowerJournalEvent event, TowerNode* node, TowerNode* subject, TowerAtom member) {
+  // Trees without a journal skip the walk up to the roots
+  if (tower_journal_count.load(std::memory_order_relaxed) != 0 && (node->flags & TOWER_NODE_FLAG_JOURNAL_SUBTREE)) {
+    tower_journal_record_slow(event, node, subject, member);
+  }
+}
+
+// Mark (or unmark) the subtree as being within a journal, after it's moved into (or out of) one or a
+// journal is created (or destroyed) on it
+// A marked node always has marked nodes below it, so marking stops at nodes that already are, and
+// unmarking stops at nodes that aren't or that are themselves journal roots
+// Frozen nodes can't change, so they're skipped and marked correctly once thawed (see tower_node_thaw)
+void tower_node_mark_journaled(TowerNode* root, bool journaled) {
+  std::vector<TowerNode*> stack;
+  stack.push_back(root);
+  while (!stack.empty()) {
+    TowerNode* node = stack.back();
+    stack.pop_back();
+    if (journaled) {
+      if (node->flags & TOWER_NODE_FLAG_JOURNAL_SUBTREE) {
+        continue;
+      }
+      node->flags |= TOWER_NODE_FLAG_JOURNAL_SUBTREE;
+    } else {
+      if (!(node->flags & TOWER_NODE_FLAG_JOURNAL_SUBTREE) || (node->flags & TOWER_NODE_FLAG_JOURNALED)) {
+        continue;
+      }
+      node->flags &= ~TOWER_NODE_FLAG_JOURNAL_SUBTREE;
+    }
+    // A clone's children that haven't been cloned yet belong to the source, and are marked once cloned
+    for (TowerNode* child : node->children) {
+      if (child && !(child->flags & TOWER_NODE_FLAG_FROZEN)) {
+        stack.push_back(child);
+      }
+    }
+  }
+}
+
+// Whether a node attached to the parent (or detached if it's null) is within a journal
+inline bool tower_node_is_journaled_under(TowerNode* node, TowerNode* parent) {
+  return (node->flags & TOWER_NODE_FLAG_JOURNALED) || (parent && (parent->flags & TOWER_NODE_FLAG_JOURNAL_SUBTREE));
+}
+
+// Get the member name of the child in a slot, or TOWER_ATOM_NONE if it has none
+inline TowerAtom tower_node_get_child_member_at(TowerNode* parent, size_t slot) {
+  return parent->child_members.empty() ? TOWER_ATOM_NONE : parent->child_members[slot];
+}
+
+// The node whose children make up the structure of a node, which for a clone that hasn't cloned it's
+// children yet is the source (so that hashing and comparing clones never has to clone anything)
+inline TowerNode* tower_node_get_structure(TowerNode* node) {
+  return (node->flags & TOWER_NODE_FLAG_COW_CHILDREN) ? node->extra->cow_source : node;
+}
+
+// Get the position of a slot among the children, not counting the tombstones before it
+size_t tower_node_get_slot_index(const TowerNode* parent, size_t slot) {
+  if (parent->child_tombstone_count == 0) {
+    return slot;
+  }
+  size_t index = slot;
+  for (size_t i = 0; i < slot; ++i) {
+    index -= (parent->children[i] == nullptr);
+  }
+  return index;
+}
+
+// Remove all tombstones from the parent's children, preserving the order of the remaining children
+// Detaching is O(1) by leaving a tombstone, and writes compact once tombstones are a large part of the
+// children, so that reads never have to (and never write to the node)
+void tower_node_compact_children(TowerNode* parent) {
+  if (parent->flags & TOWER_NODE_FLAG_COW_CHILDREN) {
+    tower_node_materialize_children(parent);
+  }
+  if (parent->child_tombstone_count == 0) {
+    return;
+  }
+
+  auto& children = parent->children;
+  auto& members = parent->child_members;
+  const bool has_members = !members.empty();
+  size_t write = 0;
+  for (size_t read = 0; read < children.size(); ++read) {
+    if (children[read] == nullptr) {
+      continue;
+    }
+    if (write != read) {
+      children[write] = children[read];
+      if (has_members) {
+        members[write] = members[read];
+      }
+    }
+    // Shared children don't know which slots they are in
+    if (!(children[write]->flags & TOWER_NODE_FLAG_SHARED)) {
+      children[write]->parent_slot = write;
+    }
+    ++write;
+  }
+  children.resize(write);
+  if (has_members) {
+    members.resize(write);
+  }
+  parent->child_tombstone_count = 0;
+
+  if (parent->member_index) {
+    tower_node_rebuild_member_index(parent);
+  }
+}
+
+const size_t TOWER_NODE_TOMBSTONE_COMPACT_RATIO = 2;
+
+// Leaves a tombstone in the slot, but does not touch the child or it's reference count
+void tower_node_remove_child_slot(TowerNode* parent, size_t slot) {
+  tower_node_invalidate_hash(parent);
+  tower_node_invalidate_labels(parent);
+  auto& children = parent->children;
+  auto& members = parent->child_members;
+  TowerAtom member = tower_node_get_child_member_at(parent, slot);
+  if (member != TOWER_ATOM_NONE) {
+    --parent->named_child_count;
+    if (parent->member_index) {
+      tower_member_index_erase(parent->member_index, member);
+    }
+  }
+  children[slot] = nullptr;
+  if (member != TOWER_ATOM_NONE) {
+    members[slot] = TOWER_ATOM_NONE;
+  }
+  ++parent->child_tombstone_count;
+
+  // Tombstones at the end never need to be compacted
+  while (!children.empty() && children.back() == nullptr) {
+    children.pop_back();
+    if (!members.empty()) {
+      members.pop_back();
+    }
+    --parent->child_tombstone_count;
+  }
+
+  // Compacting once half of the slots are tombstones keeps detaching O(1) amortized, and bounds how
+  // many tombstones reads have to skip
+  if (parent->child_tombstone_count * TOWER_NODE_TOMBSTONE_COMPACT_RATIO > parent->children.size()) {
+    tower_node_compact_children(parent);
+  }
+}
+
+void tower_node_attach(TowerNode* child, TowerNode* new_parent) {
+  tower_node_attach_member_atom(child, new_parent, TOWER_ATOM_NONE);
+}
+
+void tower_node_attach_member(TowerNode* child, TowerNode* new_parent, const char* member_name) {
+  tower_node_attach_member_atom(child, new_parent, tower_atom_intern(member_name));
+}
+
+size_t tower_node_find_child_member_slot(TowerNode* parent, TowerAtom member);
+void tower_node_detach_slot(TowerNode* parent, size_t slot);
+
+void tower_node_attach_member_atom(TowerNode* child, TowerNode* new_parent, TowerAtom member) {
+  assert(child != nullptr);
+  assert(child != new_parent);
+  // Nodes within an arena are destroyed with the arena, so they can never escape to a parent outside of it
+  assert(new_parent == nullptr || child->arena == nullptr || child->arena == new_parent->arena);
+  // Frozen nodes can't be moved (shared nodes are never moved, only added to more parents), and frozen
+  // parents can't gain or lose children
+  const bool shared = (child->flags & TOWER_NODE_FLAG_SHARED) != 0;
+  assert(!(child->flags & TOWER_NODE_FLAG_FROZEN) || shared);
+  assert(new_parent == nullptr || !(new_parent->flags & TOWER_NODE_FLAG_FROZEN));
+  assert(child->parent == nullptr || !(child->parent->flags & TOWER_NODE_FLAG_FROZEN));
+
+  if (child->parent == nullptr && new_parent == nullptr) {
+    return;
+  }
+
+  // We know we're changing parents at this point (attaching to a new one or detaching)
+  // Check if we need to detach from the current parent
+  if (child->parent) {
+    tower_journal_record(TOWER_JOURNAL_DETACH, child->parent, child, tower_node_get_child_member_at(child->parent, child->parent_slot));
+    tower_node_remove_child_slot(child->parent, child->parent_slot);
+  } else if (shared) {
+    // Each parent holds a reference to a shared child for as long as it's within one of the parent's slots
+    tower_node_add_frozen_ref(child);
+  } else {
+    // Since the child has no parent, we know the new parent can't
+    // be null so we are transitioning from detached to attached
+    tower_node_add_ref(child);
+  }
+
+  // Shared children never point back to their parents, so the slot alone links them
+  if (!shared) {
+    child->parent = new_parent;
+    child->parent_slot = TOWER_INVALID_INDEX;
+  }
+
+  // Finally, if we have a new parent, add ourselves
+  if (new_parent) {
+    // A clone's own children have to exist before it can gain more
+    if (new_parent->flags & TOWER_NODE_FLAG_COW_CHILDREN) {
+      tower_node_materialize_children(new_parent);
+    }
+    if (member != TOWER_ATOM_NONE) {
+      // Find a member of the same name and detach it
+      // Note: This may destroy the child if this is the last reference to this child
+      size_t same_member_slot = tower_node_find_child_member_slot(new_parent, member);
+      if (same_member_slot != TOWER_INVALID_INDEX) {
+        tower_node_detach_slot(new_parent, same_member_slot);
+      }
+    }
+
+    // The arena must release children from outside of it when destroyed
+    if (new_parent->arena && child->arena != new_parent->arena && !(new_parent->flags & TOWER_NODE_FLAG_ARENA_IMPORTS)) {
+      new_parent->flags |= TOWER_NODE_FLAG_ARENA_IMPORTS;
+      tower_arena_get_records(new_parent->arena)->importing_parents.push_back(new_parent);
+    }
+
+    tower_node_invalidate_hash(new_parent);
+    tower_node_invalidate_labels(new_parent);
+    const size_t slot = new_parent->children.size();
+    if (!shared) {
+      child->parent_slot = slot;
+    }
+    new_parent->children.push_back(child);
+    // Member names are only stored once any child has one
+    auto& members = new_parent->child_members;
+    if (member != TOWER_ATOM_NONE || !members.empty()) {
+      members.resize(slot, TOWER_ATOM_NONE);
+      members.push_back(member);
+    }
+
+    if (member != TOWER_ATOM_NONE) {
+      ++new_parent->named_child_count;
+      TowerMemberIndex* index = new_parent->member_index;
+      // Grow (or create) the index once it would be more than half full
+      if (index == nullptr ? new_parent->named_child_count >= TOWER_MEMBER_INDEX_THRESHOLD : index->count * 2 >= index->capacity) {
+        tower_node_rebuild_member_index(new_parent);
+      } else if (index) {
+        tower_member_index_insert(index, member, slot);
+      }
+    }
+    tower_journal_record(TOWER_JOURNAL_ATTACH, new_parent, child, member);
+  }
+
+  // Shared nodes are frozen, so they never need to be marked
+  if (!shared && ((child->flags & TOWER_NODE_FLAG_JOURNAL_SUBTREE) != 0) != tower_node_is_journaled_under(child, new_parent)) {
+    tower_node_mark_journaled(child, !(child->flags & TOWER_NODE_FLAG_JOURNAL_SUBTREE));
+  }
+
+  if (new_parent == nullptr) {
+    // Since the child had a parent, if the new parent is null
+    // we are transitioning from attached to detached
+    // This MUST come at the end as this could be the last reference
+    // to child and could cause the child pointer to be freed
+    tower_node_release_ref(child);
+  }
+}
+
+void tower_node_detach(TowerNode* child) {
+  tower_node_attach_member_atom(child, nullptr, TOWER_ATOM_NONE);
+}
+
+// Detach whichever child is in the slot, including a shared child (which can't be found from the child)
+void tower_node_detach_slot(TowerNode* parent, size_t slot) {
+  TowerNode* child = parent->children[slot];
+  if (!(child->flags & TOWER_NODE_FLAG_SHARED)) {
+    tower_node_detach(child);
+    return;
+  }
+  assert(!(parent->flags & TOWER_NODE_FLAG_FROZEN));
+  tower_journal_record(TOWER_JOURNAL_DETACH, parent, child, tower_node_get_child_member_at(parent, slot));
+  tower_node_remove_child_slot(parent, slot);
+  if (tower_node_drop_shared_ref(child)) {
+    tower_node_release_destroy(child);
+  }
+}
+
+TowerNode* tower_node_get_parent(TowerNode* child) {
+  return child->parent;
+}
+
+size_t tower_node_get_child_count(TowerNode* parent) {
+  // Counting doesn't need a clone to have it's own children yet (frozen sources have no tombstones)
+  if (parent->flags & TOWER_NODE_FLAG_COW_CHILDREN) {
+    return parent->extra->cow_source->children.size();
+  }
+  return parent->children.size() - parent->child_tombstone_count;
+}
+
+void tower_node_attach_many(TowerNode* const* children, size_t count, TowerNode* new_parent) {
+  assert(new_parent != nullptr);
+  // Make room for all of them at once, compacting first so that tombstones don't count towards the size
+  tower_node_compact_children(new_parent);
+  new_parent->children.reserve(new_parent->children.size() + count);
+  if (!new_parent->child_members.empty()) {
+    new_parent->child_members.reserve(new_parent->children.size() + count);
+  }
+  for (size_t i = 0; i < count; ++i) {
+    tower_node_attach_member_atom(children[i], new_parent, TOWER_ATOM_NONE);
+  }
+}
+
+TowerNode* const* tower_node_get_children(TowerNode* parent, size_t* count) {
+  // A clone's children have to be it's own before they're handed out to be written
+  if (parent->flags & TOWER_NODE_FLAG_COW_CHILDREN) {
+    tower_node_materialize_children(parent);
+  }
+  *count = parent->children.size();
+  return parent->children.data();
+}
+
+// Find the slot of the child at the index (skipping tombstones), or TOWER_INVALID_INDEX
+size_t tower_node_get_child_slot(const TowerNode* parent, size_t index) {
+  auto& children = parent->children;
+  if (parent->child_tombstone_count == 0) {
+    return (index < children.size()) ? index : TOWER_INVALID_INDEX;
+  }
+  // Tombstones are only ever a small part of the children (see tower_node_remove_child_slot)
+  for (size_t slot = 0; slot < children.size(); ++slot) {
+    if (children[slot] && index-- == 0) {
+      return slot;
+    }
+  }
+  return TOWER_INVALID_INDEX;
+}
+
+TowerNode* tower_node_get_child(TowerNode* parent, size_t index) {
+  if (parent->flags & TOWER_NODE_FLAG_COW_CHILDREN) {
+    tower_node_materialize_children(parent);
+  }
+  const size_t slot = tower_node_get_child_slot(parent, index);
+  return (slot == TOWER_INVALID_INDEX) ? nullptr : parent->children[slot];
+}
+
+void tower_node_detach_child(TowerNode* parent, size_t index) {
+  // A clone's own children have to exist before it can lose any
+  if (parent->flags & TOWER_NODE_FLAG_COW_CHILDREN) {
+    tower_node_materialize_children(parent);
+  }
+  const size_t slot = tower_node_get_child_slot(parent, index);
+  assert(slot != TOWER_INVALID_INDEX);
+  tower_node_detach_slot(parent, slot);
+}
+
+// Find the slot of a member (which may include tombstones) or TOWER_INVALID_INDEX
+size_t tower_node_find_child_member_slot(TowerNode* parent, TowerAtom member) {
+  assert(member != TOWER_ATOM_NONE);
+  if (parent->flags & TOWER_NODE_FLAG_COW_CHILDREN) {
+    tower_node_materialize_children(parent);
+  }
+
+  if (parent->member_index) {
+    TowerMemberIndexEntry* entry = tower_member_index_find(parent->member_index, member);
+    return entry ? entry->slot : TOWER_INVALID_INDEX;
+  }
+
+  for (size_t i = 0; i < parent->child_members.size(); ++i) {
+    // Tombstones never have a member
+    if (parent->child_members[i] == member) {
+      return i;
+    }
+  }
+  return TOWER_INVALID_INDEX;
+}
+
+TowerNode* tower_node_get_child_member(TowerNode* parent, const char* member_name) {
+  assert(member_name && *member_name != '\0');
+  // If the name was never interned, then no node can have it as a member
+  TowerAtom member = tower_atom_find(member_name);
+  return (member == TOWER_ATOM_NONE) ? nullptr : tower_node_get_child_member_atom(parent, member);
+}
+
+TowerNode* tower_node_get_child_member_atom(TowerNode* parent, TowerAtom member) {
+  size_t slot = tower_node_find_child_member_slot(parent, member);
+  return (slot == TOWER_INVALID_INDEX) ? nullptr : parent->children[slot];
+}
+
+size_t tower_node_get_child_member_index(TowerNode* parent, const char* member_name) {
+  assert(member_name && *member_name != '\0');
+  TowerAtom member = tower_atom_find(member_name);
+  return (member == TOWER_ATOM_NONE) ? TOWER_INVALID_INDEX : tower_node_get_child_member_index_atom(parent, member);
+}
+
+size_t tower_node_get_child_member_index_atom(TowerNode* parent, TowerAtom member) {
+  size_t slot = tower_node_find_child_member_slot(parent, member);
+  return (slot == TOWER_INVALID_INDEX) ? TOWER_INVALID_INDEX : tower_node_get_slot_index(parent, slot);
+}
+
+const char* tower_node_get_parent_member_name(TowerNode* child) {
+  return tower_atom_get_string(tower_node_get_parent_member_atom(child));
+}
+
+TowerAtom tower_node_get_parent_member_atom(TowerNode* child) {
+  if (child->parent == nullptr) {
+    return TOWER_ATOM_NONE;
+  }
+
+  assert(child->parent->children[child->parent_slot] == child);
+  return tower_node_get_child_member_at(child->parent, child->parent_slot);
+}
+
+size_t tower_node_get_parent_child_index(TowerNode* child) {
+  if (!child->parent) {
+    return TOWER_INVALID_INDEX;
+  }
+
+  assert(child->parent->children[child->parent_slot] == child);
+  return tower_node_get_slot_index(child->parent, child->parent_slot);
+}
+
+TowerWeak* tower_node_create_weak(TowerNode* node) {
+  assert(!(node->flags & TOWER_NODE_FLAG_DESTROYED));
+  // Frozen nodes can be shared between threads, so another thread may be creating the block at the same time
+  std::atomic_ref<TowerWeak*> node_weak(node->weak);
+  TowerWeak* weak = node_weak.load(std::memory_order_acquire);
+  if (weak == nullptr) {
+    TowerWeak* created = new (tower_memory_allocate(sizeof(TowerWeak))) TowerWeak();
+    created->node = node;
+    if (node_weak.compare_exchange_strong(weak, created, std::memory_order_acq_rel, std::memory_order_acquire)) {
+      weak = created;
+      if (node->arena) {
+        tower_arena_get_records(node->arena)->weak_nodes.push_back(node);
+      }
+    } else {
+      created->~TowerWeak();
+      tower_memory_free(created);
+    }
+  }
+  return tower_weak_add_ref(weak);
+}
+
+TowerNode* tower_weak_upgrade(TowerWeak* weak) {
+  tower_weak_lock(weak);
+  TowerNode* node = weak->node;
+  // The node may have been released to zero but not yet destroyed (such as when reclamation is deferred)
+  if (node && !tower_node_try_add_ref(node)) {
+    node = nullptr;
+  }
+  tower_weak_unlock(weak);
+  return node;
+}
+
+void tower_node_freeze(TowerNode* root) {
+  assert(!(root->flags & TOWER_NODE_FLAG_FROZEN));
+  // The freeze holds the reference that pins the subtree, taken before the count stops changing
+  tower_node_add_ref(root);
+
+  std::vector<TowerNode*> stack;
+  stack.push_back(root);
+  while (!stack.empty()) {
+    TowerNode* node = stack.back();
+    stack.pop_back();
+    // A subtree can only be frozen once, otherwise thawing the outer freeze would thaw the inner one
+    assert(!(node->flags & TOWER_NODE_FLAG_FROZEN));
+
+    // Readers never have to compact, so reads never write to the node
+    tower_node_compact_children(node);
+    node->flags |= TOWER_NODE_FLAG_FROZEN;
+    for (TowerNode* child : node->children) {
+      // Shared children are already frozen by their interner
+      if (!(child->flags & TOWER_NODE_FLAG_SHARED)) {
+        stack.push_back(child);
+      }
+    }
+  }
+}
+
+void tower_node_thaw(TowerNode* root) {
+  assert(root->flags & TOWER_NODE_FLAG_FROZEN);
+
+  // Marking journaled subtrees skips frozen nodes, so the nodes are marked again while being thawed
+  struct Frame {
+    TowerNode* node;
+    bool journaled;
+  };
+  std::vector<Frame> stack;
+  stack.push_back({ root, tower_node_is_journaled_under(root, root->parent) });
+  while (!stack.empty()) {
+    Frame frame = stack.back();
+    stack.pop_back();
+    TowerNode* node = frame.node;
+    assert(node->flags & TOWER_NODE_FLAG_FROZEN);
+    node->flags &= ~(TOWER_NODE_FLAG_FROZEN | TOWER_NODE_FLAG_JOURNAL_SUBTREE);
+    if (frame.journaled) {
+      node->flags |= TOWER_NODE_FLAG_JOURNAL_SUBTREE;
+    }
+    for (TowerNode* child : node->children) {
+      if (!(child->flags & TOWER_NODE_FLAG_SHARED)) {
+        stack.push_back({ child, frame.journaled || (child->flags & TOWER_NODE_FLAG_JOURNALED) });
+      }
+    }
+  }
+
+  // This may be the last reference to the subtree
+  tower_node_release_ref(root);
+}
+
+bool tower_node_is_frozen(TowerNode* node) {
+  return (node->flags & TOWER_NODE_FLAG_FROZEN) != 0;
+}
+
+size_t tower_shape_hash(TowerNode* type, size_t capacity) {
+  // Nodes are at least 16 byte aligned so the low bits carry no information
+  return (((uintptr_t)type >> 4) * 0x9E3779B9u) & (capacity - 1);
+}
+
+size_t tower_shape_find_slot(TowerShape* shape, TowerNode* type) {
+  if (shape->capacity == 0) {
+    return TOWER_INVALID_INDEX;
+  }
+
+  TowerShapeEntry* entries = shape->entries;
+  size_t i = tower_shape_hash(type, shape->capacity);
+  while (entries[i].type != nullptr) {
+    if (entries[i].type == type) {
+      return entries[i].slot;
+    }
+    i = (i + 1) & (shape->capacity - 1);
+  }
+  return TOWER_INVALID_INDEX;
+}
+
+inline size_t tower_shape_cache_index(TowerShape* shape, TowerNode* type) {
+  return ((((uintptr_t)shape ^ ((uintptr_t)type << 2)) >> 4) * 0x9E3779B9u) % TowerShapeCache::capacity;
+}
+
+// Get (or create) the shape that results from adding a component of the type to the shape
+TowerShape* tower_shape_add_type_slow(TowerShape* shape, TowerNode* type) {
+  std::lock_guard<std::mutex> lock(tower_shape_mutex);
+  TowerShapeCache& cache = tower_shape_cache;
+  const uint64_t epoch = tower_shape_epoch.load(std::memory_order_relaxed);
+  if (cache.epoch != epoch) {
+    memset(cache.entries, 0, sizeof(cache.entries));
+    cache.epoch = epoch;
+  }
+
+  if (shape->transitions == nullptr) {
+    shape->transitions = new std::unordered_map<TowerNode*, TowerShape*>();
+  }
+  TowerShape*& next = (*shape->transitions)[type];
+  if (!next) {
+    next = new TowerShape();
+    next->component_count = shape->component_count + 1;
+    next->parent = shape;
+    next->added_type = type;
+    next->capacity = 4;
+    while (next->capacity < next->component_count * 2) {
+      next->capacity *= 2;
+    }
+    next->entries = new TowerShapeEntry[next->capacity];
+
+    // Copy all the slots from the previous shape, and the new type goes in the next slot
+    TowerShape* created = next;
+    const auto insert = [&](TowerNode* type, size_t slot) {
+      size_t i = tower_shape_hash(type, created->capacity);
+      while (created->entries[i].type != nullptr) {
+        i = (i + 1) & (created->capacity - 1);
+      }
+      created->entries[i].type = type;
+      created->entries[i].slot = slot;
+      // Types within arenas are freed with the arena without being destroyed, so their shapes are kept
+      created->entries[i].keyed = type->arena == nullptr;
+      if (created->entries[i].keyed) {
+        TowerTypeExtra* extra = tower_type_get_extra(type);
+        if (extra->shape_key == nullptr) {
+          extra->shape_key = new TowerShapeKey();
+        }
+        extra->shape_key->shapes.insert(created);
+      }
+    };
+    for (size_t i = 0; i < shape->capacity; ++i) {
+      if (shape->entries[i].type) {
+        insert(shape->entries[i].type, shape->entries[i].slot);
+      }
+    }
+    insert(type, shape->component_count);
+  }
+
+  cache.entries[tower_shape_cache_index(shape, type)] = { shape, type, next };
+  return next;
+}
+
+inline TowerShape* tower_shape_add_type(TowerShape* shape, TowerNode* type) {
+  TowerShapeCache& cache = tower_shape_cache;
+  const TowerShapeCacheEntry& entry = cache.entries[tower_shape_cache_index(shape, type)];
+  if (entry.shape == shape && entry.type == type && cache.epoch == tower_shape_epoch.load(std::memory_order_acquire)) {
+    return entry.next;
+  }
+  return tower_shape_add_type_slow(shape, type);
+}
+
+TowerComponent* tower_node_get_component(TowerNode* owner, TowerNode* type) {
+  size_t slot = tower_shape_find_slot(owner->shape, type);
+  return (slot == TOWER_INVALID_INDEX) ? nullptr : owner->components[slot];
+}
+
+void* tower_node_get_component_userdata(TowerNode* owner, TowerNode* type) {
+  TowerComponent* component = tower_node_get_component(owner, type);
+  // Writing to a component shared with the source of a clone would change the source and every other clone
+  assert(component == nullptr || component->owner == owner);
+  return tower_component_get_userdata(component);
+}
+
+const void* tower_node_get_component_userdata_for_read(TowerNode* owner, TowerNode* type) {
+  return tower_component_userdata(tower_node_get_component(owner, type));
+}
+
+size_t tower_node_get_component_count(TowerNode* owner) {
+  return owner->shape->component_count;
+}
+
+TowerComponent* tower_node_get_component_by_index(TowerNode* owner, size_t index) {
+  if (index < owner->shape->component_count) {
+    return owner->components[index];
+  }
+  return nullptr;
+}
+
+TowerComponent* const* tower_node_get_components(TowerNode* owner, size_t* count) {
+  *count = owner->shape->component_count;
+  return owner->components;
+}
+
+size_t tower_component_get_allocated_count() {
+  return tower_counter_read(TOWER_COUNTER_COMPONENTS);
+}
+
+// Allocate and construct a component owned by the node without giving it a slot in the node's shape
+TowerComponent* tower_component_allocate(
+  TowerNode* owner,
+  TowerNode* type,
+  size_t data_bytes,
+  TowerComponentDestructor destructor
+) {
+  TowerArena* arena = owner->arena;
+
+  // Place the component within the node if there's room left, otherwise it gets it's own allocation
+  void* memory = nullptr;
+  const size_t total_bytes = tower_component_get_total_bytes(data_bytes);
+  if (owner->inline_component_bytes - owner->inline_component_used >= total_bytes) {
+    memory = tower_node_get_inline_components(owner) + owner->inline_component_used;
+    owner->inline_component_used += total_bytes;
+  } else {
+    memory = tower_node_memory_allocate(arena, sizeof(TowerComponent) + data_bytes, TOWER_MEMORY_CATEGORY_COMPONENTS);
+  }
+
+  tower_counter_add(TOWER_COUNTER_COMPONENTS, 1);
+  assert(data_bytes <= UINT32_MAX);
+  TowerComponent* component = new (memory) TowerComponent();
+  component->destructor = destructor;
+  component->type = type;
+  component->owner = owner;
+  component->data_bytes = (uint32_t)data_bytes;
+  TowerComponentIndex* index = tower_type_find_index(type);
+  if (index) {
+    tower_component_index_add(index, component);
+  }
+
+  if (arena) {
+    ++arena->component_count;
+    TowerArenaRecords* records = tower_arena_get_records(arena);
+    if (destructor) {
+      records->destructible_components.push_back(component);
+    }
+    if (index) {
+      records->indexed_components.push_back(component);
+    }
+
+    // Types within the same arena live exactly as long as the arena does
+    if (type != records->last_type && type->arena != arena) {
+      if (std::find(records->types.begin(), records->types.end(), type) == records->types.end()) {
+        tower_node_add_ref(type);
+        records->types.push_back(type);
+      }
+      records->last_type = type;
+    }
+  } else {
+    tower_node_add_ref(type);
+    // Components within arenas are only counted as part of their arena's chunks
+    if (!type->arena) {
+      tower_memory_counters_change(tower_type_get_memory(type)->counters, (ptrdiff_t)tower_component_get_total_bytes(data_bytes), 1);
+    }
+  }
+  return component;
+}
 
 TowerComponent* tower_component_create(
   TowerNode* owner,
@@ -538,6 +5708,8 @@ TowerComponent* tower_component_create(
   size_t data_bytes,
   TowerComponentDestructor destructor
 ) {
+  assert(!(owner->flags & TOWER_NODE_FLAG_FROZEN));
+
   // Never add the same component twice
   TowerComponent* found_component = tower_node_get_component(owner, type);
   if (found_component) {
@@ -545,36 +5717,2119 @@ TowerComponent* tower_component_create(
     return found_component;
   }
 
-  void* memory = tower_memory_allocate(sizeof(TowerComponent) + data_bytes);
-  ++TowerComponent::allocated_count;
-  TowerComponent* component = new (memory) TowerComponent();
-  component->destructor = destructor;
-  tower_node_add_ref(type);
-  component->type = type;
-  component->owner = owner;
-  owner->components.push_back(component);
-  return component;
+  tower_node_invalidate_hash(owner);
+  tower_journal_record(TOWER_JOURNAL_COMPONENT_CREATE, owner, type, TOWER_ATOM_NONE);
+  TowerComponent* component = tower_component_allocate(owner, type, data_bytes, destructor);
+  TowerArena* arena = owner->arena;
+  const size_t slot = owner->shape->component_count;
+  if (slot == owner->component_capacity) {
+    size_t new_capacity = owner->component_capacity * 2;
+    TowerComponent** components = (TowerComponent**)tower_node_memory_allocate(arena, sizeof(TowerComponent*) * new_capacity);
+    memcpy(components, owner->components, sizeof(TowerComponent*) * slot);
+    if (owner->components != owner->inline_component_slots) {
+      tower_node_memory_free(arena, owner->components);
+    }
+    owner->components = components;
+    owner->component_capacity = new_capacity;
+  }
+  owner->components[slot] = component;
+  owner->shape = tower_shape_add_type(owner->shape, type);
+  return component;
+}
+
+TowerNode* tower_component_get_owner(TowerComponent* component) {
+  return component->owner;
+}
+
+TowerNode* tower_component_get_type(TowerComponent* component) {
+  return component->type;
+}
+
+size_t tower_component_get_data_bytes(TowerComponent* component) {
+  return component->data_bytes;
+}
+
+void* tower_component_get_userdata(TowerComponent* component) {
+  if (component == nullptr) {
+    return nullptr;
+  }
+  // The caller may write to the payload, so the owner's hash can't be trusted anymore
+  if (!(component->owner->flags & TOWER_NODE_FLAG_FROZEN)) {
+    tower_node_invalidate_hash(component->owner);
+  }
+  return tower_component_userdata(component);
+}
+
+TowerComponent* tower_component_from_userdata(void* userdata) {
+  if (userdata == nullptr) {
+    return nullptr;
+  }
+  return (TowerComponent*)((uint8_t*)userdata - sizeof(TowerComponent));
+}
+
+struct TowerTypeRecord {
+  TowerTypeInfo info;
+  std::string name;
+};
+
+// Types registered with tower_type_register, which may happen during static initialization
+struct TowerTypeRegistry {
+  std::mutex mutex;
+  std::unordered_map<TowerNode*, TowerTypeRecord> records;
+  std::unordered_map<std::string_view, TowerNode*> names;
+};
+
+TowerTypeRegistry& tower_type_registry() {
+  static TowerTypeRegistry registry;
+  return registry;
+}
+
+void tower_type_register(TowerNode* type, const TowerTypeInfo* info) {
+  assert(info->name && *info->name != '\0');
+  assert(!info->deserialize || info->data_bytes != 0);
+  TowerTypeRegistry& registry = tower_type_registry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  assert(registry.records.find(type) == registry.records.end());
+  assert(registry.names.find(info->name) == registry.names.end());
+
+  TowerTypeRecord& record = registry.records[type];
+  record.info = *info;
+  record.name = info->name;
+  record.info.name = record.name.c_str();
+  registry.names[record.name] = type;
+  // The registry keeps the type alive until it's unregistered
+  tower_node_add_ref(type);
+}
+
+void tower_type_unregister(TowerNode* type) {
+  TowerTypeRegistry& registry = tower_type_registry();
+  {
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    auto found = registry.records.find(type);
+    assert(found != registry.records.end());
+    registry.names.erase(found->second.name);
+    registry.records.erase(found);
+  }
+  tower_node_release_ref(type);
+}
+
+const TowerTypeInfo* tower_type_get_info(TowerNode* type) {
+  TowerTypeRegistry& registry = tower_type_registry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  auto found = registry.records.find(type);
+  return (found == registry.records.end()) ? nullptr : &found->second.info;
+}
+
+TowerNode* tower_type_find(const char* name) {
+  TowerTypeRegistry& registry = tower_type_registry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  auto found = registry.names.find(name);
+  return (found == registry.names.end()) ? nullptr : found->second;
+}
+
+TowerMemoryStats tower_type_get_memory_stats(TowerNode* type) {
+  TowerTypeExtra* extra = tower_type_find_extra(type);
+  TowerTypeMemory* memory = extra ? std::atomic_ref<TowerTypeMemory*>(extra->type_memory).load(std::memory_order_acquire) : nullptr;
+  return memory ? tower_memory_counters_load(memory->counters) : TowerMemoryStats {};
+}
+
+// A snapshot is a single block of memory made of the header followed by tables of fixed size entries,
+// then the strings and the component payloads. Everything refers to everything else by 32-bit offsets
+// from the start of the snapshot (or indices into the tables) so that it can be used directly from any
+// address, such as a memory mapped file. Nodes are stored breadth first, so the root is node 0 and the
+// children of each node are contiguous in the child table
+const uint32_t TOWER_SNAPSHOT_MAGIC = 0x53525754; // "TWRS"
+const uint32_t TOWER_SNAPSHOT_VERSION = 1;
+// Payloads are aligned so that they can be read in place
+const size_t TOWER_SNAPSHOT_PAYLOAD_ALIGNMENT = 16;
+
+struct TowerSnapshotHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t total_bytes;
+  uint32_t node_count;
+  uint32_t child_count;
+  uint32_t type_count;
+  uint32_t component_count;
+  uint32_t nodes_offset;
+  uint32_t children_offset;
+  uint32_t types_offset;
+  uint32_t components_offset;
+  uint32_t reserved;
+};
+
+struct TowerSnapshotNode {
+  uint32_t first_child;
+  uint32_t child_count;
+  uint32_t first_component;
+  uint32_t component_count;
+};
+
+struct TowerSnapshotChild {
+  uint32_t node;
+  // The offset of the member name, or 0 if the child has no name (nothing but the header is at 0)
+  uint32_t member;
+};
+
+struct TowerSnapshotType {
+  uint32_t name;
+};
+
+struct TowerSnapshotComponent {
+  uint32_t type;
+  uint32_t data_bytes;
+  uint32_t payload;
+  uint32_t payload_bytes;
+};
+
+// The snapshot handed out by tower_snapshot_view is the header itself
+struct TowerSnapshot : TowerSnapshotHeader {
+};
+
+struct TowerSnapshotWriter {
+  std::vector<uint8_t> payloads;
+};
+
+void tower_snapshot_writer_write(TowerSnapshotWriter* writer, const void* data, size_t bytes) {
+  writer->payloads.insert(writer->payloads.end(), (const uint8_t*)data, (const uint8_t*)data + bytes);
+}
+
+void* tower_snapshot_create(TowerNode* root, size_t* bytes) {
+  std::vector<TowerNode*> nodes;
+  std::vector<TowerSnapshotNode> node_entries;
+  std::vector<TowerSnapshotChild> child_entries;
+  std::vector<TowerSnapshotType> type_entries;
+  std::vector<TowerSnapshotComponent> component_entries;
+  std::vector<const TowerTypeInfo*> type_infos;
+  // Strings and payloads are written relative to the start of their section, and offset at the end
+  std::string strings;
+  TowerSnapshotWriter writer;
+  std::unordered_map<TowerNode*, uint32_t> type_indices;
+  std::unordered_map<TowerAtom, uint32_t> member_offsets;
+
+  const auto add_string = [&](const char* string) {
+    uint32_t offset = (uint32_t)strings.size();
+    strings.append(string);
+    strings.push_back('\0');
+    return offset;
+  };
+
+  nodes.push_back(root);
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    TowerNode* node = nodes[i];
+    TowerSnapshotNode entry = {};
+
+    // The children are read in place, skipping tombstones (and a clone's are those of it's source)
+    TowerNode* structure = tower_node_get_structure(node);
+    entry.first_child = (uint32_t)child_entries.size();
+    entry.child_count = (uint32_t)(structure->children.size() - structure->child_tombstone_count);
+    for (size_t c = 0; c < structure->children.size(); ++c) {
+      if (structure->children[c] == nullptr) {
+        continue;
+      }
+      TowerSnapshotChild child = {};
+      child.node = (uint32_t)nodes.size();
+      // Member offsets are stored as one past the offset within the strings, so that 0 means no name
+      TowerAtom member = tower_node_get_child_member_at(structure, c);
+      if (member != TOWER_ATOM_NONE) {
+        auto inserted = member_offsets.insert({member, 0});
+        if (inserted.second) {
+          inserted.first->second = add_string(tower_atom_get_string(member)) + 1;
+        }
+        child.member = inserted.first->second;
+      }
+      child_entries.push_back(child);
+      nodes.push_back(structure->children[c]);
+    }
+
+    entry.first_component = (uint32_t)component_entries.size();
+    entry.component_count = (uint32_t)node->shape->component_count;
+    for (size_t c = 0; c < node->shape->component_count; ++c) {
+      TowerComponent* component = node->components[c];
+      auto inserted = type_indices.insert({component->type, (uint32_t)type_entries.size()});
+      if (inserted.second) {
+        const TowerTypeInfo* info = tower_type_get_info(component->type);
+        // Every component type must be registered to know how to find the type again when loading
+        if (info == nullptr) {
+          return nullptr;
+        }
+        type_entries.push_back({ add_string(info->name) });
+        type_infos.push_back(info);
+      }
+      uint32_t type_index = inserted.first->second;
+
+      TowerSnapshotComponent component_entry = {};
+      component_entry.type = type_index;
+      component_entry.data_bytes = (uint32_t)component->data_bytes;
+      writer.payloads.resize(tower_align(writer.payloads.size(), TOWER_SNAPSHOT_PAYLOAD_ALIGNMENT));
+      component_entry.payload = (uint32_t)writer.payloads.size();
+      void* userdata = tower_component_userdata(component);
+      if (type_infos[type_index]->serialize) {
+        type_infos[type_index]->serialize(component, userdata, &writer);
+      } else {
+        tower_snapshot_writer_write(&writer, userdata, component->data_bytes);
+      }
+      component_entry.payload_bytes = (uint32_t)(writer.payloads.size() - component_entry.payload);
+      component_entries.push_back(component_entry);
+    }
+    node_entries.push_back(entry);
+  }
+
+  TowerSnapshotHeader header = {};
+  header.magic = TOWER_SNAPSHOT_MAGIC;
+  header.version = TOWER_SNAPSHOT_VERSION;
+  header.node_count = (uint32_t)node_entries.size();
+  header.child_count = (uint32_t)child_entries.size();
+  header.type_count = (uint32_t)type_entries.size();
+  header.component_count = (uint32_t)component_entries.size();
+
+  size_t offset = sizeof(TowerSnapshotHeader);
+  header.nodes_offset = (uint32_t)offset;
+  offset += sizeof(TowerSnapshotNode) * node_entries.size();
+  header.children_offset = (uint32_t)offset;
+  offset += sizeof(TowerSnapshotChild) * child_entries.size();
+  header.types_offset = (uint32_t)offset;
+  offset += sizeof(TowerSnapshotType) * type_entries.size();
+  header.components_offset = (uint32_t)offset;
+  offset += sizeof(TowerSnapshotComponent) * component_entries.size();
+  const size_t strings_offset = offset;
+  offset += strings.size();
+  const size_t payloads_offset = tower_align(offset, TOWER_SNAPSHOT_PAYLOAD_ALIGNMENT);
+  offset = payloads_offset + writer.payloads.size();
+  assert(offset <= UINT32_MAX);
+  header.total_bytes = (uint32_t)offset;
+
+  for (TowerSnapshotChild& child : child_entries) {
+    if (child.member != 0) {
+      child.member += (uint32_t)strings_offset - 1;
+    }
+  }
+  for (TowerSnapshotType& type : type_entries) {
+    type.name += (uint32_t)strings_offset;
+  }
+  for (TowerSnapshotComponent& component : component_entries) {
+    component.payload += (uint32_t)payloads_offset;
+  }
+
+  uint8_t* snapshot = (uint8_t*)tower_memory_allocate(offset);
+  memset(snapshot, 0, offset);
+  memcpy(snapshot, &header, sizeof(header));
+  memcpy(snapshot + header.nodes_offset, node_entries.data(), sizeof(TowerSnapshotNode) * node_entries.size());
+  memcpy(snapshot + header.children_offset, child_entries.data(), sizeof(TowerSnapshotChild) * child_entries.size());
+  memcpy(snapshot + header.types_offset, type_entries.data(), sizeof(TowerSnapshotType) * type_entries.size());
+  memcpy(snapshot + header.components_offset, component_entries.data(), sizeof(TowerSnapshotComponent) * component_entries.size());
+  memcpy(snapshot + strings_offset, strings.data(), strings.size());
+  memcpy(snapshot + payloads_offset, writer.payloads.data(), writer.payloads.size());
+  *bytes = offset;
+  return snapshot;
+}
+
+const TowerSnapshot* tower_snapshot_view(const void* data, size_t bytes) {
+  // Only the tables are validated up front, so viewing costs the same regardless of the snapshot size
+  const TowerSnapshotHeader* header = (const TowerSnapshotHeader*)data;
+  if (bytes < sizeof(TowerSnapshotHeader) || header->magic != TOWER_SNAPSHOT_MAGIC ||
+    header->version != TOWER_SNAPSHOT_VERSION || header->total_bytes > bytes || header->node_count == 0) {
+    return nullptr;
+  }
+  const auto table_fits = [&](uint32_t offset, uint32_t count, size_t entry_bytes) {
+    return offset % alignof(uint32_t) == 0 && offset <= header->total_bytes &&
+      (header->total_bytes - offset) / entry_bytes >= count;
+  };
+  if (!table_fits(header->nodes_offset, header->node_count, sizeof(TowerSnapshotNode)) ||
+    !table_fits(header->children_offset, header->child_count, sizeof(TowerSnapshotChild)) ||
+    !table_fits(header->types_offset, header->type_count, sizeof(TowerSnapshotType)) ||
+    !table_fits(header->components_offset, header->component_count, sizeof(TowerSnapshotComponent))) {
+    return nullptr;
+  }
+  return (const TowerSnapshot*)header;
+}
+
+inline const TowerSnapshotNode& tower_snapshot_get_node(const TowerSnapshot* snapshot, size_t node) {
+  assert(node < snapshot->node_count);
+  return ((const TowerSnapshotNode*)((const uint8_t*)snapshot + snapshot->nodes_offset))[node];
+}
+
+inline const TowerSnapshotChild& tower_snapshot_get_child_entry(const TowerSnapshot* snapshot, size_t node, size_t index) {
+  const TowerSnapshotNode& entry = tower_snapshot_get_node(snapshot, node);
+  assert(index < entry.child_count);
+  return ((const TowerSnapshotChild*)((const uint8_t*)snapshot + snapshot->children_offset))[entry.first_child + index];
+}
+
+inline const TowerSnapshotComponent& tower_snapshot_get_component_entry(const TowerSnapshot* snapshot, size_t node, size_t index) {
+  const TowerSnapshotNode& entry = tower_snapshot_get_node(snapshot, node);
+  assert(index < entry.component_count);
+  return ((const TowerSnapshotComponent*)((const uint8_t*)snapshot + snapshot->components_offset))[entry.first_component + index];
+}
+
+inline const char* tower_snapshot_get_string(const TowerSnapshot* snapshot, uint32_t offset) {
+  return (const char*)snapshot + offset;
+}
+
+size_t tower_snapshot_get_node_count(const TowerSnapshot* snapshot) {
+  return snapshot->node_count;
+}
+
+size_t tower_snapshot_get_child_count(const TowerSnapshot* snapshot, size_t node) {
+  return tower_snapshot_get_node(snapshot, node).child_count;
+}
+
+size_t tower_snapshot_get_child(const TowerSnapshot* snapshot, size_t node, size_t index) {
+  return tower_snapshot_get_child_entry(snapshot, node, index).node;
+}
+
+const char* tower_snapshot_get_child_member_name(const TowerSnapshot* snapshot, size_t node, size_t index) {
+  uint32_t member = tower_snapshot_get_child_entry(snapshot, node, index).member;
+  return (member == 0) ? nullptr : tower_snapshot_get_string(snapshot, member);
+}
+
+size_t tower_snapshot_get_component_count(const TowerSnapshot* snapshot, size_t node) {
+  return tower_snapshot_get_node(snapshot, node).component_count;
+}
+
+const char* tower_snapshot_get_component_type_name(const TowerSnapshot* snapshot, size_t node, size_t index) {
+  uint32_t type = tower_snapshot_get_component_entry(snapshot, node, index).type;
+  const TowerSnapshotType* types = (const TowerSnapshotType*)((const uint8_t*)snapshot + snapshot->types_offset);
+  return tower_snapshot_get_string(snapshot, types[type].name);
+}
+
+const void* tower_snapshot_get_component_payload(const TowerSnapshot* snapshot, size_t node, size_t index, size_t* bytes) {
+  const TowerSnapshotComponent& component = tower_snapshot_get_component_entry(snapshot, node, index);
+  *bytes = component.payload_bytes;
+  return (const uint8_t*)snapshot + component.payload;
+}
+
+// Check that a string lies within the snapshot and is null terminated before the end
+bool tower_snapshot_string_fits(const TowerSnapshot* snapshot, uint32_t offset) {
+  return offset < snapshot->total_bytes &&
+    memchr((const uint8_t*)snapshot + offset, '\0', snapshot->total_bytes - offset) != nullptr;
+}
+
+TowerNode* tower_snapshot_instantiate(const TowerSnapshot* snapshot, TowerArena* arena) {
+  // Resolve every type up front so that nothing is created if any type is missing
+  const TowerSnapshotType* type_entries = (const TowerSnapshotType*)((const uint8_t*)snapshot + snapshot->types_offset);
+  std::vector<TowerNode*> types(snapshot->type_count);
+  std::vector<const TowerTypeInfo*> type_infos(snapshot->type_count);
+  for (size_t i = 0; i < snapshot->type_count; ++i) {
+    if (!tower_snapshot_string_fits(snapshot, type_entries[i].name)) {
+      return nullptr;
+    }
+    types[i] = tower_type_find(tower_snapshot_get_string(snapshot, type_entries[i].name));
+    if (types[i] == nullptr) {
+      return nullptr;
+    }
+    type_infos[i] = tower_type_get_info(types[i]);
+  }
+
+  const TowerSnapshotNode* node_entries = (const TowerSnapshotNode*)((const uint8_t*)snapshot + snapshot->nodes_offset);
+  const TowerSnapshotChild* child_entries = (const TowerSnapshotChild*)((const uint8_t*)snapshot + snapshot->children_offset);
+  const TowerSnapshotComponent* component_entries =
+    (const TowerSnapshotComponent*)((const uint8_t*)snapshot + snapshot->components_offset);
+
+  // The view only checked the tables, so every entry is checked before anything is created, since the data
+  // may be truncated or corrupted (such as a memory mapped file)
+  // Children must come after their parent and every node but the root must be attached exactly once
+  std::vector<bool> attached(snapshot->node_count);
+  for (size_t i = 0; i < snapshot->node_count; ++i) {
+    const TowerSnapshotNode& entry = node_entries[i];
+    if ((uint64_t)entry.first_child + entry.child_count > snapshot->child_count ||
+      (uint64_t)entry.first_component + entry.component_count > snapshot->component_count) {
+      return nullptr;
+    }
+    for (size_t c = 0; c < entry.child_count; ++c) {
+      const TowerSnapshotChild& child = child_entries[entry.first_child + c];
+      if (child.node <= i || child.node >= snapshot->node_count || attached[child.node] ||
+        (child.member != 0 && !tower_snapshot_string_fits(snapshot, child.member))) {
+        return nullptr;
+      }
+      attached[child.node] = true;
+    }
+    const TowerSnapshotComponent* components = component_entries + entry.first_component;
+    for (size_t c = 0; c < entry.component_count; ++c) {
+      const TowerSnapshotComponent& component = components[c];
+      if (component.type >= snapshot->type_count || component.payload > snapshot->total_bytes ||
+        component.payload_bytes > snapshot->total_bytes - component.payload) {
+        return nullptr;
+      }
+      // The userdata must be the size the type expects (the same as tower_json_reader_feed)
+      const TowerTypeInfo* info = type_infos[component.type];
+      const size_t expected_bytes = info->deserialize ? info->data_bytes : component.payload_bytes;
+      if (component.data_bytes != expected_bytes || (info->data_bytes != 0 && component.data_bytes != info->data_bytes)) {
+        return nullptr;
+      }
+      // A type can only appear once per node, and two type entries may name the same type
+      for (size_t previous = 0; previous < c; ++previous) {
+        if (types[components[previous].type] == types[component.type]) {
+          return nullptr;
+        }
+      }
+    }
+  }
+  for (size_t i = 1; i < snapshot->node_count; ++i) {
+    if (!attached[i]) {
+      return nullptr;
+    }
+  }
+
+  std::vector<TowerNode*> nodes(snapshot->node_count);
+  for (size_t i = 0; i < snapshot->node_count; ++i) {
+    const TowerSnapshotNode& entry = node_entries[i];
+    const TowerSnapshotComponent* components = component_entries + entry.first_component;
+    size_t data_bytes = 0;
+    for (size_t c = 0; c < entry.component_count; ++c) {
+      data_bytes += components[c].data_bytes;
+    }
+
+    TowerNode* node = tower_node_create_with_capacity(arena, entry.component_count, data_bytes);
+    nodes[i] = node;
+    for (size_t c = 0; c < entry.component_count; ++c) {
+      const TowerSnapshotComponent& component_entry = components[c];
+      const TowerTypeInfo* info = type_infos[component_entry.type];
+      TowerComponent* component =
+        tower_component_create(node, types[component_entry.type], component_entry.data_bytes, info->destructor);
+      void* userdata = tower_component_userdata(component);
+      const uint8_t* payload = (const uint8_t*)snapshot + component_entry.payload;
+      if (info->deserialize) {
+        info->deserialize(component, userdata, payload, component_entry.payload_bytes);
+      } else {
+        memcpy(userdata, payload, component_entry.data_bytes);
+      }
+    }
+  }
+
+  // Children always come after their parent, so every node but the root is attached exactly once
+  for (size_t i = 0; i < snapshot->node_count; ++i) {
+    const TowerSnapshotNode& entry = node_entries[i];
+    TowerNode* node = nodes[i];
+    node->children.reserve(entry.child_count);
+    for (size_t c = 0; c < entry.child_count; ++c) {
+      const TowerSnapshotChild& child = child_entries[entry.first_child + c];
+      TowerAtom member = (child.member == 0) ? TOWER_ATOM_NONE : tower_atom_intern(tower_snapshot_get_string(snapshot, child.member));
+      tower_node_attach_member_atom(nodes[child.node], node, member);
+      tower_node_release_ref(nodes[child.node]);
+    }
+  }
+  return nodes[0];
+}
+
+TowerNode* tower_node_clone_cow(TowerNode* source, TowerArena* arena) {
+  // Sharing is only safe while the source can't change underneath the clone
+  assert(source->flags & TOWER_NODE_FLAG_FROZEN);
+
+  // The components are shared, so the clone only needs room for the ones that are later written to
+  TowerNode* node = tower_node_create_with_capacity(arena, 0, 0);
+  tower_node_add_frozen_ref(source);
+  tower_node_get_extra(node)->cow_source = source;
+  if (arena) {
+    tower_arena_get_records(arena)->clone_nodes.push_back(node);
+  }
+  const size_t component_count = source->shape->component_count;
+  if (component_count > node->component_capacity) {
+    node->components = (TowerComponent**)tower_node_memory_allocate(arena, sizeof(TowerComponent*) * component_count);
+    node->component_capacity = component_count;
+  }
+  memcpy(node->components, source->components, sizeof(TowerComponent*) * component_count);
+  node->shape = source->shape;
+  // The clone has the same structure, so it shares the source's hash if it has been computed
+  tower_node_store_hash(node, tower_node_load_hash(source));
+
+  // Children are cloned a level at a time, only once something looks at them
+  if (!source->children.empty()) {
+    node->flags |= TOWER_NODE_FLAG_COW_CHILDREN;
+  }
+  return node;
+}
+
+void tower_node_release_unused_cow_source(TowerNode* node);
+
+// Give a clone children of it's own, which are themselves clones of the source's children
+void tower_node_materialize_children(TowerNode* node) {
+  node->flags &= ~TOWER_NODE_FLAG_COW_CHILDREN;
+  // The new children were never labeled
+  tower_node_invalidate_labels(node);
+  TowerNode* source = node->extra->cow_source;
+  // Frozen nodes are always compacted, so there are no tombstones to skip
+  const size_t count = source->children.size();
+  node->children.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    // The clone's only reference is the one the parent holds, the same as after attaching and releasing it
+    TowerNode* child = tower_node_clone_cow(source->children[i], node->arena);
+    child->parent = node;
+    child->parent_slot = i;
+    // The clone has no children of its own yet, so only it needs to be marked
+    child->flags |= node->flags & TOWER_NODE_FLAG_JOURNAL_SUBTREE;
+    node->children[i] = child;
+  }
+
+  if (source->named_child_count != 0) {
+    node->child_members.assign(source->child_members.begin(), source->child_members.end());
+    node->named_child_count = source->named_child_count;
+    tower_node_rebuild_member_index(node);
+  }
+  tower_node_release_unused_cow_source(node);
+}
+
+// Once a clone has it's own children and components, it no longer needs it's source
+void tower_node_release_unused_cow_source(TowerNode* node) {
+  if (node->flags & TOWER_NODE_FLAG_COW_CHILDREN) {
+    return;
+  }
+  for (size_t i = 0; i < node->shape->component_count; ++i) {
+    if (node->components[i]->owner != node) {
+      return;
+    }
+  }
+  TowerNode* source = node->extra->cow_source;
+  if (tower_node_drop_cow_source(node)) {
+    tower_node_release_destroy(source);
+  }
+}
+
+TowerComponent* tower_node_get_component_for_write(TowerNode* owner, TowerNode* type) {
+  assert(!(owner->flags & TOWER_NODE_FLAG_FROZEN));
+  size_t slot = tower_shape_find_slot(owner->shape, type);
+  if (slot == TOWER_INVALID_INDEX) {
+    return nullptr;
+  }
+  // The caller is about to change the payload
+  tower_node_invalidate_hash(owner);
+  tower_journal_record(TOWER_JOURNAL_COMPONENT_WRITE, owner, type, TOWER_ATOM_NONE);
+  TowerComponent* shared = owner->components[slot];
+  if (shared->owner == owner) {
+    return shared;
+  }
+
+  // Components that hold onto resources must be registered so that they know how to be copied
+  const TowerTypeInfo* info = tower_type_get_info(type);
+  assert(info || shared->destructor == nullptr);
+
+  TowerComponent* component = tower_component_allocate(owner, type, shared->data_bytes, shared->destructor);
+  void* userdata = tower_component_userdata(component);
+  void* shared_userdata = tower_component_userdata(shared);
+  if (info && (info->serialize || info->deserialize)) {
+    // Copy through the same serializers that snapshots use
+    TowerSnapshotWriter writer;
+    if (info->serialize) {
+      info->serialize(shared, shared_userdata, &writer);
+    } else {
+      tower_snapshot_writer_write(&writer, shared_userdata, shared->data_bytes);
+    }
+    if (info->deserialize) {
+      info->deserialize(component, userdata, writer.payloads.data(), writer.payloads.size());
+    } else {
+      assert(writer.payloads.size() == shared->data_bytes);
+      memcpy(userdata, writer.payloads.data(), shared->data_bytes);
+    }
+  } else {
+    memcpy(userdata, shared_userdata, shared->data_bytes);
+  }
+
+  // The slot stays the same, so the shape doesn't change
+  owner->components[slot] = component;
+  tower_node_release_unused_cow_source(owner);
+  return component;
+}
+
+inline uint64_t tower_hash_mix(uint64_t hash, uint64_t value) {
+  hash ^= value + 0x9E3779B97F4A7C15ull + (hash << 6) + (hash >> 2);
+  return hash * 0xFF51AFD7ED558CCDull;
+}
+
+uint64_t tower_hash_bytes(const uint8_t* data, size_t bytes) {
+  uint64_t hash = bytes;
+  size_t i = 0;
+  for (; i + 8 <= bytes; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, 8);
+    hash = tower_hash_mix(hash, word);
+  }
+  if (i != bytes) {
+    uint64_t word = 0;
+    memcpy(&word, data + i, bytes - i);
+    hash = tower_hash_mix(hash, word);
+  }
+  return hash;
+}
+
+// The bytes that identify a component's payload, which are serialized for types that have a serializer
+// (such as payloads that point to their data) and are otherwise the payload itself
+const uint8_t* tower_component_get_payload(TowerComponent* component, const TowerTypeInfo* info, TowerSnapshotWriter* scratch, size_t* bytes) {
+  void* userdata = tower_component_userdata(component);
+  if (info && info->serialize) {
+    scratch->payloads.clear();
+    info->serialize(component, userdata, scratch);
+    *bytes = scratch->payloads.size();
+    return scratch->payloads.data();
+  }
+  *bytes = component->data_bytes;
+  return (const uint8_t*)userdata;
+}
+
+// Looks up the registered info of component types, remembering the last one since neighbors tend to share types
+struct TowerTypeInfoCache {
+  TowerNode* type = nullptr;
+  const TowerTypeInfo* info = nullptr;
+
+  const TowerTypeInfo* get(TowerNode* type_node) {
+    if (type_node != type) {
+      type = type_node;
+      info = tower_type_get_info(type_node);
+    }
+    return info;
+  }
+};
+
+uint64_t tower_node_hash(TowerNode* root) {
+  const uint64_t cached = tower_node_load_hash(root);
+  if (cached != 0) {
+    return cached;
+  }
+
+  struct Frame {
+    TowerNode* node;
+    size_t next_child;
+  };
+  std::vector<Frame> stack;
+  TowerSnapshotWriter scratch;
+  TowerTypeInfoCache infos;
+  stack.push_back({ root, 0 });
+  while (!stack.empty()) {
+    Frame& frame = stack.back();
+    TowerNode* structure = tower_node_get_structure(frame.node);
+
+    // Descend into the next child whose hash is out of date
+    bool descended = false;
+    while (frame.next_child < structure->children.size()) {
+      TowerNode* child = structure->children[frame.next_child++];
+      if (child && tower_node_load_hash(child) == 0) {
+        stack.push_back({ child, 0 });
+        descended = true;
+        break;
+      }
+    }
+    if (descended) {
+      continue;
+    }
+
+    TowerNode* node = frame.node;
+    stack.pop_back();
+
+    // Components are combined without regard to order, since the order they were added in isn't structure
+    uint64_t component_sum = 0;
+    const size_t component_count = node->shape->component_count;
+    for (size_t i = 0; i < component_count; ++i) {
+      TowerComponent* component = node->components[i];
+      size_t bytes = 0;
+      const uint8_t* payload = tower_component_get_payload(component, infos.get(component->type), &scratch, &bytes);
+      component_sum += tower_hash_mix(component->type->id, tower_hash_bytes(payload, bytes));
+    }
+    uint64_t hash = tower_hash_mix(component_count, component_sum);
+
+    size_t child_count = 0;
+    for (size_t slot = 0; slot < structure->children.size(); ++slot) {
+      TowerNode* child = structure->children[slot];
+      if (child) {
+        hash = tower_hash_mix(hash, tower_node_get_child_member_at(structure, slot));
+        hash = tower_hash_mix(hash, tower_node_load_hash(child));
+        ++child_count;
+      }
+    }
+    hash = tower_hash_mix(hash, child_count);
+    // 0 marks a hash that hasn't been computed
+    tower_node_store_hash(node, hash != 0 ? hash : 1);
+  }
+  return tower_node_load_hash(root);
+}
+
+// Compare two components of the same type by their payloads
+bool tower_component_equal(TowerComponent* a, TowerComponent* b, const TowerTypeInfo* info, TowerSnapshotWriter* scratch_a, TowerSnapshotWriter* scratch_b) {
+  if (a == b) {
+    return true;
+  }
+  size_t a_bytes = 0;
+  size_t b_bytes = 0;
+  const uint8_t* a_payload = tower_component_get_payload(a, info, scratch_a, &a_bytes);
+  const uint8_t* b_payload = tower_component_get_payload(b, info, scratch_b, &b_bytes);
+  return a_bytes == b_bytes && memcmp(a_payload, b_payload, a_bytes) == 0;
+}
+
+bool tower_node_equal(TowerNode* a, TowerNode* b) {
+  if (a == b) {
+    return true;
+  }
+  // Different hashes are the common case, and equal hashes are confirmed by comparing the structure
+  if (tower_node_hash(a) != tower_node_hash(b)) {
+    return false;
+  }
+
+  std::vector<std::pair<TowerNode*, TowerNode*>> stack;
+  TowerSnapshotWriter scratch_a;
+  TowerSnapshotWriter scratch_b;
+  TowerTypeInfoCache infos;
+  stack.push_back({ a, b });
+  while (!stack.empty()) {
+    auto [node_a, node_b] = stack.back();
+    stack.pop_back();
+    // Shared subtrees (such as those of clones) are equal without looking any further
+    if (node_a == node_b) {
+      continue;
+    }
+    // Every node below has a valid hash, so most differences are still caught without comparing payloads
+    if (tower_node_load_hash(node_a) != tower_node_load_hash(node_b) || node_a->shape->component_count != node_b->shape->component_count) {
+      return false;
+    }
+
+    for (size_t i = 0; i < node_a->shape->component_count; ++i) {
+      TowerComponent* component_a = node_a->components[i];
+      TowerComponent* component_b = tower_node_get_component(node_b, component_a->type);
+      if (!component_b || !tower_component_equal(component_a, component_b, infos.get(component_a->type), &scratch_a, &scratch_b)) {
+        return false;
+      }
+    }
+
+    // Walk both children together, skipping tombstones
+    TowerNode* structure_a = tower_node_get_structure(node_a);
+    TowerNode* structure_b = tower_node_get_structure(node_b);
+    size_t slot_a = 0;
+    size_t slot_b = 0;
+    for (;;) {
+      while (slot_a < structure_a->children.size() && !structure_a->children[slot_a]) {
+        ++slot_a;
+      }
+      while (slot_b < structure_b->children.size() && !structure_b->children[slot_b]) {
+        ++slot_b;
+      }
+      bool a_done = slot_a == structure_a->children.size();
+      bool b_done = slot_b == structure_b->children.size();
+      if (a_done || b_done) {
+        if (a_done != b_done) {
+          return false;
+        }
+        break;
+      }
+      if (tower_node_get_child_member_at(structure_a, slot_a) != tower_node_get_child_member_at(structure_b, slot_b)) {
+        return false;
+      }
+      stack.push_back({ structure_a->children[slot_a], structure_b->children[slot_b] });
+      ++slot_a;
+      ++slot_b;
+    }
+  }
+  return true;
+}
+
+struct TowerInterner {
+  // Canonical nodes by their structural hash, where nodes with the same hash are compared to each other
+  std::unordered_multimap<uint64_t, TowerNode*> table;
+  // Canonical nodes in the order they were interned, which always puts children before their parents
+  std::vector<TowerNode*> nodes;
+};
+
+TowerInterner* tower_interner_create() {
+  return new (tower_memory_allocate(sizeof(TowerInterner))) TowerInterner();
+}
+
+void tower_interner_destroy(TowerInterner* interner) {
+  // Nodes that are still held by trees (or other shared nodes) live on until those release them
+  for (TowerNode* node : interner->nodes) {
+    if (tower_node_drop_shared_ref(node)) {
+      tower_node_release_destroy(node);
+    }
+  }
+  interner->~TowerInterner();
+  tower_memory_free(interner);
+}
+
+TowerNode* tower_interner_intern(TowerInterner* interner, TowerNode* root) {
+  assert(root->parent == nullptr);
+  if (root->flags & TOWER_NODE_FLAG_SHARED) {
+    return root;
+  }
+
+  struct Frame {
+    TowerNode* node;
+    size_t next_child;
+  };
+  std::vector<Frame> stack;
+  TowerNode* canonical = nullptr;
+  tower_node_compact_children(root);
+  stack.push_back({ root, 0 });
+  while (!stack.empty()) {
+    // Children are interned before their parents, so that parents are compared by their canonical children
+    Frame& frame = stack.back();
+    bool descended = false;
+    while (frame.next_child < frame.node->children.size()) {
+      TowerNode* child = frame.node->children[frame.next_child++];
+      if (!(child->flags & TOWER_NODE_FLAG_SHARED)) {
+        tower_node_compact_children(child);
+        stack.push_back({ child, 0 });
+        descended = true;
+        break;
+      }
+    }
+    if (descended) {
+      continue;
+    }
+
+    TowerNode* node = stack.back().node;
+    stack.pop_back();
+    // Shared nodes can't have components that belong to another node or live in an arena
+    assert(!(node->flags & TOWER_NODE_FLAG_FROZEN));
+    assert(node->arena == nullptr);
+
+    canonical = nullptr;
+    const uint64_t hash = tower_node_hash(node);
+    auto range = interner->table.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (tower_node_equal(it->second, node)) {
+        canonical = it->second;
+        break;
+      }
+    }
+
+    // The parent's reference to a new canonical node becomes the reference for it's slot, and the
+    // interner takes one of it's own (the caller's reference to the root is handed to the interner)
+    // Duplicates are released, and their slot holds a reference to the canonical node instead
+    TowerNode* parent = node->parent;
+    if (parent) {
+      parent->children[node->parent_slot] = canonical ? canonical : node;
+      node->parent = nullptr;
+      node->parent_slot = TOWER_INVALID_INDEX;
+    }
+    if (canonical) {
+      if (parent) {
+        tower_node_add_frozen_ref(canonical);
+      }
+      tower_node_release_ref(node);
+    } else {
+      canonical = node;
+      if (parent) {
+        tower_node_add_ref(node);
+      }
+      node->flags |= TOWER_NODE_FLAG_SHARED;
+      tower_node_freeze(node);
+      interner->table.emplace(hash, node);
+      interner->nodes.push_back(node);
+    }
+  }
+  return canonical;
+}
+
+size_t tower_interner_get_node_count(TowerInterner* interner) {
+  return interner->nodes.size();
+}
+
+bool tower_node_is_shared(TowerNode* node) {
+  return (node->flags & TOWER_NODE_FLAG_SHARED) != 0;
+}
+
+// The children of a node on the stack can't change (only those of the node last returned), so the
+// frame walks them directly
+struct TowerCursorFrame {
+  TowerNode* node;
+  TowerNode* const* next;
+  TowerNode* const* end;
+};
+
+struct TowerCursor {
+  TowerCursorOrder order;
+  TowerNode* type;
+  // The root until it has been visited
+  TowerNode* pending = nullptr;
+  // The node last returned by tower_cursor_next, whose children pre-order visits next
+  TowerNode* current = nullptr;
+  // Pre and post order walk down through a stack of the nodes whose children are being visited
+  std::vector<TowerCursorFrame> stack;
+  // Level order visits nodes from a queue instead, which is consumed from the front
+  std::vector<TowerNode*> queue;
+  size_t queue_head = 0;
+};
+
+TowerCursor* tower_cursor_create(TowerNode* root, TowerCursorOrder order, TowerNode* type) {
+  TowerCursor* cursor = new (tower_memory_allocate(sizeof(TowerCursor))) TowerCursor();
+  cursor->order = order;
+  cursor->type = type;
+  tower_cursor_reset(cursor, root);
+  return cursor;
+}
+
+void tower_cursor_destroy(TowerCursor* cursor) {
+  cursor->~TowerCursor();
+  tower_memory_free(cursor);
+}
+
+void tower_cursor_reset(TowerCursor* cursor, TowerNode* root) {
+  cursor->pending = root;
+  cursor->current = nullptr;
+  cursor->stack.clear();
+  cursor->queue.clear();
+  cursor->queue_head = 0;
+}
+
+// Called once a node has been reached, to make sure it's children are ready to be read and to start
+// loading the array of them (tombstones are skipped as they're reached)
+inline void tower_cursor_enter(TowerNode* node) {
+  // The nodes handed out can be written, so a clone's children have to be it's own
+  if (node->flags & TOWER_NODE_FLAG_COW_CHILDREN) {
+    tower_node_materialize_children(node);
+  }
+  if (!node->children.empty()) {
+    __builtin_prefetch(node->children.data());
+  }
+}
+
+inline bool tower_cursor_matches(TowerCursor* cursor, TowerNode* node) {
+  return cursor->type == nullptr || tower_shape_find_slot(node->shape, cursor->type) != TOWER_INVALID_INDEX;
+}
+
+// How many nodes ahead to start loading, since visiting a leaf takes much less time than loading one
+// Nodes are loaded first, then the components they point to once they have arrived
+const size_t TOWER_CURSOR_PREFETCH_DISTANCE = 8;
+const size_t TOWER_CURSOR_PREFETCH_COMPONENT_DISTANCE = 4;
+
+// The prefetch helpers are always inlined, since GCC otherwise sees a function that only prefetches
+// as having no effect and drops the call entirely
+
+// A visit reads the start of the node up to it's children (which may straddle three cache lines)
+__attribute__((always_inline)) inline void tower_cursor_prefetch_node(TowerNode* node) {
+  __builtin_prefetch(node);
+  __builtin_prefetch((const uint8_t*)node + 64);
+  __builtin_prefetch(&node->member_index);
+}
+
+// Start loading the nodes ahead of the next one to visit (which may be tombstones), and the first
+// component of nodes that were loaded earlier, which is usually what's read from a node once visited
+// A stale pointer beyond the node's components is harmless to prefetch
+__attribute__((always_inline)) inline void tower_cursor_prefetch_ahead(TowerNode* const* next, TowerNode* const* end) {
+  if (end - next > (ptrdiff_t)TOWER_CURSOR_PREFETCH_DISTANCE && next[TOWER_CURSOR_PREFETCH_DISTANCE]) {
+    tower_cursor_prefetch_node(next[TOWER_CURSOR_PREFETCH_DISTANCE]);
+  }
+  if (end - next > (ptrdiff_t)TOWER_CURSOR_PREFETCH_COMPONENT_DISTANCE && next[TOWER_CURSOR_PREFETCH_COMPONENT_DISTANCE]) {
+    __builtin_prefetch(next[TOWER_CURSOR_PREFETCH_COMPONENT_DISTANCE]->components[0]);
+  }
+}
+
+// Take the next child of the frame (which may be a tombstone), starting to load the siblings further ahead
+inline TowerNode* tower_cursor_take_child(TowerCursorFrame& frame) {
+  tower_cursor_prefetch_ahead(frame.next, frame.end);
+  return *frame.next++;
+}
+
+void tower_cursor_push_frame(TowerCursor* cursor, TowerNode* node) {
+  TowerNode* const* children = node->children.data();
+  const size_t count = node->children.size();
+  for (size_t i = 0; i < TOWER_CURSOR_PREFETCH_DISTANCE && i < count; ++i) {
+    if (children[i]) {
+      tower_cursor_prefetch_node(children[i]);
+    }
+  }
+  cursor->stack.push_back({ node, children, children + count });
+}
+
+// Start visiting the children of a node, if it has any (most nodes are leaves, so they stay inline)
+inline void tower_cursor_push(TowerCursor* cursor, TowerNode* node) {
+  tower_cursor_enter(node);
+  if (!node->children.empty()) {
+    tower_cursor_push_frame(cursor, node);
+  }
+}
+
+TowerNode* tower_cursor_next_pre_order(TowerCursor* cursor) {
+  TowerNode* node = nullptr;
+  if (cursor->pending) {
+    node = cursor->pending;
+    cursor->pending = nullptr;
+  } else if (cursor->current) {
+    // The children of the node last returned are only looked at now, since they may have changed since
+    tower_cursor_push(cursor, cursor->current);
+  }
+
+  for (;;) {
+    if (node) {
+      if (tower_cursor_matches(cursor, node)) {
+        return node;
+      }
+      tower_cursor_push(cursor, node);
+    }
+
+    if (cursor->stack.empty()) {
+      return nullptr;
+    }
+    TowerCursorFrame& frame = cursor->stack.back();
+    if (frame.next == frame.end) {
+      cursor->stack.pop_back();
+      node = nullptr;
+      continue;
+    }
+    // The children of the last node returned may have been detached, leaving tombstones behind
+    node = tower_cursor_take_child(frame);
+  }
+}
+
+TowerNode* tower_cursor_next_post_order(TowerCursor* cursor) {
+  if (cursor->pending) {
+    TowerNode* root = cursor->pending;
+    cursor->pending = nullptr;
+    tower_cursor_push(cursor, root);
+    if (cursor->stack.empty() && tower_cursor_matches(cursor, root)) {
+      return root;
+    }
+  }
+
+  while (!cursor->stack.empty()) {
+    TowerCursorFrame& frame = cursor->stack.back();
+    if (frame.next != frame.end) {
+      // Keep going down until reaching a node whose children have all been visited, where leaves are
+      // visited without ever being pushed
+      TowerNode* child = tower_cursor_take_child(frame);
+      if (child == nullptr) {
+        continue;
+      }
+      size_t stack_size = cursor->stack.size();
+      tower_cursor_push(cursor, child);
+      if (cursor->stack.size() == stack_size && tower_cursor_matches(cursor, child)) {
+        return child;
+      }
+      continue;
+    }
+
+    TowerNode* node = frame.node;
+    cursor->stack.pop_back();
+    if (tower_cursor_matches(cursor, node)) {
+      return node;
+    }
+  }
+  return nullptr;
 }
 
-TowerNode* tower_component_get_owner(TowerComponent* component) {
-  return component->owner;
+TowerNode* tower_cursor_next_level_order(TowerCursor* cursor) {
+  auto& queue = cursor->queue;
+  if (cursor->pending) {
+    queue.push_back(cursor->pending);
+    cursor->pending = nullptr;
+  }
+
+  while (cursor->queue_head < queue.size()) {
+    // Drop the visited nodes from the front once they are most of the queue, so that the queue only
+    // grows with the width of the tree
+    if (cursor->queue_head >= 4096 && cursor->queue_head * 2 >= queue.size()) {
+      queue.erase(queue.begin(), queue.begin() + cursor->queue_head);
+      cursor->queue_head = 0;
+    }
+
+    // The queue never holds tombstones
+    tower_cursor_prefetch_ahead(queue.data() + cursor->queue_head, queue.data() + queue.size());
+    TowerNode* node = queue[cursor->queue_head++];
+    tower_cursor_enter(node);
+    if (node->child_tombstone_count == 0) {
+      queue.insert(queue.end(), node->children.begin(), node->children.end());
+    } else {
+      for (TowerNode* child : node->children) {
+        if (child) {
+          queue.push_back(child);
+        }
+      }
+    }
+    if (tower_cursor_matches(cursor, node)) {
+      return node;
+    }
+  }
+  return nullptr;
 }
 
-TowerNode* tower_component_get_type(TowerComponent* component) {
-  return component->type;
+TowerNode* tower_cursor_next(TowerCursor* cursor) {
+  TowerNode* node = nullptr;
+  switch (cursor->order) {
+    case TOWER_CURSOR_PRE_ORDER:
+      node = tower_cursor_next_pre_order(cursor);
+      break;
+    case TOWER_CURSOR_POST_ORDER:
+      node = tower_cursor_next_post_order(cursor);
+      break;
+    case TOWER_CURSOR_LEVEL_ORDER:
+      node = tower_cursor_next_level_order(cursor);
+      break;
+  }
+  cursor->current = node;
+  return node;
 }
 
-void* tower_component_get_userdata(TowerComponent* component) {
-  if (component == nullptr) {
-    return nullptr;
+void tower_cursor_skip_children(TowerCursor* cursor) {
+  assert(cursor->order == TOWER_CURSOR_PRE_ORDER);
+  // The children of the current node are only pushed by the next call
+  cursor->current = nullptr;
+}
+
+void tower_type_set_indexed(TowerNode* type, bool indexed) {
+  // Arenas release their nodes without destroying them one by one, which would leak the index
+  assert(type->arena == nullptr);
+  if (indexed == (tower_type_find_index(type) != nullptr)) {
+    return;
+  }
+  if (indexed) {
+    tower_type_get_extra(type)->component_index = new (tower_memory_allocate(sizeof(TowerComponentIndex))) TowerComponentIndex();
+  } else {
+    tower_type_destroy_index(type);
   }
-  return ((uint8_t*)component) + sizeof(TowerComponent);
 }
 
-TowerComponent* tower_component_from_userdata(void* userdata) {
-  if (userdata == nullptr) {
-    return nullptr;
+bool tower_type_get_indexed(TowerNode* type) {
+  return tower_type_find_index(type) != nullptr;
+}
+
+void tower_type_destroy_index(TowerNode* type) {
+  TowerComponentIndex* index = type->type_extra->component_index;
+  for (TowerComponent* component : index->components) {
+    component->index_slot = TOWER_COMPONENT_NOT_INDEXED;
   }
-  return (TowerComponent*)((uint8_t*)userdata - sizeof(TowerComponent));
+  type->type_extra->component_index = nullptr;
+  index->~TowerComponentIndex();
+  tower_memory_free(index);
+}
+
+TowerComponent* const* tower_type_get_components(TowerNode* type, size_t* count) {
+  TowerComponentIndex* index = tower_type_find_index(type);
+  assert(index);
+  std::lock_guard<std::mutex> lock(index->mutex);
+  *count = index->components.size();
+  return index->components.data();
+}
+
+// Labels are handed out from one counter so that subtrees labeled at different times never overlap
+std::mutex tower_label_mutex;
+uint64_t tower_label_next = 1;
+// Changes whenever any labels do, so that indexes know to sort again
+uint64_t tower_label_epoch = 0;
+
+// Give every node of the subtree new pre-order labels, so that a node is within a subtree exactly when
+// it's enter label is between the enter and exit labels of the subtree's root
+// Shared nodes are within many subtrees and children of clones that haven't been cloned yet belong
+// to the source, so neither are labeled (and their components are never found within a subtree)
+void tower_node_label(TowerNode* root) {
+  ++tower_label_epoch;
+
+  struct Frame {
+    TowerNode* node;
+    size_t next_child;
+  };
+  std::vector<Frame> stack;
+  tower_node_get_extra(root)->label_enter = tower_label_next++;
+  stack.push_back({ root, 0 });
+  while (!stack.empty()) {
+    Frame& frame = stack.back();
+    auto& children = frame.node->children;
+    if (frame.next_child < children.size()) {
+      TowerNode* child = children[frame.next_child++];
+      if (child && !(child->flags & TOWER_NODE_FLAG_SHARED)) {
+        tower_node_get_extra(child)->label_enter = tower_label_next++;
+        stack.push_back({ child, 0 });
+      }
+      continue;
+    }
+    frame.node->extra->label_exit = tower_label_next - 1;
+    stack.pop_back();
+  }
+}
+
+TowerComponent* const* tower_type_get_subtree_components(TowerNode* type, TowerNode* root, size_t* count) {
+  TowerComponentIndex* index = tower_type_find_index(type);
+  assert(index);
+  std::lock_guard<std::mutex> label_lock(tower_label_mutex);
+  // Valid labels mean nothing within the subtree has moved since it was labeled
+  if (tower_node_get_label_exit(root) == 0) {
+    tower_node_label(root);
+  }
+
+  std::lock_guard<std::mutex> lock(index->mutex);
+  auto& components = index->components;
+  if (index->sorted_epoch != tower_label_epoch) {
+    std::sort(components.begin(), components.end(), [](TowerComponent* a, TowerComponent* b) {
+      return tower_node_get_label_enter(a->owner) < tower_node_get_label_enter(b->owner);
+    });
+    for (size_t i = 0; i < components.size(); ++i) {
+      components[i]->index_slot = (uint32_t)i;
+    }
+    index->sorted_epoch = tower_label_epoch;
+  }
+
+  // Owners that were labeled within the range are still within the subtree, otherwise it's labels wouldn't be valid
+  const TowerNodeExtra* labels = root->extra;
+  auto first = std::lower_bound(components.begin(), components.end(), labels->label_enter,
+    [](TowerComponent* component, uint64_t label) { return tower_node_get_label_enter(component->owner) < label; });
+  auto last = std::upper_bound(first, components.end(), labels->label_exit,
+    [](uint64_t label, TowerComponent* component) { return label < tower_node_get_label_enter(component->owner); });
+  *count = last - first;
+  return components.data() + (first - components.begin());
+}
+
+TowerJournal* tower_journal_create(TowerNode* root, size_t capacity) {
+  assert(!(root->flags & TOWER_NODE_FLAG_FROZEN));
+  assert(capacity != 0);
+  TowerJournal* journal = new (tower_memory_allocate(sizeof(TowerJournal))) TowerJournal();
+  journal->root = root;
+  size_t ring_capacity = 1;
+  while (ring_capacity < capacity) {
+    ring_capacity *= 2;
+  }
+  journal->entries.resize(ring_capacity);
+  tower_node_add_ref(root);
+
+  tower_node_mark_journaled(root, true);
+  std::lock_guard<std::mutex> lock(tower_journal_mutex);
+  root->flags |= TOWER_NODE_FLAG_JOURNALED;
+  tower_journals.push_back(journal);
+  ++tower_journal_count;
+  return journal;
+}
+
+void tower_journal_destroy(TowerJournal* journal) {
+  TowerNode* root = journal->root;
+  bool last = false;
+  {
+    std::lock_guard<std::mutex> lock(tower_journal_mutex);
+    tower_journals.erase(std::find(tower_journals.begin(), tower_journals.end(), journal));
+    --tower_journal_count;
+    // Other journals may have the same root
+    last = std::none_of(tower_journals.begin(), tower_journals.end(), [&](TowerJournal* other) { return other->root == root; });
+    if (last) {
+      root->flags &= ~TOWER_NODE_FLAG_JOURNALED;
+    }
+  }
+  // The subtree may still be within a journal further up
+  if (last && !tower_node_is_journaled_under(root, root->parent)) {
+    tower_node_mark_journaled(root, false);
+  }
+  journal->~TowerJournal();
+  tower_memory_free(journal);
+  tower_node_release_ref(root);
+}
+
+size_t tower_journal_drain(TowerJournal* journal, TowerJournalEntry* entries, size_t max_count, size_t* dropped) {
+  std::lock_guard<std::mutex> lock(tower_journal_mutex);
+  const uint64_t capacity = journal->entries.size();
+  const size_t count = (size_t)std::min<uint64_t>(journal->write - journal->read, max_count);
+  for (size_t i = 0; i < count; ++i) {
+    entries[i] = journal->entries[journal->read++ & (capacity - 1)];
+  }
+  if (dropped) {
+    *dropped = journal->dropped;
+  }
+  journal->dropped = 0;
+  return count;
+}
+
+// Writes JSON into a fixed size buffer that is handed to the flush callback whenever it fills up
+struct TowerJsonOutput {
+  TowerJsonFlush flush;
+  void* userdata;
+  uint8_t* buffer;
+  size_t capacity;
+  size_t used = 0;
+
+  void flush_buffer() {
+    if (used != 0) {
+      flush(buffer, used, userdata);
+      used = 0;
+    }
+  }
+
+  void write(char c) {
+    if (used == capacity) {
+      flush_buffer();
+    }
+    buffer[used++] = (uint8_t)c;
+  }
+
+  void write(const char* data, size_t length) {
+    while (length != 0) {
+      if (used == capacity) {
+        flush_buffer();
+      }
+      size_t count = std::min(length, capacity - used);
+      memcpy(buffer + used, data, count);
+      used += count;
+      data += count;
+      length -= count;
+    }
+  }
+
+  void write_string(const char* string) {
+    static const char hex_digits[] = "0123456789abcdef";
+    write('"');
+    for (const char* c = string; *c; ++c) {
+      uint8_t byte = (uint8_t)*c;
+      if (byte == '"' || byte == '\\') {
+        write('\\');
+        write((char)byte);
+      } else if (byte < 0x20) {
+        write("\\u00", 4);
+        write(hex_digits[byte >> 4]);
+        write(hex_digits[byte & 0xF]);
+      } else {
+        write((char)byte);
+      }
+    }
+    write('"');
+  }
+
+  void write_hex(const uint8_t* data, size_t length) {
+    static const char hex_digits[] = "0123456789abcdef";
+    write('"');
+    for (size_t i = 0; i < length; ++i) {
+      if (capacity - used < 2) {
+        flush_buffer();
+      }
+      buffer[used++] = (uint8_t)hex_digits[data[i] >> 4];
+      buffer[used++] = (uint8_t)hex_digits[data[i] & 0xF];
+    }
+    write('"');
+  }
+
+  void write_number(size_t number) {
+    char digits[32];
+    int length = snprintf(digits, sizeof(digits), "%zu", number);
+    write(digits, (size_t)length);
+  }
+};
+
+// Each node is an object, where every key is optional:
+// {"member":"name","components":{"type name":[data_bytes,"hex payload"]},"children":[...]}
+bool tower_json_write(TowerNode* root, TowerJsonFlush flush, void* userdata, size_t buffer_size) {
+  assert(buffer_size >= 2);
+  TowerJsonOutput output;
+  output.flush = flush;
+  output.userdata = userdata;
+  output.buffer = (uint8_t*)tower_memory_allocate(buffer_size);
+  output.capacity = buffer_size;
+
+  struct Frame {
+    TowerNode* node;
+    size_t next_child;
+    // Whether a child has been written, which the next one is separated from
+    bool separate;
+  };
+  std::vector<Frame> stack;
+  TowerSnapshotWriter payload;
+  // Neighboring nodes tend to have the same types, so avoid looking up the registry for each of them
+  TowerNode* last_type = nullptr;
+  const TowerTypeInfo* last_info = nullptr;
+
+  const auto open_node = [&](TowerNode* node, TowerAtom member) -> bool {
+    output.write('{');
+    bool first_key = true;
+    if (member != TOWER_ATOM_NONE) {
+      output.write("\"member\":", 9);
+      output.write_string(tower_atom_get_string(member));
+      first_key = false;
+    }
+
+    const size_t component_count = node->shape->component_count;
+    if (component_count != 0) {
+      output.write(first_key ? "\"components\":{" : ",\"components\":{", first_key ? 14 : 15);
+      for (size_t c = 0; c < component_count; ++c) {
+        TowerComponent* component = node->components[c];
+        if (component->type != last_type) {
+          last_type = component->type;
+          last_info = tower_type_get_info(last_type);
+        }
+        const TowerTypeInfo* info = last_info;
+        // Every component type must be registered to know it's name
+        if (info == nullptr) {
+          return false;
+        }
+        if (c != 0) {
+          output.write(',');
+        }
+        output.write_string(info->name);
+        output.write(":[", 2);
+        output.write_number(component->data_bytes);
+        output.write(',');
+        void* data = tower_component_userdata(component);
+        if (info->serialize) {
+          payload.payloads.clear();
+          info->serialize(component, data, &payload);
+          output.write_hex(payload.payloads.data(), payload.payloads.size());
+        } else {
+          output.write_hex((const uint8_t*)data, component->data_bytes);
+        }
+        output.write(']');
+      }
+      output.write('}');
+      first_key = false;
+    }
+
+    // The children are read in place, skipping tombstones (and a clone's are those of it's source)
+    TowerNode* structure = tower_node_get_structure(node);
+    if (structure->children.empty()) {
+      output.write('}');
+      return true;
+    }
+    output.write(first_key ? "\"children\":[" : ",\"children\":[", first_key ? 12 : 13);
+    stack.push_back({structure, 0, false});
+    return true;
+  };
+
+  bool written = open_node(root, TOWER_ATOM_NONE);
+  while (written && !stack.empty()) {
+    Frame& frame = stack.back();
+    TowerNode* node = frame.node;
+    if (frame.next_child == node->children.size()) {
+      output.write("]}", 2);
+      stack.pop_back();
+      continue;
+    }
+    size_t slot = frame.next_child++;
+    if (node->children[slot] == nullptr) {
+      continue;
+    }
+    if (frame.separate) {
+      output.write(',');
+    }
+    frame.separate = true;
+    // This may push onto the stack, invalidating the frame
+    written = open_node(node->children[slot], tower_node_get_child_member_at(node, slot));
+  }
+
+  // Whatever was buffered when failing is dropped, since the text can never be complete
+  if (written) {
+    output.flush_buffer();
+  }
+  tower_memory_free(output.buffer);
+  return written;
+}
+
+void tower_memory_dump(TowerJsonFlush flush, void* userdata, bool json) {
+  uint8_t buffer[1024];
+  TowerJsonOutput output = { flush, userdata, buffer, sizeof(buffer) };
+  bool first = true;
+  // Text has one table for both, so types are told apart from categories by a prefix
+  const auto write_stats = [&](const char* prefix, const char* name, const TowerMemoryStats& stats) {
+    if (json) {
+      if (!first) {
+        output.write(',');
+      }
+      output.write_string(name);
+      output.write(":{\"bytes\":", 10);
+      output.write_number(stats.bytes);
+      output.write(",\"count\":", 9);
+      output.write_number(stats.count);
+      output.write(",\"peak_bytes\":", 14);
+      output.write_number(stats.peak_bytes);
+      output.write('}');
+    } else {
+      char label[128];
+      snprintf(label, sizeof(label), "%s%s", prefix, name);
+      char line[256];
+      int length = snprintf(line, sizeof(line), "%-40s %14zu %10zu %14zu\n", label, stats.bytes, stats.count, stats.peak_bytes);
+      output.write(line, std::min((size_t)length, sizeof(line) - 1));
+    }
+    first = false;
+  };
+
+  tower_memory_categories_flush();
+  if (json) {
+    output.write("{\"categories\":{", 15);
+  } else {
+    char line[256];
+    int length = snprintf(line, sizeof(line), "%-40s %14s %10s %14s\n", "category / type", "bytes", "count", "peak bytes");
+    output.write(line, (size_t)length);
+  }
+  const size_t category_count = tower_memory_get_category_count();
+  for (size_t i = 0; i < category_count; ++i) {
+    write_stats("", tower_memory_category_names[i], tower_memory_counters_load(tower_memory_categories[i]));
+  }
+
+  if (json) {
+    output.write("},\"types\":{", 11);
+  }
+  first = true;
+  // The stats are copied under the lock and written after, so that flush never runs while holding it
+  // (flush may allocate, or destroy a type, which both need the same lock)
+  std::vector<std::pair<std::string, TowerMemoryStats>> types;
+  {
+    std::lock_guard<std::mutex> lock(tower_type_memory_mutex);
+    for (TowerTypeMemory* memory = tower_type_memory_list; memory; memory = memory->next) {
+      // Types that were never registered are named by their id
+      const TowerTypeInfo* info = tower_type_get_info(memory->type);
+      types.emplace_back(info ? info->name : "#" + std::to_string(memory->type->id), tower_memory_counters_load(memory->counters));
+    }
+  }
+  for (const auto& [name, stats] : types) {
+    write_stats("type ", name.c_str(), stats);
+  }
+  if (json) {
+    output.write("}}", 2);
+  }
+  output.flush_buffer();
+}
+
+void tower_profiler_set_sample_interval(size_t bytes) {
+  tower_profiler_interval.store(bytes, std::memory_order_relaxed);
+  // Other threads notice the next time their countdown runs out, but the calling thread does right away
+  tower_memory_cache.bytes_until_sample = 0;
+  tower_memory_cache.sample_armed = false;
+}
+
+size_t tower_profiler_get_sample_interval() {
+  return tower_profiler_interval.load(std::memory_order_relaxed);
+}
+
+void tower_profiler_push_scope(const char* name) {
+  TowerProfilerScopes& scopes = tower_profiler_scopes;
+  if (scopes.depth < TOWER_PROFILER_MAX_FRAMES) {
+    scopes.names[scopes.depth] = name;
+  }
+  ++scopes.depth;
+}
+
+void tower_profiler_pop_scope() {
+  assert(tower_profiler_scopes.depth != 0);
+  --tower_profiler_scopes.depth;
+}
+
+void tower_profiler_dump(TowerJsonFlush flush, void* userdata, bool live) {
+  uint8_t buffer[1024];
+  TowerJsonOutput output = { flush, userdata, buffer, sizeof(buffer) };
+  TowerProfiler& profiler = tower_profiler();
+  // The sites are copied under the lock and written after, so that flush never runs while holding it
+  // (flush may allocate, which can sample and needs the same lock)
+  std::vector<std::pair<TowerProfilerStack, size_t>> sites;
+  {
+    std::lock_guard<std::mutex> lock(profiler.mutex);
+    for (const auto& [stack, site] : profiler.sites) {
+      const size_t bytes = live ? site.live_bytes : site.total_bytes;
+      if (bytes != 0) {
+        sites.emplace_back(stack, bytes);
+      }
+    }
+  }
+  for (const auto& [stack, bytes] : sites) {
+    // Folded stacks go from the outermost frame to the innermost, separated by semicolons
+    const size_t scope_count = stack[0];
+    bool first = true;
+    for (size_t i = 1; i <= scope_count; ++i) {
+      if (!first) {
+        output.write(';');
+      }
+      const char* name = (const char*)stack[i];
+      output.write(name, strlen(name));
+      first = false;
+    }
+    for (size_t i = stack.size(); i-- > scope_count + 1;) {
+      if (!first) {
+        output.write(';');
+      }
+      char address[32];
+      int length = snprintf(address, sizeof(address), "0x%llx", (unsigned long long)stack[i]);
+      output.write(address, (size_t)length);
+      first = false;
+    }
+    if (first) {
+      output.write("[unknown]", 9);
+    }
+    output.write(' ');
+    output.write_number(bytes);
+    output.write('\n');
+  }
+  output.flush_buffer();
+}
+
+enum TowerJsonToken {
+  TOWER_JSON_TOKEN_OBJECT_BEGIN,
+  TOWER_JSON_TOKEN_OBJECT_END,
+  TOWER_JSON_TOKEN_ARRAY_BEGIN,
+  TOWER_JSON_TOKEN_ARRAY_END,
+  TOWER_JSON_TOKEN_COLON,
+  TOWER_JSON_TOKEN_COMMA,
+  TOWER_JSON_TOKEN_STRING,
+  TOWER_JSON_TOKEN_NUMBER,
+};
+
+// Where the parser is within the structure of a node (see tower_json_write)
+enum TowerJsonState {
+  TOWER_JSON_STATE_NODE,
+  TOWER_JSON_STATE_KEY_OR_END,
+  TOWER_JSON_STATE_KEY,
+  TOWER_JSON_STATE_KEY_COLON,
+  TOWER_JSON_STATE_MEMBER,
+  TOWER_JSON_STATE_COMPONENTS_BEGIN,
+  TOWER_JSON_STATE_COMPONENT_OR_END,
+  TOWER_JSON_STATE_COMPONENT,
+  TOWER_JSON_STATE_COMPONENT_COLON,
+  TOWER_JSON_STATE_COMPONENT_BEGIN,
+  TOWER_JSON_STATE_COMPONENT_BYTES,
+  TOWER_JSON_STATE_COMPONENT_COMMA,
+  TOWER_JSON_STATE_COMPONENT_PAYLOAD,
+  TOWER_JSON_STATE_COMPONENT_END,
+  TOWER_JSON_STATE_AFTER_COMPONENT,
+  TOWER_JSON_STATE_CHILDREN_BEGIN,
+  TOWER_JSON_STATE_CHILD_OR_END,
+  TOWER_JSON_STATE_AFTER_CHILD,
+  TOWER_JSON_STATE_AFTER_VALUE,
+  TOWER_JSON_STATE_DONE,
+  TOWER_JSON_STATE_ERROR,
+};
+
+// Where the lexer is within a token, since tokens can be split across calls to tower_json_reader_feed
+enum TowerJsonLex {
+  TOWER_JSON_LEX_NONE,
+  TOWER_JSON_LEX_STRING,
+  TOWER_JSON_LEX_ESCAPE,
+  TOWER_JSON_LEX_UNICODE,
+  TOWER_JSON_LEX_NUMBER,
+};
+
+struct TowerJsonReader {
+  struct Frame {
+    // The node holds a reference until it's closed and attached to it's parent
+    TowerNode* node;
+    TowerAtom member;
+  };
+
+  TowerArena* arena = nullptr;
+  std::vector<Frame> stack;
+  TowerNode* root = nullptr;
+  TowerJsonState state = TOWER_JSON_STATE_NODE;
+
+  TowerJsonLex lex = TOWER_JSON_LEX_NONE;
+  // The contents of the current string token, reused for every string
+  std::string text;
+  uint32_t unicode = 0;
+  size_t unicode_digits = 0;
+  // The first half of a surrogate pair, which must be followed by the second half
+  uint32_t high_surrogate = 0;
+  size_t number = 0;
+
+  // The key of the current node being read, and the component being read
+  std::string key;
+  TowerNode* component_type = nullptr;
+  const TowerTypeInfo* component_info = nullptr;
+  size_t component_bytes = 0;
+  std::vector<uint8_t> payload;
+  // Types that have been read, to avoid looking up the registry for every component
+  std::unordered_map<std::string, std::pair<TowerNode*, const TowerTypeInfo*>> types;
+  std::string last_type_name;
+};
+
+TowerJsonReader* tower_json_reader_create(TowerArena* arena) {
+  TowerJsonReader* reader = new (tower_memory_allocate(sizeof(TowerJsonReader))) TowerJsonReader();
+  reader->arena = arena;
+  return reader;
+}
+
+void tower_json_reader_destroy(TowerJsonReader* reader) {
+  // Release any nodes that were never finished (attached nodes are released with their parent)
+  for (const TowerJsonReader::Frame& frame : reader->stack) {
+    tower_node_release_ref(frame.node);
+  }
+  if (reader->root) {
+    tower_node_release_ref(reader->root);
+  }
+  reader->~TowerJsonReader();
+  tower_memory_free(reader);
+}
+
+inline int tower_json_hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+void tower_json_append_utf8(std::string& text, uint32_t codepoint) {
+  if (codepoint < 0x80) {
+    text.push_back((char)codepoint);
+  } else if (codepoint < 0x800) {
+    text.push_back((char)(0xC0 | (codepoint >> 6)));
+    text.push_back((char)(0x80 | (codepoint & 0x3F)));
+  } else if (codepoint < 0x10000) {
+    text.push_back((char)(0xE0 | (codepoint >> 12)));
+    text.push_back((char)(0x80 | ((codepoint >> 6) & 0x3F)));
+    text.push_back((char)(0x80 | (codepoint & 0x3F)));
+  } else {
+    text.push_back((char)(0xF0 | (codepoint >> 18)));
+    text.push_back((char)(0x80 | ((codepoint >> 12) & 0x3F)));
+    text.push_back((char)(0x80 | ((codepoint >> 6) & 0x3F)));
+    text.push_back((char)(0x80 | (codepoint & 0x3F)));
+  }
+}
+
+void tower_json_reader_open_node(TowerJsonReader* reader) {
+  reader->stack.push_back({ tower_node_create_in_arena(reader->arena), TOWER_ATOM_NONE });
+  reader->state = TOWER_JSON_STATE_KEY_OR_END;
+}
+
+void tower_json_reader_close_node(TowerJsonReader* reader) {
+  TowerJsonReader::Frame frame = reader->stack.back();
+  reader->stack.pop_back();
+  if (reader->stack.empty()) {
+    reader->root = frame.node;
+    reader->state = TOWER_JSON_STATE_DONE;
+    return;
+  }
+  tower_node_attach_member_atom(frame.node, reader->stack.back().node, frame.member);
+  tower_node_release_ref(frame.node);
+  reader->state = TOWER_JSON_STATE_AFTER_CHILD;
+}
+
+bool tower_json_reader_create_component(TowerJsonReader* reader) {
+  // Decode the hex payload
+  const std::string& text = reader->text;
+  if (text.size() % 2 != 0) {
+    return false;
+  }
+  std::vector<uint8_t>& payload = reader->payload;
+  payload.resize(text.size() / 2);
+  for (size_t i = 0; i < payload.size(); ++i) {
+    int high = tower_json_hex_value(text[i * 2]);
+    int low = tower_json_hex_value(text[i * 2 + 1]);
+    if (high < 0 || low < 0) {
+      return false;
+    }
+    payload[i] = (uint8_t)((high << 4) | low);
+  }
+
+  // The size comes from the text, so it must match what the type expects before anything is constructed
+  const TowerTypeInfo* info = reader->component_info;
+  const size_t expected_bytes = info->deserialize ? info->data_bytes : payload.size();
+  if (reader->component_bytes != expected_bytes || (info->data_bytes != 0 && reader->component_bytes != info->data_bytes)) {
+    return false;
+  }
+  // A type repeated within a node would hand back the existing component, which may be smaller
+  TowerNode* node = reader->stack.back().node;
+  if (tower_node_get_component(node, reader->component_type)) {
+    return false;
+  }
+  TowerComponent* component = tower_component_create(node, reader->component_type, reader->component_bytes, info->destructor);
+  void* userdata = tower_component_userdata(component);
+  if (info->deserialize) {
+    info->deserialize(component, userdata, payload.data(), payload.size());
+  } else {
+    memcpy(userdata, payload.data(), payload.size());
+  }
+  return true;
+}
+
+// Advance the parser by one token, returning false if the token is not valid where it is
+bool tower_json_reader_token(TowerJsonReader* reader, TowerJsonToken token) {
+  switch (reader->state) {
+  case TOWER_JSON_STATE_NODE:
+    if (token != TOWER_JSON_TOKEN_OBJECT_BEGIN) {
+      return false;
+    }
+    tower_json_reader_open_node(reader);
+    return true;
+  case TOWER_JSON_STATE_KEY_OR_END:
+    if (token == TOWER_JSON_TOKEN_OBJECT_END) {
+      tower_json_reader_close_node(reader);
+      return true;
+    }
+    [[fallthrough]];
+  case TOWER_JSON_STATE_KEY:
+    if (token != TOWER_JSON_TOKEN_STRING) {
+      return false;
+    }
+    reader->key = reader->text;
+    reader->state = TOWER_JSON_STATE_KEY_COLON;
+    return true;
+  case TOWER_JSON_STATE_KEY_COLON:
+    if (token != TOWER_JSON_TOKEN_COLON) {
+      return false;
+    }
+    if (reader->key == "member") {
+      reader->state = TOWER_JSON_STATE_MEMBER;
+    } else if (reader->key == "components") {
+      reader->state = TOWER_JSON_STATE_COMPONENTS_BEGIN;
+    } else if (reader->key == "children") {
+      reader->state = TOWER_JSON_STATE_CHILDREN_BEGIN;
+    } else {
+      return false;
+    }
+    return true;
+  case TOWER_JSON_STATE_MEMBER:
+    // The root has nothing to be a member of
+    if (token != TOWER_JSON_TOKEN_STRING || reader->stack.size() == 1) {
+      return false;
+    }
+    reader->stack.back().member = tower_atom_intern(reader->text.c_str());
+    reader->state = TOWER_JSON_STATE_AFTER_VALUE;
+    return true;
+  case TOWER_JSON_STATE_COMPONENTS_BEGIN:
+    if (token != TOWER_JSON_TOKEN_OBJECT_BEGIN) {
+      return false;
+    }
+    reader->state = TOWER_JSON_STATE_COMPONENT_OR_END;
+    return true;
+  case TOWER_JSON_STATE_COMPONENT_OR_END:
+    if (token == TOWER_JSON_TOKEN_OBJECT_END) {
+      reader->state = TOWER_JSON_STATE_AFTER_VALUE;
+      return true;
+    }
+    [[fallthrough]];
+  case TOWER_JSON_STATE_COMPONENT: {
+    if (token != TOWER_JSON_TOKEN_STRING) {
+      return false;
+    }
+    // Neighboring nodes tend to have the same types
+    if (reader->text != reader->last_type_name || reader->component_type == nullptr) {
+      auto found = reader->types.find(reader->text);
+      if (found == reader->types.end()) {
+        TowerNode* type = tower_type_find(reader->text.c_str());
+        if (type == nullptr) {
+          return false;
+        }
+        found = reader->types.insert({reader->text, {type, tower_type_get_info(type)}}).first;
+      }
+      reader->component_type = found->second.first;
+      reader->component_info = found->second.second;
+      reader->last_type_name = reader->text;
+    }
+    reader->state = TOWER_JSON_STATE_COMPONENT_COLON;
+    return true;
+  }
+  case TOWER_JSON_STATE_COMPONENT_COLON:
+    if (token != TOWER_JSON_TOKEN_COLON) {
+      return false;
+    }
+    reader->state = TOWER_JSON_STATE_COMPONENT_BEGIN;
+    return true;
+  case TOWER_JSON_STATE_COMPONENT_BEGIN:
+    if (token != TOWER_JSON_TOKEN_ARRAY_BEGIN) {
+      return false;
+    }
+    reader->state = TOWER_JSON_STATE_COMPONENT_BYTES;
+    return true;
+  case TOWER_JSON_STATE_COMPONENT_BYTES:
+    if (token != TOWER_JSON_TOKEN_NUMBER) {
+      return false;
+    }
+    // Components store their size in 32 bits
+    if (reader->number > UINT32_MAX) {
+      return false;
+    }
+    reader->component_bytes = reader->number;
+    reader->state = TOWER_JSON_STATE_COMPONENT_COMMA;
+    return true;
+  case TOWER_JSON_STATE_COMPONENT_COMMA:
+    if (token != TOWER_JSON_TOKEN_COMMA) {
+      return false;
+    }
+    reader->state = TOWER_JSON_STATE_COMPONENT_PAYLOAD;
+    return true;
+  case TOWER_JSON_STATE_COMPONENT_PAYLOAD:
+    if (token != TOWER_JSON_TOKEN_STRING || !tower_json_reader_create_component(reader)) {
+      return false;
+    }
+    reader->state = TOWER_JSON_STATE_COMPONENT_END;
+    return true;
+  case TOWER_JSON_STATE_COMPONENT_END:
+    if (token != TOWER_JSON_TOKEN_ARRAY_END) {
+      return false;
+    }
+    reader->state = TOWER_JSON_STATE_AFTER_COMPONENT;
+    return true;
+  case TOWER_JSON_STATE_AFTER_COMPONENT:
+    if (token == TOWER_JSON_TOKEN_COMMA) {
+      reader->state = TOWER_JSON_STATE_COMPONENT;
+    } else if (token == TOWER_JSON_TOKEN_OBJECT_END) {
+      reader->state = TOWER_JSON_STATE_AFTER_VALUE;
+    } else {
+      return false;
+    }
+    return true;
+  case TOWER_JSON_STATE_CHILDREN_BEGIN:
+    if (token != TOWER_JSON_TOKEN_ARRAY_BEGIN) {
+      return false;
+    }
+    reader->state = TOWER_JSON_STATE_CHILD_OR_END;
+    return true;
+  case TOWER_JSON_STATE_CHILD_OR_END:
+    if (token == TOWER_JSON_TOKEN_ARRAY_END) {
+      reader->state = TOWER_JSON_STATE_AFTER_VALUE;
+      return true;
+    }
+    if (token != TOWER_JSON_TOKEN_OBJECT_BEGIN) {
+      return false;
+    }
+    tower_json_reader_open_node(reader);
+    return true;
+  case TOWER_JSON_STATE_AFTER_CHILD:
+    if (token == TOWER_JSON_TOKEN_COMMA) {
+      reader->state = TOWER_JSON_STATE_NODE;
+    } else if (token == TOWER_JSON_TOKEN_ARRAY_END) {
+      reader->state = TOWER_JSON_STATE_AFTER_VALUE;
+    } else {
+      return false;
+    }
+    return true;
+  case TOWER_JSON_STATE_AFTER_VALUE:
+    if (token == TOWER_JSON_TOKEN_COMMA) {
+      reader->state = TOWER_JSON_STATE_KEY;
+    } else if (token == TOWER_JSON_TOKEN_OBJECT_END) {
+      tower_json_reader_close_node(reader);
+    } else {
+      return false;
+    }
+    return true;
+  case TOWER_JSON_STATE_DONE:
+  case TOWER_JSON_STATE_ERROR:
+    return false;
+  }
+  return false;
+}
+
+bool tower_json_reader_feed(TowerJsonReader* reader, const char* data, size_t length) {
+  if (reader->state == TOWER_JSON_STATE_ERROR) {
+    return false;
+  }
+
+  const char* end = data + length;
+  const char* c = data;
+  const auto fail = [&]() {
+    reader->state = TOWER_JSON_STATE_ERROR;
+    return false;
+  };
+
+  while (c != end) {
+    switch (reader->lex) {
+    case TOWER_JSON_LEX_STRING: {
+      if (reader->high_surrogate != 0 && *c != '\\') {
+        return fail();
+      }
+      // Copy runs of plain characters at once
+      const char* run = c;
+      while (c != end && *c != '"' && *c != '\\' && (uint8_t)*c >= 0x20) {
+        ++c;
+      }
+      reader->text.append(run, c - run);
+      if (c == end) {
+        break;
+      }
+      char terminator = *c++;
+      if (terminator == '\\') {
+        reader->lex = TOWER_JSON_LEX_ESCAPE;
+      } else if (terminator == '"') {
+        reader->lex = TOWER_JSON_LEX_NONE;
+        if (!tower_json_reader_token(reader, TOWER_JSON_TOKEN_STRING)) {
+          return fail();
+        }
+      } else {
+        return fail();
+      }
+      break;
+    }
+    case TOWER_JSON_LEX_ESCAPE: {
+      char escaped = *c++;
+      reader->lex = TOWER_JSON_LEX_STRING;
+      if (reader->high_surrogate != 0 && escaped != 'u') {
+        return fail();
+      }
+      switch (escaped) {
+      case '"': reader->text.push_back('"'); break;
+      case '\\': reader->text.push_back('\\'); break;
+      case '/': reader->text.push_back('/'); break;
+      case 'b': reader->text.push_back('\b'); break;
+      case 'f': reader->text.push_back('\f'); break;
+      case 'n': reader->text.push_back('\n'); break;
+      case 'r': reader->text.push_back('\r'); break;
+      case 't': reader->text.push_back('\t'); break;
+      case 'u':
+        reader->lex = TOWER_JSON_LEX_UNICODE;
+        reader->unicode = 0;
+        reader->unicode_digits = 0;
+        break;
+      default:
+        return fail();
+      }
+      break;
+    }
+    case TOWER_JSON_LEX_UNICODE: {
+      int digit = tower_json_hex_value(*c++);
+      if (digit < 0) {
+        return fail();
+      }
+      reader->unicode = (reader->unicode << 4) | (uint32_t)digit;
+      if (++reader->unicode_digits == 4) {
+        // Strings are null terminated, so an embedded null could never be read back the same
+        uint32_t unicode = reader->unicode;
+        const bool low_surrogate = unicode >= 0xDC00 && unicode <= 0xDFFF;
+        if (unicode == 0 || low_surrogate != (reader->high_surrogate != 0)) {
+          return fail();
+        }
+        if (low_surrogate) {
+          tower_json_append_utf8(reader->text, 0x10000 + ((reader->high_surrogate - 0xD800) << 10) + (unicode - 0xDC00));
+          reader->high_surrogate = 0;
+        } else if (unicode >= 0xD800 && unicode <= 0xDBFF) {
+          reader->high_surrogate = unicode;
+        } else {
+          tower_json_append_utf8(reader->text, unicode);
+        }
+        reader->lex = TOWER_JSON_LEX_STRING;
+      }
+      break;
+    }
+    case TOWER_JSON_LEX_NUMBER:
+      while (c != end && *c >= '0' && *c <= '9') {
+        const size_t digit = (size_t)(*c - '0');
+        if (reader->number > (SIZE_MAX - digit) / 10) {
+          return fail();
+        }
+        reader->number = reader->number * 10 + digit;
+        ++c;
+      }
+      if (c != end) {
+        reader->lex = TOWER_JSON_LEX_NONE;
+        if (!tower_json_reader_token(reader, TOWER_JSON_TOKEN_NUMBER)) {
+          return fail();
+        }
+      }
+      break;
+    case TOWER_JSON_LEX_NONE: {
+      char next = *c++;
+      TowerJsonToken token;
+      switch (next) {
+      case ' ': case '\t': case '\r': case '\n':
+        continue;
+      case '{': token = TOWER_JSON_TOKEN_OBJECT_BEGIN; break;
+      case '}': token = TOWER_JSON_TOKEN_OBJECT_END; break;
+      case '[': token = TOWER_JSON_TOKEN_ARRAY_BEGIN; break;
+      case ']': token = TOWER_JSON_TOKEN_ARRAY_END; break;
+      case ':': token = TOWER_JSON_TOKEN_COLON; break;
+      case ',': token = TOWER_JSON_TOKEN_COMMA; break;
+      case '"':
+        reader->lex = TOWER_JSON_LEX_STRING;
+        reader->text.clear();
+        continue;
+      default:
+        if (next >= '0' && next <= '9') {
+          reader->lex = TOWER_JSON_LEX_NUMBER;
+          reader->number = (size_t)(next - '0');
+          continue;
+        }
+        return fail();
+      }
+      if (!tower_json_reader_token(reader, token)) {
+        return fail();
+      }
+      break;
+    }
+    }
+  }
+  return true;
 }
 
+TowerNode* tower_json_reader_finish(TowerJsonReader* reader) {
+  if (reader->state != TOWER_JSON_STATE_DONE) {
+    return nullptr;
+  }
+  // The reference is handed to the caller
+  TowerNode* root = reader->root;
+  reader->root = nullptr;
+  reader->state = TOWER_JSON_STATE_ERROR;
+  return root;
+}
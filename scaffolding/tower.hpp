@@ -3,14 +3,39 @@
 
 struct TowerNode;
 struct TowerComponent;
+struct TowerArena;
+struct TowerWeak;
+struct TowerSnapshot;
+struct TowerSnapshotWriter;
+struct TowerJsonReader;
+struct TowerInterner;
+struct TowerCursor;
+struct TowerJournal;
 
 const size_t TOWER_INVALID_INDEX = (size_t)-1;
 
+// An interned string that is compared by value (see tower_atom_intern)
+typedef uint32_t TowerAtom;
+
+// The atom of a null or empty string, which canonically means "no name"
+const TowerAtom TOWER_ATOM_NONE = 0;
+
+// A weak reference to a node that can be safely checked for whether the node is still alive
+// The low 32 bits are an index into a table, and the high 32 bits are a generation
+typedef uint64_t TowerHandle;
+
+// Never refers to a node
+const TowerHandle TOWER_HANDLE_NONE = 0;
+
 // Run a suite of tests over tower nodes and components
 void tower_tests();
 
+// Run a suite of benchmarks over tower nodes and components, printing the timings
+void tower_benchmarks();
+
 
 // Allocate memory and return a pointer to it, or null if the allocation fails
+// Small allocations are served from per-thread size class caches backed by shared slabs
 void* tower_memory_allocate(size_t size);
 
 // Free a pointer to allocated memory
@@ -19,6 +44,99 @@ void tower_memory_free(void* memory);
 // Get how many tower allocations there have been
 size_t tower_memory_get_allocated_count();
 
+// What an allocation is used for, so that memory use can be broken down (see tower_memory_get_stats)
+typedef uint32_t TowerMemoryCategory;
+
+// Allocations that were not given a category (see tower_memory_allocate)
+const TowerMemoryCategory TOWER_MEMORY_CATEGORY_GENERAL = 0;
+// Nodes outside of arenas, including their inline components, children and component arrays
+const TowerMemoryCategory TOWER_MEMORY_CATEGORY_NODES = 1;
+// Components outside of arenas that did not fit within their node
+const TowerMemoryCategory TOWER_MEMORY_CATEGORY_COMPONENTS = 2;
+// Arenas and the chunks that everything within them is allocated from
+const TowerMemoryCategory TOWER_MEMORY_CATEGORY_ARENAS = 3;
+
+struct TowerMemoryStats {
+  // Bytes requested by the live allocations, not including the allocator's own overhead
+  size_t bytes;
+  // How many allocations are live
+  size_t count;
+  // The most bytes that were live at once, since the start of the program or the last tower_memory_reset_peaks
+  size_t peak_bytes;
+};
+
+// Create a category with a name, or get the existing category with the same name
+// Categories live for the lifetime of the program, and there can be at most 64 of them
+TowerMemoryCategory tower_memory_category_create(const char* name);
+
+// Get how many categories there are, including the built in ones
+size_t tower_memory_get_category_count();
+
+// Get the name of a category, which lives for the lifetime of the program
+const char* tower_memory_category_get_name(TowerMemoryCategory category);
+
+// Allocate memory the same as tower_memory_allocate, counting it towards a category until it's freed
+void* tower_memory_allocate_tagged(size_t size, TowerMemoryCategory category);
+
+// Get the current memory use of a category
+// Each thread adds it's changes to the shared stats once they reach 64KB, so the stats (and peaks) can be
+// behind by up to that much for every other thread, while the calling thread's changes are always included
+TowerMemoryStats tower_memory_get_stats(TowerMemoryCategory category);
+
+// Copy the stats of up to max_count categories (indexed by category) without taking any locks, and
+// return how many categories there are
+size_t tower_memory_snapshot(TowerMemoryStats* stats, size_t max_count);
+
+// Start measuring peaks again from the current memory use of every category and type, such as before
+// building a table to find out how much it needed at most
+void tower_memory_reset_peaks();
+
+
+// Intern a null-terminated utf8 string and return a stable atom for it
+// The same string always results in the same atom for the lifetime of the program
+// A null or empty string results in TOWER_ATOM_NONE
+TowerAtom tower_atom_intern(const char* string);
+
+// Find the atom of a string without interning it
+// Returns TOWER_ATOM_NONE if the string is null, empty, or has never been interned
+TowerAtom tower_atom_find(const char* string);
+
+// Get the null-terminated string of an atom, or null for TOWER_ATOM_NONE
+// The string memory is owned by the atom table and lives for the lifetime of the program
+const char* tower_atom_get_string(TowerAtom atom);
+
+
+// Create an arena (region) that nodes, their components, and their child lists are allocated from
+// Memory within an arena is never freed individually, it is all released at once by tower_arena_destroy
+// An arena must only be used by one thread at a time
+TowerArena* tower_arena_create();
+
+// Destroy the arena and every node created within it at once, regardless of reference counts
+// Destructors of components that are still alive are run, and any references the arena holds
+// to nodes outside of it (component types and attached children) are released
+// Any pointers to nodes within the arena are invalid after this call
+void tower_arena_destroy(TowerArena* arena);
+
+// Destroy every node created within the arena the same as tower_arena_destroy, but keep the arena and
+// it's memory to be reused by the nodes created next, which avoids allocating it again for each tree
+void tower_arena_reset(TowerArena* arena);
+
+
+// Enable or disable deferred reclamation, which is disabled by default
+// While enabled, nodes released to a count of zero (other than nodes within an arena) are handed to a
+// background thread that runs component destructors and frees memory, so dropping a large tree
+// doesn't stall the releasing thread. The released subtree must be exclusively owned, no other
+// thread may hold or take references to nodes within it, and component destructors run on the
+// background thread. Disabling waits for all queued nodes to be reclaimed (see tower_reclaim_flush)
+void tower_reclaim_set_deferred(bool deferred);
+
+// Return true if deferred reclamation is enabled
+bool tower_reclaim_get_deferred();
+
+// Wait until every node that was queued for deferred reclamation has been destroyed
+// After a flush, the allocated counts of nodes, components, and memory are up to date
+void tower_reclaim_flush();
+
 
 // Get how many tower nodes are allocated
 size_t tower_node_get_allocated_count();
@@ -27,18 +145,106 @@ size_t tower_node_get_allocated_count();
 // The reference count will be 1 (reference is returned to caller)
 TowerNode* tower_node_create();
 
+// Construct a tower node whose memory (including components and child lists) comes from the arena
+// If the arena is null, this is the same as tower_node_create
+// Nodes within an arena can hold children from outside of it, however a node within an arena can
+// never be attached to a parent outside of the arena (escaping the arena asserts in debug)
+// The arena holds a single reference to each component type used within it (rather than each component)
+TowerNode* tower_node_create_in_arena(TowerArena* arena);
+
+// Construct a tower node (optionally within an arena) with room reserved to store components
+// directly within the node's allocation, avoiding a separate allocation for each component
+// The room is for component_count components with a combined data_bytes (see tower_component_create)
+// Components that don't fit are still allocated separately, and nodes created without a capacity
+// reserve no room at all
+TowerNode* tower_node_create_with_capacity(TowerArena* arena, size_t component_count, size_t component_data_bytes);
+
+// Get the arena the node was allocated within, or null if it was allocated individually
+TowerArena* tower_node_get_arena(TowerNode* node);
+
+// Choose whether the node's reference count is updated atomically, which is off by default
+// This must be set while only one thread has access to the node, before it's shared
+// With an atomic reference count, any thread holding a reference may add or release references
+// (including through tower_node_attach and tower_node_detach of the node as a child). Adding a
+// reference is relaxed, and releasing one is acquire-release, so every thread's writes to the node
+// happen before it's destroyed by whichever thread releases the last reference.
+// Nothing else about the node becomes thread-safe. Any number of threads may read a node at once
+// (children, members, and components) as long as no thread modifies it, which includes attaching or
+// detaching children, and creating components. Reading children by position compacts the space left
+// by detached children (see tower_node_detach), so a shared node should not have detached children.
+// Component types used from several threads need an atomic reference count as well
+void tower_node_set_atomic_ref_count(TowerNode* node, bool atomic);
+
+// Return true if the node's reference count is updated atomically
+bool tower_node_get_atomic_ref_count(TowerNode* node);
+
+// Freeze the subtree under root, making it immutable until tower_node_thaw is called
+// Frozen nodes are pinned by a single reference to the root for the life of the freeze, so adding and
+// releasing references to frozen nodes does nothing (references taken while frozen must also be
+// released while frozen). Any number of threads can then read the subtree at once without any
+// synchronization. Attaching or detaching frozen nodes, attaching or detaching children of frozen
+// nodes, or creating components on frozen nodes asserts in debug
+// Nodes outside of the subtree (such as component types) are not frozen
+// A node can't be frozen again while within a frozen subtree
+void tower_node_freeze(TowerNode* root);
+
+// Thaw a subtree previously frozen by tower_node_freeze, releasing the reference that pinned it
+// This must be called while only one thread has access to the subtree
+void tower_node_thaw(TowerNode* root);
+
+// Return true if the node is within a frozen subtree
+bool tower_node_is_frozen(TowerNode* node);
+
+// Clone a frozen subtree in O(1) by sharing it's children and components with the source
+// Each level of children is only cloned once it's looked at or changed (counting them doesn't), and
+// components stay shared until written to (see tower_node_get_component_for_write), so changing a
+// few nodes of a large template only costs the levels on the way to them
+// Shared components still report the source as their owner (see tower_component_get_owner)
+// The clone holds a reference to the source until it has it's own children and components, so the
+// source outlives it even once thawed, however it must stay frozen while clones on other threads share it
+TowerNode* tower_node_clone_cow(TowerNode* source, TowerArena* arena = nullptr);
+
 // Increment the reference count of a node in tower and returns the new count
 size_t tower_node_add_ref(TowerNode* node);
 
 // Decrement the reference count of a node in tower and returns the new count
 // When the ref count reaches zero, the node and it's components will be destructed
 // Any child nodes that have no references holding them alive (or only weak references) will be destroyed
+// Destruction is iterative, so releasing arbitrarily deep trees will not overflow the stack
 size_t tower_node_release_ref(TowerNode* node);
 
 // Get the current reference count of a tower node
 size_t tower_node_get_ref_count(TowerNode* node);
 
+// Get a handle to the node that can be stored without holding a reference (see tower_node_from_handle)
+// The node is given a handle the first time this is called, and always returns the same handle after
+TowerHandle tower_node_get_handle(TowerNode* node);
+
+// Get the node a handle refers to in O(1), or null if the node has been destroyed or the handle is invalid
+// A destroyed node's handle is not valid again when it's slot is reused by another node (unless the slot
+// is reused 2^32 times)
+// This does NOT increment the reference count of the returned node, and must not race with the
+// last release of the node on another thread
+TowerNode* tower_node_from_handle(TowerHandle handle);
+
+// Create a weak reference to a node, which does not keep the node alive (see tower_weak_upgrade)
+// The weak reference must be released with tower_weak_release
+TowerWeak* tower_node_create_weak(TowerNode* node);
+
+// Get a strong reference to the node of a weak reference in O(1), or null if the node has been destroyed
+// If a node is returned, it's reference count has been incremented and must be released by the caller
+// Upgrading never takes a global lock, only a lock per node that is also taken when the node is destroyed
+TowerNode* tower_weak_upgrade(TowerWeak* weak);
+
+// Add another count to a weak reference, returning the same weak reference
+TowerWeak* tower_weak_add_ref(TowerWeak* weak);
+
+// Release a weak reference, which may be done before or after the node is destroyed
+void tower_weak_release(TowerWeak* weak);
+
 // Every tower node has a unique id that counts up from the start of the program
+// Threads reserve ids in blocks, so ids are in creation order among nodes created by the same thread,
+// but only roughly in creation order between threads
 // This is useful to uniquely identify a node without pointing at it, or to maintin creation order
 size_t tower_node_get_id(TowerNode* node);
 
@@ -49,14 +255,29 @@ void tower_node_attach(TowerNode* child, TowerNode* new_parent);
 
 // Attach a child tower node to a parent, automatically detaching it from any parent it's attached to
 // If parent is null, then this will detach the child from any parent it's currently attached to
-// If member_name is not null, it overwrites any member of the same name and is copied / stored internally
+// If member_name is not null, it overwrites any member of the same name and is interned as an atom
 // On attach reference count is incremented, on detach it's decremented
 void tower_node_attach_member(TowerNode* child, TowerNode* new_parent, const char* member_name);
 
+// The same as tower_node_attach_member, but with an already interned member name
+// If member is TOWER_ATOM_NONE, the child is attached without a name
+void tower_node_attach_member_atom(TowerNode* child, TowerNode* new_parent, TowerAtom member);
+
+// Attach many children to a parent in order without member names, the same as calling tower_node_attach
+// on each of them, but only growing the parent's children once
+void tower_node_attach_many(TowerNode* const* children, size_t count, TowerNode* new_parent);
+
 // Detach a child node from a parent (or do nothing if it has no parent)
 // If the child was attached, the reference could will be decremented
+// Detaching is O(1) amortized and leaves a tombstone in the parent, the remaining children keep their order
+// and are compacted by a later detach once tombstones are half of the parent's slots
+// Reads never compact, so they never write to the parent
 void tower_node_detach(TowerNode* child);
 
+// Detach the child at the index (counting the same as tower_node_get_child) from the parent
+// Unlike tower_node_detach, this can detach a shared child, which only the parent knows it's link to
+void tower_node_detach_child(TowerNode* parent, size_t index);
+
 // Get the parent of a child, or null if it's is the root
 // This does NOT increment the reference count of the returned node
 TowerNode* tower_node_get_parent(TowerNode* child);
@@ -69,31 +290,51 @@ size_t tower_node_get_child_count(TowerNode* parent);
 // This does NOT increment the reference count of the returned node
 TowerNode* tower_node_get_child(TowerNode* parent, size_t index);
 
+// Get all the children of a parent in order, and write how many slots there are to count
+// Slots that are null are tombstones left behind by detaching (see tower_node_detach), which must be skipped
+// The returned array is only valid until children are attached to or detached from the parent
+// This does NOT increment the reference count of the returned nodes
+TowerNode* const* tower_node_get_children(TowerNode* parent, size_t* count);
+
 // Get a specfic child node by member name, or null if the member is not found
 // This does NOT increment the reference count of the returned node
 TowerNode* tower_node_get_child_member(TowerNode* parent, const char* member_name);
+TowerNode* tower_node_get_child_member_atom(TowerNode* parent, TowerAtom member);
 
 // Get the index of a specfic child node by member name, or TOWER_INVALID_INDEX if the member is not found
 size_t tower_node_get_child_member_index(TowerNode* parent, const char* member_name);
+size_t tower_node_get_child_member_index_atom(TowerNode* parent, TowerAtom member);
 
 // Get the member name of a specific child from the parent
-// The string memory is owned by the parent node, and will be destroyed if the parent
-// is destroyed, or if the child is removed as a member
+// The string memory is owned by the atom table (see tower_atom_get_string)
 // If the child has no name, or the child has no parent, null will be returned
 const char* tower_node_get_parent_member_name(TowerNode* child);
 
+// Get the member name of a specific child from the parent as an atom
+// If the child has no name, or the child has no parent, TOWER_ATOM_NONE will be returned
+TowerAtom tower_node_get_parent_member_atom(TowerNode* child);
+
 // Get the index of a specfic child node, or TOWER_INVALID_INDEX if the child has no parent
 size_t tower_node_get_parent_child_index(TowerNode* child);
 
 // Lookup a component on a tower node by type id, or returns null if it's not found
+// The components of a clone may still be shared with it's source (see tower_node_clone_cow), in which
+// case they are read-only, and must be written through tower_node_get_component_for_write instead
 // This does NOT increment the reference count of the owner or the type
 TowerComponent* tower_node_get_component(TowerNode* owner, TowerNode* type);
 
 // Lookup a component on a tower node by type id, or returns null if it's not found
 // This then offsets to the reserved userdata section of the component
+// The userdata is writable, so the component can't be shared with the source of a clone (which asserts
+// in debug builds), and clones must use tower_node_get_component_for_write or the read-only version below
 // This does NOT increment the reference count of the owner or the type
 void* tower_node_get_component_userdata(TowerNode* owner, TowerNode* type);
 
+// Lookup a component on a tower node by type id and get it's userdata to read, or returns null if it's not found
+// Unlike tower_node_get_component_userdata, this can be used on the shared components of clones
+// This does NOT increment the reference count of the owner or the type
+const void* tower_node_get_component_userdata_for_read(TowerNode* owner, TowerNode* type);
+
 // Return how many components the node has
 size_t tower_node_get_component_count(TowerNode* owner);
 
@@ -102,6 +343,87 @@ size_t tower_node_get_component_count(TowerNode* owner);
 // This does NOT increment the reference count of the owner
 TowerComponent* tower_node_get_component_by_index(TowerNode* owner, size_t index);
 
+// Get all the components of a node in the order they were added, and write how many there are to count
+// The returned array is only valid until another component is created on the node
+// This does NOT increment the reference count of the owner
+TowerComponent* const* tower_node_get_components(TowerNode* owner, size_t* count);
+
+// Get a component to modify, first giving the owner it's own copy if it's shared with the source
+// of a clone (see tower_node_clone_cow), or null if the owner doesn't have the component
+// Copies go through the type's registered serializers, or are copied as is if it has none
+TowerComponent* tower_node_get_component_for_write(TowerNode* owner, TowerNode* type);
+
+// Get a structural hash of the subtree, made from the component types and payloads (serialized if
+// the type has a serializer), and the member names and hashes of the children
+// Hashes are computed the first time they're needed, cached, and computed again only for nodes that
+// changed since, so this is O(1) amortized (frozen subtrees can be hashed from any thread)
+// Attaching, detaching, creating components and getting writable userdata (tower_component_get_userdata,
+// tower_node_get_component_userdata and tower_node_get_component_for_write) invalidate the cached hash of
+// the node and the nodes above it, so a payload written through a pointer kept from before the last hash
+// needs tower_node_invalidate_hash
+uint64_t tower_node_hash(TowerNode* root);
+
+// Mark the cached hash of the node (and the nodes above it) as out of date after changing a payload
+void tower_node_invalidate_hash(TowerNode* node);
+
+// Return true if two subtrees have the same structure (see tower_node_hash), which is O(1) when their hashes differ
+bool tower_node_equal(TowerNode* a, TowerNode* b);
+
+// Create a table that canonicalizes structurally equal subtrees (see tower_interner_intern)
+// Interners are not thread safe, but the nodes they share can be read from any thread
+TowerInterner* tower_interner_create();
+
+// Destroy an interner and release it's reference to every node it shares
+// Shared nodes that are still children of other nodes live on until the last of them is released
+void tower_interner_destroy(TowerInterner* interner);
+
+// Replace every subtree under root (and root itself) with a canonical node shared by every equal
+// subtree (see tower_node_equal), and return the canonical root
+// The root must be detached and outside of an arena, and the caller's reference to it is handed to
+// the interner (no other references to nodes within it should be held). Duplicate subtrees are
+// released, and the canonical nodes are frozen and held by the interner (the returned root has no
+// reference of the caller's, so it's only valid while the interner or a parent holds it)
+// Shared nodes can be attached to any number of parents at once, which each hold a reference to them,
+// and they report no parent (tower_node_get_parent returns null and tower_node_detach does nothing)
+// A shared child is detached with tower_node_detach_child, or replaced by attaching another child with
+// the same member name
+TowerNode* tower_interner_intern(TowerInterner* interner, TowerNode* root);
+
+// Get the number of canonical nodes the interner holds
+size_t tower_interner_get_node_count(TowerInterner* interner);
+
+// Return true if the node is a canonical node shared by an interner
+bool tower_node_is_shared(TowerNode* node);
+
+// The order a cursor visits the nodes of a subtree in
+enum TowerCursorOrder {
+  // Parents before their children
+  TOWER_CURSOR_PRE_ORDER,
+  // Children before their parents
+  TOWER_CURSOR_POST_ORDER,
+  // Every node at one depth before any node at the next depth
+  TOWER_CURSOR_LEVEL_ORDER,
+};
+
+// Create a cursor that walks every node of the subtree under root (including root) without recursion
+// If type is not null, only nodes with a component of that type are returned (their children are still walked)
+// A cursor can be reused for other subtrees (see tower_cursor_reset) to avoid allocating it's stack again
+TowerCursor* tower_cursor_create(TowerNode* root, TowerCursorOrder order, TowerNode* type = nullptr);
+
+// Destroy a cursor, which doesn't hold references to any nodes
+void tower_cursor_destroy(TowerCursor* cursor);
+
+// Start walking another subtree with the same order and type
+void tower_cursor_reset(TowerCursor* cursor, TowerNode* root);
+
+// Get the next node of the walk, or null once every node has been visited
+// In pre-order, the children of the node last returned can be changed before the next call (the walk
+// then visits whatever children it has), otherwise the subtree must not change during the walk
+TowerNode* tower_cursor_next(TowerCursor* cursor);
+
+// Don't walk the children of the node last returned, which is only supported in pre-order
+void tower_cursor_skip_children(TowerCursor* cursor);
+
 
 // Virtual destructor for a component
 typedef void (*TowerComponentDestructor)(TowerComponent* component, void* userdata);
@@ -130,10 +452,218 @@ TowerNode* tower_component_get_owner(TowerComponent* component);
 // This does NOT increment the reference count of the returned node
 TowerNode* tower_component_get_type(TowerComponent* component);
 
+// Get the size of the userdata section that was passed to tower_component_create
+size_t tower_component_get_data_bytes(TowerComponent* component);
+
 // Get a pointer to the arbitrary userdata section of the tower component
 // The size of the userdata section matches data_bytes passed in tower_component_create
+// The userdata is writable, so unless the owner is frozen this invalidates it's hash (see tower_node_hash)
 void* tower_component_get_userdata(TowerComponent* component);
 
 // From a pointer to a component's userdata section, get the original TowerComponent
 TowerComponent* tower_component_from_userdata(void* userdata);
 
+
+// Write the userdata of a component into a snapshot (see tower_snapshot_writer_write)
+typedef void (*TowerComponentSerialize)(TowerComponent* component, void* userdata, TowerSnapshotWriter* writer);
+
+// Construct the userdata of a component from the bytes written by it's serializer
+// The userdata is uninitialized memory of the same data_bytes the original component was created with
+typedef void (*TowerComponentDeserialize)(TowerComponent* component, void* userdata, const void* data, size_t bytes);
+
+// Describes a component type so that it can be found by name and it's components can be saved and loaded
+struct TowerTypeInfo {
+  // A unique name that identifies the type across runs of the program (the string is copied)
+  const char* name;
+  // The destructor given to components created when loading a snapshot
+  TowerComponentDestructor destructor;
+  // If the serializer is null, the userdata is copied as is (the type must be trivially copyable)
+  TowerComponentSerialize serialize;
+  // If the deserializer is null, the userdata is copied as is (the type must be trivially copyable)
+  TowerComponentDeserialize deserialize;
+  // The data_bytes every component of the type is created with, which loading checks untrusted input against
+  // This is required with a deserializer, and otherwise 0 allows any size (the payload is the userdata)
+  size_t data_bytes;
+};
+
+// Register a component type, which increments the reference count of the type until it's unregistered
+// A type and a name can only be registered once
+void tower_type_register(TowerNode* type, const TowerTypeInfo* info);
+
+// Unregister a component type and release the reference the registration held
+void tower_type_unregister(TowerNode* type);
+
+// Get the registered info of a type, or null if the type is not registered
+// The info remains valid until the type is unregistered
+const TowerTypeInfo* tower_type_get_info(TowerNode* type);
+
+// Find a registered type by name, or null if no type has the name
+// This does NOT increment the reference count of the returned node
+TowerNode* tower_type_find(const char* name);
+
+// Get the memory used by the live components of a type outside of arenas, where count is the number of
+// components and bytes includes their headers (whether or not they are within their node)
+TowerMemoryStats tower_type_get_memory_stats(TowerNode* type);
+
+// Start or stop keeping every live component of the type in a dense array, so that all of them can be
+// found without walking any trees (see tower_type_get_components and tower_type_get_subtree_components)
+// This must be set before any components of the type are created, and the type can't be within an arena
+void tower_type_set_indexed(TowerNode* type, bool indexed);
+
+// Return true if the type keeps an index of it's components
+bool tower_type_get_indexed(TowerNode* type);
+
+// Get every live component of an indexed type, in no particular order
+// The array is only valid until a component of the type is created or destroyed, or the type is queried again
+TowerComponent* const* tower_type_get_components(TowerNode* type, size_t* count);
+
+// Get the live components of an indexed type whose owners are within the subtree under root (including
+// root itself) in O(log n + matches), in pre-order of their owners
+// Nodes are given interval labels the first time their subtree is queried, which stay valid until
+// a child is attached or detached somewhere within the subtree. Whenever any subtree is labeled, the
+// next query of each type sorts it's components by the labels again
+// Components of shared nodes (see tower_interner_intern), and components still shared with the source
+// of a clone (see tower_node_clone_cow), are never found within a subtree
+// The array is only valid until a component of the type is created or destroyed, or the type is queried again
+TowerComponent* const* tower_type_get_subtree_components(TowerNode* type, TowerNode* root, size_t* count);
+
+// A change made within the subtree of a journal (see tower_journal_create)
+enum TowerJournalEvent {
+  // A child was attached to node, where subject is the child
+  TOWER_JOURNAL_ATTACH,
+  // A child was detached from node (or replaced by another child with the same member name), where subject is the child
+  TOWER_JOURNAL_DETACH,
+  // A component was created on node, where subject is the type
+  TOWER_JOURNAL_COMPONENT_CREATE,
+  // A component of node was handed out to be written to (see tower_node_get_component_for_write), where subject is the type
+  TOWER_JOURNAL_COMPONENT_WRITE,
+};
+
+struct TowerJournalEntry {
+  TowerJournalEvent event;
+  // Nodes are given as handles, since they may have been destroyed by the time the entry is read
+  TowerHandle node;
+  TowerHandle subject;
+  // The member name of the child that was attached or detached, or TOWER_ATOM_NONE
+  TowerAtom member;
+};
+
+// Create a journal that records every change made within the subtree under root (including root) into a
+// ring buffer of capacity entries (rounded up to a power of 2), to be drained in batches (see tower_journal_drain)
+// Changes are recorded for the node that changed, when root is that node or is above it at the time
+// Components are only destroyed along with their node, which has always been detached first, so the
+// detach is the only entry recorded for them
+// The journal holds a reference to root, so root can't be frozen and must be outlived by it's arena
+// Changes outside of any journal's subtree cost a relaxed atomic load and a flag check, while changes within
+// one walk up to the root, and creating the journal or moving a subtree into or out of one walks the subtree
+TowerJournal* tower_journal_create(TowerNode* root, size_t capacity = 4096);
+
+// Destroy a journal, dropping any entries that were not drained
+void tower_journal_destroy(TowerJournal* journal);
+
+// Move up to max_count of the oldest entries into entries, returning how many were moved
+// If the buffer filled up since the last drain, the oldest entries were overwritten, and how many were lost
+// is written to dropped (which can be null), in which case the whole subtree should be treated as changed
+size_t tower_journal_drain(TowerJournal* journal, TowerJournalEntry* entries, size_t max_count, size_t* dropped);
+
+
+// Append bytes to the payload of the component being serialized
+void tower_snapshot_writer_write(TowerSnapshotWriter* writer, const void* data, size_t bytes);
+
+// Save the subtree under root (the nodes, the order and member names of children, and components) into
+// a single block of memory that can be stored and later viewed or instantiated (see tower_snapshot_view)
+// The size of the snapshot is written to bytes, and the snapshot must be freed with tower_memory_free
+// Every component type within the subtree must be registered (see tower_type_register), otherwise null is returned
+void* tower_snapshot_create(TowerNode* root, size_t* bytes);
+
+// View a snapshot in place without copying or parsing it, or return null if the header or the bounds of it's
+// tables are not valid (which takes constant time, so the entries within the tables are not checked)
+// The data can come from anywhere, such as a memory mapped file, and it must outlive the view
+// The data must be 4 byte aligned, and 16 byte aligned for component payloads to be aligned
+// Within the view, nodes are referred to by index, where the root is always node 0
+// The getters below trust the entries, so untrusted data should only be read through them once
+// tower_snapshot_instantiate has succeeded on it (which checks every entry)
+const TowerSnapshot* tower_snapshot_view(const void* data, size_t bytes);
+
+// Get the number of nodes in the snapshot
+size_t tower_snapshot_get_node_count(const TowerSnapshot* snapshot);
+
+// Get the number of children of a node in the snapshot
+size_t tower_snapshot_get_child_count(const TowerSnapshot* snapshot, size_t node);
+
+// Get the node index of a child of a node in the snapshot
+size_t tower_snapshot_get_child(const TowerSnapshot* snapshot, size_t node, size_t index);
+
+// Get the member name of a child of a node in the snapshot, or null if the child has no name
+const char* tower_snapshot_get_child_member_name(const TowerSnapshot* snapshot, size_t node, size_t index);
+
+// Get the number of components of a node in the snapshot
+size_t tower_snapshot_get_component_count(const TowerSnapshot* snapshot, size_t node);
+
+// Get the registered type name of a component of a node in the snapshot
+const char* tower_snapshot_get_component_type_name(const TowerSnapshot* snapshot, size_t node, size_t index);
+
+// Get the serialized bytes of a component of a node in the snapshot, and write how many there are to bytes
+const void* tower_snapshot_get_component_payload(const TowerSnapshot* snapshot, size_t node, size_t index, size_t* bytes);
+
+// Create the nodes of a snapshot (optionally within an arena) and return the root with a reference count of 1
+// Components are created with the registered types of the same name, and if any type is not registered
+// nothing is created and null is returned
+// Every entry is checked before anything is created, and null is also returned if any of them is out of
+// bounds, the nodes don't form a tree, or a component's size doesn't match it's type (see TowerTypeInfo)
+TowerNode* tower_snapshot_instantiate(const TowerSnapshot* snapshot, TowerArena* arena);
+
+
+// Buffer flush for streamed output, the same as DebugFlush with the userdata given to the writer
+// Never assume that any of the data written is complete
+typedef void (*TowerJsonFlush)(const uint8_t* data, size_t length, void* userdata);
+
+// Write the subtree under root as JSON, handing the text to flush each time the buffer fills up
+// Each node is an object where every key is optional (and only written when not empty):
+//   {"member":"name","components":{"type name":[data_bytes,"hex payload"]},"children":[...]}
+// Component payloads are written the same as snapshots (see TowerTypeInfo), and every component type
+// within the subtree must be registered (see tower_type_register), otherwise false is returned and the
+// text already flushed is incomplete
+// Deep trees are written without recursion, and nothing is allocated per node
+bool tower_json_write(TowerNode* root, TowerJsonFlush flush, void* userdata, size_t buffer_size = 64 * 1024);
+
+// Create a reader that incrementally builds nodes (optionally within an arena) from JSON written by
+// tower_json_write, which can be fed any amount of text at a time
+TowerJsonReader* tower_json_reader_create(TowerArena* arena);
+
+// Destroy a reader, and release any nodes it created that were not returned by tower_json_reader_finish
+void tower_json_reader_destroy(TowerJsonReader* reader);
+
+// Feed more text to the reader, returning false if the text is not valid (after which the reader always fails)
+// The text is not required to be null terminated, and tokens can be split between calls
+bool tower_json_reader_feed(TowerJsonReader* reader, const char* data, size_t length);
+
+// Get the root node once all of the text has been fed, with a reference count of 1 for the caller
+// Returns null if the text was not valid or is incomplete
+TowerNode* tower_json_reader_finish(TowerJsonReader* reader);
+
+// Write the stats of every category and every type with live components, handing the text to flush
+// As JSON, this is {"categories":{"name":{"bytes":0,"count":0,"peak_bytes":0}},"types":{"name":{...}}}
+// and otherwise it's a table with a line per category and type, where types are prefixed by "type "
+// Types that were never registered are named by their id, such as "#12"
+void tower_memory_dump(TowerJsonFlush flush, void* userdata, bool json);
+
+// Sample roughly one allocation per interval bytes from tower_memory_allocate, recording the scopes and
+// call stack that made it (0 disables sampling, the default, which costs a countdown per allocation)
+// Samples are spaced out randomly by bytes, so large allocations are more likely to be sampled, and each
+// sample is weighted so the profile estimates every allocation rather than only the sampled ones
+// Other threads pick up a new interval within a megabyte of allocation, and the calling thread right away
+void tower_profiler_set_sample_interval(size_t bytes);
+size_t tower_profiler_get_sample_interval();
+
+// Name the work the calling thread is doing, which is recorded at the outermost end of sampled stacks
+// The name is not copied and must outlive the profile (canonically a string literal)
+// Scopes nest and must be popped in the reverse order they were pushed
+void tower_profiler_push_scope(const char* name);
+void tower_profiler_pop_scope();
+
+// Write the sampled profile as folded stacks, one line per stack: "scope;scope;0x1234;0x5678 bytes"
+// From the outermost frame to the innermost, where frames are return addresses (empty on WebAssembly)
+// The live profile only counts sampled allocations that have not been freed, and otherwise all of them
+// The output can be fed to flame graph tools, with addresses symbolized against the loaded binary
+void tower_profiler_dump(TowerJsonFlush flush, void* userdata, bool live);